@@ -6,7 +6,6 @@
 #include <stdio.h>
 #include <sys/select.h>
 #include <termios.h>
-#include <stropts.h>
 #include <unistd.h>
 #include <sys/ioctl.h>
 
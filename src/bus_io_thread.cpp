@@ -0,0 +1,214 @@
+#include "bus_io_thread.hpp"
+#include <chrono>
+
+/** @brief Open the serial port. The I/O thread is only started by start()
+*
+* @param[in] valid_com_name the serial port, as for HerkulexDriver
+*/
+BusIoThread::BusIoThread(std::string valid_com_name)
+	: hlx(valid_com_name), loop(10000000), running(false), dropped_commands(0)
+{
+}
+
+BusIoThread::~BusIoThread()
+{
+	stop();
+}
+
+/** @brief Set the motors whose telemetry is read every cycle. Must be called before start()
+*
+* @param[in] pIDs ids of the motors
+* @param[in] num_ids number of motors (at most BusSnapshot::kMaxServo)
+*
+* @return returns nothing
+*/
+void BusIoThread::setPolledServos(const char* pIDs, int num_ids)
+{
+	if (num_ids > BusSnapshot::kMaxServo)
+		num_ids = BusSnapshot::kMaxServo;
+	for (int i = 0; i < num_ids; i++)
+		polled[i] = pIDs[i];
+	num_polled = num_ids;
+}
+
+/** @brief Start the I/O thread
+*
+* @param[in] period_ns period of the I/O cycle in nanoseconds. Should be longer than the time to read the telemetry of all polled motors
+*
+* @return returns nothing
+*/
+void BusIoThread::start(long long period_ns)
+{
+	if (running)
+		return;
+	loop.setPeriod(period_ns);
+	running = true;
+	worker = std::thread([this]() { loop.run(ioCycle, this); });
+}
+
+/** @brief Stop the I/O thread. Commands still queued are not sent
+*
+* @return returns nothing
+*/
+void BusIoThread::stop()
+{
+	running = false;
+	if (worker.joinable())
+		worker.join();
+}
+
+void BusIoThread::ioCycle(void* context, long long cycle)
+{
+	BusIoThread* self = (BusIoThread*)context;
+	if (!self->running)
+	{
+		self->loop.stop();
+		return;
+	}
+
+	// all commands queued since the last cycle go out in one write
+	BusCommand command;
+	self->hlx.beginBatch();
+	while (self->commands.pop(command))
+		self->execute(command);
+	self->hlx.endBatch();
+
+	BusSnapshot& snapshot = self->snapshots.writeBuffer();
+	snapshot.num_servo = self->num_polled;
+	if (self->num_polled > 0)
+		self->hlx.readTelemetry(self->polled, self->num_polled, snapshot.telemetry);
+	snapshot.cycle = cycle;
+	snapshot.timestamp_us = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+	self->snapshots.publish();
+	self->states.publish(snapshot.telemetry, snapshot.num_servo, snapshot.timestamp_us);
+}
+
+void BusIoThread::execute(BusCommand& command)
+{
+	switch (command.type)
+	{
+	case BusCommand::kRunMotor:
+		hlx.runMotor(command.jog, command.num_jog);
+		break;
+	case BusCommand::kRunMotorIndividual:
+		hlx.runMotorIndividual(command.jog, command.num_jog);
+		break;
+	case BusCommand::kSetTorqueControl:
+		hlx.setTorqueControl(command.pID, command.value);
+		break;
+	case BusCommand::kSetLEDColour:
+		hlx.setLEDColour(command.pID, (LEDColour)command.value);
+		break;
+	case BusCommand::kSetControlMode:
+		hlx.setControlMode(command.pID, command.value);
+		break;
+	case BusCommand::kClearError:
+		hlx.clearError(command.pID);
+		break;
+	}
+}
+
+/** @brief Queue a command for the I/O thread. Does not block
+*
+* @param[in] command the command
+*
+* @return returns false if the queue is full (the command is dropped and counted in droppedCommandCount())
+*/
+bool BusIoThread::push(const BusCommand& command)
+{
+	if (commands.push(command))
+		return true;
+	dropped_commands++;
+	return false;
+}
+
+bool BusIoThread::pushJog(BusCommand::Type type, const S_JOG_TAG* entries, char num_entries)
+{
+	if (num_entries > BusCommand::kMaxJog)
+		return false;
+	BusCommand command;
+	command.type = type;
+	for (int i = 0; i < num_entries; i++)
+		command.jog[i] = entries[i];
+	command.num_jog = num_entries;
+	return push(command);
+}
+
+/** @brief Queue a S_JOG. See HerkulexDriver::runMotor
+*
+* @return returns false if the command could not be queued
+*/
+bool BusIoThread::runMotor(const S_JOG_TAG* sjog, char num_sjog)
+{
+	return pushJog(BusCommand::kRunMotor, sjog, num_sjog);
+}
+
+/** @brief Queue a I_JOG. See HerkulexDriver::runMotorIndividual
+*
+* @return returns false if the command could not be queued
+*/
+bool BusIoThread::runMotorIndividual(const S_JOG_TAG* ijog, char num_ijog)
+{
+	return pushJog(BusCommand::kRunMotorIndividual, ijog, num_ijog);
+}
+
+/** @brief Queue a torque control write. See HerkulexDriver::setTorqueControl
+*
+* @return returns false if the command could not be queued
+*/
+bool BusIoThread::setTorqueControl(char pID, int mode)
+{
+	BusCommand command;
+	command.type = BusCommand::kSetTorqueControl;
+	command.pID = pID;
+	command.value = mode;
+	return push(command);
+}
+
+/** @brief Queue a LED write. See HerkulexDriver::setLEDColour
+*
+* @return returns false if the command could not be queued
+*/
+bool BusIoThread::setLEDColour(char pID, LEDColour colour)
+{
+	BusCommand command;
+	command.type = BusCommand::kSetLEDColour;
+	command.pID = pID;
+	command.value = colour;
+	return push(command);
+}
+
+/** @brief Queue a control mode write. See HerkulexDriver::setControlMode
+*
+* @return returns false if the command could not be queued
+*/
+bool BusIoThread::setControlMode(char pID, int controlmode)
+{
+	BusCommand command;
+	command.type = BusCommand::kSetControlMode;
+	command.pID = pID;
+	command.value = controlmode;
+	return push(command);
+}
+
+/** @brief Queue a status error clear. See HerkulexDriver::clearError
+*
+* @return returns false if the command could not be queued
+*/
+bool BusIoThread::clearError(char pID)
+{
+	BusCommand command;
+	command.type = BusCommand::kClearError;
+	command.pID = pID;
+	return push(command);
+}
+
+/** @brief Get the latest telemetry published by the I/O thread. Wait-free
+*
+* @return returns the latest snapshot. It stays valid until the next call (cycle = -1 until the first cycle is done)
+*/
+const BusSnapshot& BusIoThread::snapshot()
+{
+	snapshots.update();
+	return snapshots.readBuffer();
+}
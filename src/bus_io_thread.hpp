@@ -0,0 +1,125 @@
+#ifndef BUS_IO_THREAD_HPP_
+#define BUS_IO_THREAD_HPP_
+
+#include <atomic>
+#include <thread>
+#include <string>
+#include "herkulex_driver.hpp"
+#include "control_loop.hpp"
+#include "spsc_queue.hpp"
+#include "triple_buffer.hpp"
+#include "servo_state_table.hpp"
+
+/** One command for the bus I/O thread
+* @param[in] type what to do
+* @param[in] pID id of the motor (kSetTorqueControl, kSetLEDColour, kSetControlMode, kClearError)
+* @param[in] value the torque mode, led colour or control mode
+* @param[in] jog the motors to move (kRunMotor, kRunMotorIndividual)
+* @param[in] num_jog number of entries in jog
+*/
+struct BusCommand
+{
+	static const int kMaxJog = 16;
+
+	enum Type
+	{
+		kRunMotor,				//S_JOG, see HerkulexDriver::runMotor
+		kRunMotorIndividual,	//I_JOG, see HerkulexDriver::runMotorIndividual
+		kSetTorqueControl,
+		kSetLEDColour,
+		kSetControlMode,
+		kClearError
+	};
+
+	Type type = kRunMotor;
+	char pID = 0;
+	int value = 0;
+	S_JOG_TAG jog[kMaxJog];
+	char num_jog = 0;
+};
+
+/** Telemetry of all polled motors, published once per I/O cycle
+* @param[out] cycle the I/O cycle that produced the snapshot
+* @param[out] timestamp_us monotonic time at the end of the reads in microseconds
+* @param[out] num_servo number of entries in telemetry
+* @param[out] telemetry one entry per polled motor, in the order given to BusIoThread::setPolledServos
+*/
+struct BusSnapshot
+{
+	static const int kMaxServo = 16;
+
+	long long cycle = -1;
+	long long timestamp_us = 0;
+	int num_servo = 0;
+	ServoTelemetry telemetry[kMaxServo];
+};
+
+/** Asynchronous HerkulexDriver: one thread owns the serial port and does all the bus I/O
+*
+* The application pushes commands into a lock-free SPSC ring (runMotor(), setTorqueControl(), ...) and reads the latest telemetry
+* from a wait-free triple buffer (snapshot()). Neither call blocks or makes a syscall, so the control computation overlaps with the bus transfers. \n
+* Every period, the I/O thread sends all queued commands in one TX burst, then reads the telemetry of the polled motors and publishes it. \n
+* The telemetry is also published to stateTable(), which any number of other threads (logger, UI, safety monitor) can read.
+*
+* Usage: \n
+* BusIoThread bus("/dev/ttyUSB0"); \n
+* bus.setPolledServos(pIDs, 3); \n
+* bus.start(10000000); // 100 Hz \n
+* bus.runMotor(sjog, 3); \n
+* const BusSnapshot& s = bus.snapshot();
+*
+* @note exactly one thread may push commands and one thread may call snapshot(). stateTable() and emergencyStop() can be used from any thread. driver() must only be used before start() or after stop()
+*
+* Created by:
+* @author Er Jie Kai (EJK)
+ */
+class BusIoThread
+{
+public:
+	static const int kQueueSize = 64;
+
+	BusIoThread(std::string valid_com_name);
+	~BusIoThread();
+
+	HerkulexDriver& driver() { return hlx; }
+	void setPolledServos(const char* pIDs, int num_ids);
+	void setRealtime(int priority, int cpu = -1) { loop.setRealtime(priority, cpu); }
+
+	void start(long long period_ns);
+	void stop();
+
+	bool push(const BusCommand& command);
+	bool runMotor(const S_JOG_TAG* sjog, char num_sjog);
+	bool runMotorIndividual(const S_JOG_TAG* ijog, char num_ijog);
+	bool setTorqueControl(char pID, int mode);
+	bool setLEDColour(char pID, LEDColour colour);
+	bool setControlMode(char pID, int controlmode);
+	bool clearError(char pID);
+
+	const BusSnapshot& snapshot();
+	void emergencyStop(bool brake = false) { hlx.emergencyStop(brake); } //any thread or signal handler. see HerkulexDriver::emergencyStop
+	const ServoStateTable& stateTable() const { return states; }
+
+	unsigned int droppedCommandCount() const { return dropped_commands; }
+	const ControlLoopStats& getStats() const { return loop.getStats(); } //only valid after stop()
+
+private:
+	HerkulexDriver hlx;
+	ControlLoop loop;
+	std::thread worker;
+	std::atomic<bool> running;
+
+	char polled[BusSnapshot::kMaxServo];
+	int num_polled = 0;
+
+	SpscQueue<BusCommand, kQueueSize> commands;
+	TripleBuffer<BusSnapshot> snapshots;
+	ServoStateTable states;
+	std::atomic<unsigned int> dropped_commands;
+
+	static void ioCycle(void* context, long long cycle);
+	void execute(BusCommand& command);
+	bool pushJog(BusCommand::Type type, const S_JOG_TAG* entries, char num_entries);
+};
+
+#endif /*BUS_IO_THREAD_HPP_*/
@@ -0,0 +1,410 @@
+#include "bus_load_planner.hpp"
+#include <cstring>
+#include <chrono>
+#include <thread>
+
+/** @brief Create a planner without any bus */
+BusLoadPlanner::BusLoadPlanner()
+{
+	for (int b = 0; b < kMaxBus; b++)
+		max_servo[b] = 0;
+	for (int i = 0; i < kMaxServo; i++)
+		planned[i] = 0;
+}
+
+/** @brief Add a bus
+*
+* @param[in] timing baudrate and turnaround of the bus
+* @param[in] max_servo maximum number of motors on the bus
+*
+* @return returns the index of the bus (same as in ServoNetwork), or -1 if kMaxBus buses were already added
+*/
+int BusLoadPlanner::addBus(const BusTiming& timing, int max_servo)
+{
+	if (num_bus >= kMaxBus)
+		return -1;
+	timings[num_bus] = timing;
+	this->max_servo[num_bus] = max_servo;
+	return num_bus++;
+}
+
+/** @brief Add a motor with its rates and its current bus
+*
+* @return returns false if kMaxServo motors were already added or the bus does not exist
+*/
+bool BusLoadPlanner::addServo(const ServoDemand& demand)
+{
+	if (num_servo >= kMaxServo || demand.bus < 0 || demand.bus >= num_bus)
+		return false;
+	demands[num_servo] = demand;
+	planned[num_servo] = demand.bus;
+	num_servo++;
+	return true;
+}
+
+/** @brief Bus time used by one motor on a bus, without the S_JOG header shared by the motors of the bus
+*
+* @param[in] demand the rates of the motor
+* @param[in] bus index of the bus
+*
+* @return returns the fraction of the bus time (eg: 0.25 = 250 ms of bus time per second)
+*/
+double BusLoadPlanner::servoLoad(const ServoDemand& demand, int bus) const
+{
+	const BusTiming& timing = timings[bus];
+	double us = demand.command_hz * timing.wireTime(4);
+	us += demand.poll_hz[kPollPosition] * timing.readTime(PollingScheduler::PositionRange::kLength);
+	us += demand.poll_hz[kPollStatus] * timing.readTime(PollingScheduler::StatusRange::kLength);
+	us += demand.poll_hz[kPollHealth] * timing.readTime(PollingScheduler::HealthRange::kLength);
+	return us / 1e6;
+}
+
+// computes the load of every bus for a placement, and returns the maximum utilization (> 1000 if a bus has too many motors)
+double BusLoadPlanner::evaluate(const int* placement, BusLoad* loads) const
+{
+	double max_command_hz[kMaxBus] = { 0 };
+	for (int b = 0; b < num_bus; b++)
+		loads[b] = BusLoad();
+	for (int i = 0; i < num_servo; i++)
+	{
+		int b = placement[i];
+		loads[b].num_servo++;
+		loads[b].utilization += servoLoad(demands[i], b);
+		if (demands[i].command_hz > max_command_hz[b])
+			max_command_hz[b] = demands[i].command_hz;
+	}
+
+	double worst = 0;
+	for (int b = 0; b < num_bus; b++)
+	{
+		// one S_JOG header ([FF][FF][size][pID][cmd][cs1][cs2][playtime]) per setpoint cycle of the bus
+		loads[b].utilization += max_command_hz[b] * timings[b].wireTime(BusTiming::kHeaderSize + 1) / 1e6;
+		loads[b].headroom = 1 - loads[b].utilization;
+		double u = loads[b].num_servo > max_servo[b] ? 1000 + loads[b].utilization : loads[b].utilization;
+		if (u > worst)
+			worst = u;
+	}
+	return worst;
+}
+
+// largest load first, each onto the bus where the maximum utilization grows the least
+void BusLoadPlanner::greedy(int* placement) const
+{
+	int order[kMaxServo];
+	double load[kMaxServo];
+	for (int i = 0; i < num_servo; i++)
+	{
+		load[i] = servoLoad(demands[i], 0);
+		int k = i;
+		while (k > 0 && load[order[k - 1]] < load[i])
+		{
+			order[k] = order[k - 1];
+			k--;
+		}
+		order[k] = i;
+	}
+
+	int placed[kMaxServo];
+	BusLoadPlanner partial(*this);
+	partial.num_servo = 0;
+	for (int n = 0; n < num_servo; n++)
+	{
+		int i = order[n];
+		partial.demands[n] = demands[i];
+		partial.num_servo = n + 1;
+
+		int best_bus = 0;
+		double best = -1;
+		BusLoad loads[kMaxBus];
+		for (int b = 0; b < num_bus; b++)
+		{
+			placed[n] = b;
+			double worst = partial.evaluate(placed, loads);
+			if (best < 0 || worst < best)
+			{
+				best = worst;
+				best_bus = b;
+			}
+		}
+		placed[n] = best_bus;
+		placement[i] = best_bus;
+	}
+}
+
+// moves or swaps motors while the maximum utilization decreases. returns the maximum utilization
+double BusLoadPlanner::improve(int* placement) const
+{
+	BusLoad loads[kMaxBus];
+	double best = evaluate(placement, loads);
+	bool improved = true;
+	while (improved)
+	{
+		improved = false;
+		for (int i = 0; i < num_servo && !improved; i++)
+		{
+			int from = placement[i];
+			for (int b = 0; b < num_bus && !improved; b++)
+			{
+				if (b == from)
+					continue;
+				placement[i] = b; // move
+				double worst = evaluate(placement, loads);
+				if (worst < best - 1e-9)
+				{
+					best = worst;
+					improved = true;
+					break;
+				}
+				for (int j = 0; j < num_servo; j++) // swap
+				{
+					if (placement[j] != b || j == i)
+						continue;
+					placement[j] = from;
+					worst = evaluate(placement, loads);
+					if (worst < best - 1e-9)
+					{
+						best = worst;
+						improved = true;
+						break;
+					}
+					placement[j] = b;
+				}
+				if (!improved)
+					placement[i] = from;
+			}
+		}
+	}
+	return best;
+}
+
+int BusLoadPlanner::moves(const int* placement) const
+{
+	int n = 0;
+	for (int i = 0; i < num_servo; i++)
+		n += placement[i] != demands[i].bus ? 1 : 0;
+	return n;
+}
+
+/** @brief Compute the placement that minimizes the utilization of the busiest bus
+*
+* @return returns the planned utilization of the busiest bus
+*/
+double BusLoadPlanner::plan()
+{
+	int from_current[kMaxServo];
+	int from_greedy[kMaxServo];
+	for (int i = 0; i < num_servo; i++)
+		from_current[i] = demands[i].bus;
+	evaluate(from_current, current_load);
+
+	double current_worst = improve(from_current);
+	greedy(from_greedy);
+	double greedy_worst = improve(from_greedy);
+
+	bool use_greedy = greedy_worst < current_worst - 1e-9 || (greedy_worst < current_worst + 1e-9 && moves(from_greedy) < moves(from_current));
+	memcpy(planned, use_greedy ? from_greedy : from_current, sizeof(int) * num_servo);
+	reduceMoves(planned);
+	return evaluate(planned, planned_load);
+}
+
+// puts motors back on their current bus, alone or in pairs that trade places, as long as the maximum utilization does not grow. returns the maximum utilization
+double BusLoadPlanner::reduceMoves(int* placement) const
+{
+	BusLoad loads[kMaxBus];
+	double best = evaluate(placement, loads);
+	for (int i = 0; i < num_servo; i++)
+	{
+		int to_i = placement[i];
+		if (to_i == demands[i].bus)
+			continue;
+
+		placement[i] = demands[i].bus;
+		double worst = evaluate(placement, loads);
+		if (worst < best + 1e-9)
+		{
+			best = worst;
+			continue;
+		}
+		bool reverted = false;
+		for (int j = 0; j < num_servo && !reverted; j++)
+		{
+			if (j == i || placement[j] == demands[j].bus || placement[j] != demands[i].bus || demands[j].bus != to_i)
+				continue;
+			placement[j] = to_i;
+			worst = evaluate(placement, loads);
+			if (worst < best + 1e-9)
+			{
+				best = worst;
+				reverted = true;
+			}
+			else
+			{
+				placement[j] = demands[i].bus;
+			}
+		}
+		if (!reverted)
+			placement[i] = to_i;
+	}
+	return best;
+}
+
+int BusLoadPlanner::find(char pID) const
+{
+	for (int i = 0; i < num_servo; i++)
+	{
+		if (demands[i].pID == pID)
+			return i;
+	}
+	return -1;
+}
+
+/** @brief Get the bus a motor should be wired to. Valid after plan()
+*
+* @return returns the index of the bus, or -1 if the motor is unknown
+*/
+int BusLoadPlanner::getPlannedBus(char pID) const
+{
+	int i = find(pID);
+	return i >= 0 ? planned[i] : -1;
+}
+
+/** @brief Get the id renumber() gives a motor: bus X kIdsPerBus + 1 + its rank among the motors of the bus (in the order they were added)
+*
+* @return returns the new id, or the same id if the motor is unknown
+*/
+char BusLoadPlanner::getPlannedId(char pID) const
+{
+	int i = find(pID);
+	if (i < 0)
+		return pID;
+	int rank = 0;
+	for (int j = 0; j < i; j++)
+		rank += planned[j] == planned[i] ? 1 : 0;
+	return (char)(planned[i] * kIdsPerBus + 1 + rank);
+}
+
+/** @brief number of motors that must be wired to another bus. Valid after plan() */
+int BusLoadPlanner::numMoves() const
+{
+	return moves(planned);
+}
+
+/** @brief How much all the rates can be multiplied before the busiest bus of the plan reaches max_utilization
+*
+* @param[in] max_utilization highest acceptable utilization of a bus (eg: 0.8 to leave room for retries)
+*
+* @return returns the factor (eg: 1.5 = every rate can be raised by 50%)
+*/
+double BusLoadPlanner::getMaxRateScale(double max_utilization) const
+{
+	double worst = 0;
+	for (int b = 0; b < num_bus; b++)
+	{
+		if (planned_load[b].utilization > worst)
+			worst = planned_load[b].utilization;
+	}
+	return worst > 0 ? max_utilization / worst : 0;
+}
+
+/** @brief Print the load of every bus now and after the plan, and the motors to rewire
+*
+* @return returns nothing
+*/
+void BusLoadPlanner::printReport() const
+{
+	for (int b = 0; b < num_bus; b++)
+	{
+		printf("Bus %d (%d baud): %d motors, %.1f%% used -> %d motors, %.1f%% used, %.1f%% headroom\n", b, timings[b].baudrate, current_load[b].num_servo,
+			100 * current_load[b].utilization, planned_load[b].num_servo, 100 * planned_load[b].utilization, 100 * planned_load[b].headroom);
+	}
+	for (int i = 0; i < num_servo; i++)
+	{
+		if (planned[i] != demands[i].bus)
+			printf("  move motor %d from bus %d to bus %d\n", (unsigned char)demands[i].pID, demands[i].bus, planned[i]);
+	}
+	printf("  %d moves, rates can be scaled by %.2f before a bus reaches 80%%\n", numMoves(), getMaxRateScale(0.8));
+}
+
+/** @brief Write the planned ids (see getPlannedId()) into the EEP of the motors, through the bus they are wired to now, and reboot them
+*
+* Motors are first moved to free temporary ids, so that no two motors ever share an id. Every temporary id is chosen before anything is written.
+* After each reboot, every motor is probed with STAT at the id it was given (temporary, then final): a motor that does not answer at its temporary id
+* is left there and not renumbered further. The driver forgets what it knew about the old and new ids (see HerkulexDriver::forgetServo()). \n
+* After the reboot the motors only answer to their new id:
+* rewire the motors listed by printReport(), then route them again (eg: ServoNetwork::discover() on a new ServoNetwork). \n
+* Must be called before network.start().
+*
+* @param[in] network the buses, in the same order as addBus()
+*
+* @return returns the number of motors renumbered that answer at their new id, or -1 if an id is invalid or there are not enough free temporary ids (nothing is written then)
+*/
+int BusLoadPlanner::renumber(ServoNetwork& network)
+{
+	bool used[HerkulexDriver::kNumServo] = { false };
+	for (int i = 0; i < num_servo; i++)
+	{
+		unsigned char id = (unsigned char)demands[i].pID;
+		unsigned char target = (unsigned char)getPlannedId(demands[i].pID);
+		if (id >= HerkulexDriver::kNumServo || target >= HerkulexDriver::kNumServo)
+		{
+			printf("BusLoadPlanner: motor %d cannot be given id %d\n", id, target);
+			return -1;
+		}
+		used[id] = true;
+		used[target] = true;
+	}
+
+	char temporary[kMaxServo];
+	int next_free = HerkulexDriver::kNumServo - 1;
+	for (int i = 0; i < num_servo; i++)
+	{
+		if (getPlannedId(demands[i].pID) == demands[i].pID)
+			continue;
+		while (next_free >= 0 && used[next_free])
+			next_free--;
+		if (next_free < 0)
+		{
+			printf("BusLoadPlanner: no free id left to move motor %d out of the way\n", (unsigned char)demands[i].pID);
+			return -1;
+		}
+		used[next_free] = true;
+		temporary[i] = (char)next_free;
+	}
+
+	bool moved[kMaxServo] = { false }; //the motor answered at its temporary id
+	int num_renumbered = 0;
+	for (int pass = 0; pass < 2; pass++)
+	{
+		for (int i = 0; i < num_servo; i++)
+		{
+			if (getPlannedId(demands[i].pID) == demands[i].pID || (pass == 1 && !moved[i]))
+				continue;
+			char from = pass == 0 ? demands[i].pID : temporary[i];
+			char to = pass == 0 ? temporary[i] : getPlannedId(demands[i].pID);
+			HerkulexDriver& hlx = network.bus(demands[i].bus).driver();
+			hlx.write<RegEEPID>(from, (unsigned char)to);
+			hlx.reboot(from);
+		}
+		std::this_thread::sleep_for(std::chrono::milliseconds((long long)kRebootMs));
+
+		for (int i = 0; i < num_servo; i++)
+		{
+			if (getPlannedId(demands[i].pID) == demands[i].pID || (pass == 1 && !moved[i]))
+				continue;
+			char from = pass == 0 ? demands[i].pID : temporary[i];
+			char to = pass == 0 ? temporary[i] : getPlannedId(demands[i].pID);
+			HerkulexDriver& hlx = network.bus(demands[i].bus).driver();
+			hlx.forgetServo(from);
+			hlx.forgetServo(to);
+			ServoStatus status;
+			bool answered = hlx.getStatus(to, status);
+			if (!answered)
+				printf("BusLoadPlanner: motor %d does not answer at id %d\n", (unsigned char)demands[i].pID, (unsigned char)to);
+			if (pass == 0)
+				moved[i] = answered;
+			else if (answered)
+				num_renumbered++;
+		}
+	}
+	return num_renumbered;
+}
@@ -0,0 +1,100 @@
+#ifndef BUS_LOAD_PLANNER_HPP_
+#define BUS_LOAD_PLANNER_HPP_
+
+#include "servo_network.hpp"
+#include "polling_scheduler.hpp"
+
+/** Bus traffic needed by one motor
+* @param[in] pID id of the motor
+* @param[in] bus the bus the motor is wired to now
+* @param[in] command_hz rate of its setpoints (S_JOG entries)
+* @param[in] poll_hz polling rate of every register group (see PollingScheduler)
+*/
+struct ServoDemand
+{
+	char pID = 0;
+	int bus = 0;
+	double command_hz = 0;
+	double poll_hz[kNumPollGroup] = { 0 };
+};
+
+/** Load of one bus
+* @param[out] num_servo number of motors on the bus
+* @param[out] utilization fraction of the bus time used by the setpoints and polls of its motors
+* @param[out] headroom 1 - utilization
+*/
+struct BusLoad
+{
+	int num_servo = 0;
+	double utilization = 0;
+	double headroom = 1;
+};
+
+/** Chooses which bus every motor should be wired to, so that the busiest bus is as little loaded as possible
+*
+* The load of a motor is the bus time of its setpoints and polls per second, from BusTiming (baudrate, turnaround and packet sizes): \n
+* polls: poll_hz X read time of the register group. setpoints: command_hz X wire time of one S_JOG entry,
+* plus one S_JOG header per bus at the highest command rate of the bus. \n
+* plan() starts from the current wiring and from a greedy placement (largest load first, onto the bus where it raises the maximum load the least),
+* improves both by moving or swapping motors while the maximum load decreases, and keeps the best one (fewest moves on ties). \n
+* A motor cannot be moved to another adapter by software: the plan lists the motors to rewire. renumber() then writes new EEP ids
+* (bus X kIdsPerBus + 1, + 2, ...), so that the id of every motor tells which adapter it belongs to, and the ids stay unique across the buses.
+*
+* Usage: \n
+* BusLoadPlanner planner; \n
+* planner.addBus(BusTiming(115200, 100)); \n
+* planner.addBus(BusTiming(115200, 100)); \n
+* planner.addServo(demand); // once per motor \n
+* planner.plan(); \n
+* planner.printReport();
+*
+* Created by:
+* @author Er Jie Kai (EJK)
+ */
+class BusLoadPlanner
+{
+public:
+	static const int kMaxBus = ServoNetwork::kMaxBus;
+	static const int kMaxServo = NetworkSnapshot::kMaxServo;
+	static const int kIdsPerBus = 32;	//renumber() gives the motors of bus b the ids b X kIdsPerBus + 1 and up
+	static const int kRebootMs = 500;	//time for a motor to boot after REBOOT
+
+	BusLoadPlanner();
+
+	int addBus(const BusTiming& timing, int max_servo = BusSnapshot::kMaxServo);
+	bool addServo(const ServoDemand& demand);
+
+	double servoLoad(const ServoDemand& demand, int bus) const;
+	double plan();
+
+	int getPlannedBus(char pID) const;
+	char getPlannedId(char pID) const;
+	int numMoves() const;
+	const BusLoad& getCurrentLoad(int bus) const { return current_load[bus]; }
+	const BusLoad& getPlannedLoad(int bus) const { return planned_load[bus]; }
+	double getMaxRateScale(double max_utilization = 0.8) const;
+	void printReport() const;
+
+	int renumber(ServoNetwork& network);
+
+private:
+	BusTiming timings[kMaxBus];
+	int max_servo[kMaxBus];
+	int num_bus = 0;
+
+	ServoDemand demands[kMaxServo];
+	int num_servo = 0;
+
+	int planned[kMaxServo];		//planned bus of every motor
+	BusLoad current_load[kMaxBus];
+	BusLoad planned_load[kMaxBus];
+
+	double evaluate(const int* placement, BusLoad* loads) const;
+	double improve(int* placement) const;
+	double reduceMoves(int* placement) const;
+	void greedy(int* placement) const;
+	int moves(const int* placement) const;
+	int find(char pID) const;
+};
+
+#endif /*BUS_LOAD_PLANNER_HPP_*/
@@ -0,0 +1,54 @@
+#ifndef BUS_TIMING_HPP_
+#define BUS_TIMING_HPP_
+
+/** Time that herkulex transactions take on the bus
+*
+* Every byte takes 10 bits on the wire (8N1), and a motor starts its reply turnaround_us after the end of the request. \n
+* Used to fit polls into a time budget, and by ServoBusSimulator to delay its replies like real motors.
+*
+* Created by:
+* @author Er Jie Kai (EJK)
+ */
+struct BusTiming
+{
+	static const int kBitsPerByte = 10;		//start bit + 8 data bits + stop bit
+	static const int kHeaderSize = 7;		//[FF][FF][size][pID][cmd][cs1][cs2]
+
+	int baudrate = 115200;
+	long turnaround_us = 100;
+
+	BusTiming() {}
+	BusTiming(int baudrate, long turnaround_us) : baudrate(baudrate), turnaround_us(turnaround_us) {}
+
+	/** @brief time to send bytes on the wire in microseconds */
+	long long wireTime(int bytes) const
+	{
+		return (long long)bytes * kBitsPerByte * 1000000LL / baudrate;
+	}
+
+	/** @brief time of a request followed by its reply in microseconds */
+	long long transactionTime(int request_bytes, int reply_bytes) const
+	{
+		return wireTime(request_bytes) + turnaround_us + wireTime(reply_bytes);
+	}
+
+	/** @brief time of a RAM_READ or EEP_READ of length registers, with its reply */
+	long long readTime(int length) const
+	{
+		return transactionTime(kHeaderSize + 2, kHeaderSize + 4 + length);
+	}
+
+	/** @brief time of a RAM_WRITE or EEP_WRITE of length registers, with its reply if ack is true */
+	long long writeTime(int length, bool ack) const
+	{
+		return ack ? transactionTime(kHeaderSize + 2 + length, kHeaderSize + 2) : wireTime(kHeaderSize + 2 + length);
+	}
+
+	/** @brief time of a STAT request with its reply */
+	long long statTime() const
+	{
+		return transactionTime(kHeaderSize, kHeaderSize + 2);
+	}
+};
+
+#endif /*BUS_TIMING_HPP_*/
@@ -0,0 +1,239 @@
+#include "control_loop.hpp"
+#include <stdio.h>
+#include <cstring>
+
+#ifdef __unix__
+#include <time.h>
+#include <errno.h>
+#include <sched.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#else
+#include <chrono>
+#include <thread>
+#endif
+
+void LatencyHistogram::reset()
+{
+	memset(buckets, 0, sizeof(buckets));
+	num_sample = 0;
+	sum_us = 0;
+	max_us = 0;
+}
+
+void LatencyHistogram::add(long long value_us)
+{
+	if (value_us < 0)
+		value_us = 0;
+	long long bucket = value_us / kBucketWidth;
+	if (bucket > kNumBucket)
+		bucket = kNumBucket;
+	buckets[bucket]++;
+	num_sample++;
+	sum_us += value_us;
+	if (value_us > max_us)
+		max_us = value_us;
+}
+
+/** @brief Get a percentile of the recorded durations
+*
+* @param[in] p the percentile (0 to 100)
+*
+* @return returns the upper edge of the bucket holding the percentile in microseconds (at most max())
+*/
+long long LatencyHistogram::percentile(double p) const
+{
+	if (num_sample == 0)
+		return 0;
+
+	long long target = (long long)(num_sample * p / 100.0);
+	if (target >= num_sample)
+		target = num_sample - 1;
+
+	long long seen = 0;
+	for (int i = 0; i <= kNumBucket; i++)
+	{
+		seen += buckets[i];
+		if (seen > target)
+		{
+			long long edge = (long long)(i + 1) * kBucketWidth;
+			return (i == kNumBucket || edge > max_us) ? max_us : edge;
+		}
+	}
+	return max_us;
+}
+
+/** @brief Get a monotonic timestamp in nanoseconds
+*
+* @return returns the current monotonic time in nanoseconds
+*/
+static long long monotonicNanos()
+{
+#ifdef __unix__
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+#else
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+/** @brief Sleep until an absolute monotonic time
+*
+* @param[in] when_ns the time to wake up in nanoseconds
+*
+* @return returns nothing
+*/
+static void sleepUntilNanos(long long when_ns)
+{
+#ifdef __unix__
+	struct timespec ts;
+	ts.tv_sec = when_ns / 1000000000LL;
+	ts.tv_nsec = when_ns % 1000000000LL;
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+	{
+	}
+#else
+	std::this_thread::sleep_until(std::chrono::steady_clock::time_point(std::chrono::nanoseconds(when_ns)));
+#endif
+}
+
+/** @brief Create a loop with a fixed period
+*
+* @param[in] period_ns period of the loop in nanoseconds (eg: 5000000 for 200 Hz)
+*/
+ControlLoop::ControlLoop(long long period_ns)
+	: period_ns(period_ns), running(false)
+{
+}
+
+/** @brief Run the loop in real-time mode
+*
+* Applied by run(), in the thread that calls run()
+*
+* @param[in] priority SCHED_FIFO priority (1 to 99). 0 = normal scheduling
+* @param[in] cpu the cpu to pin the thread to (-1 = any)
+* @param[in] lock_memory lock all current and future memory (mlockall) to avoid page faults in the loop
+*
+* @return returns nothing
+*/
+void ControlLoop::setRealtime(int priority, int cpu, bool lock_memory)
+{
+	this->priority = priority;
+	this->cpu = cpu;
+	this->lock_memory = lock_memory;
+}
+
+void ControlLoop::applyRealtime()
+{
+#ifdef __unix__
+	static_assert(sizeof(cpu_set_t) <= sizeof(saved_affinity), "saved_affinity is too small for cpu_set_t");
+	memory_locked = false;
+	cpu_pinned = false;
+
+	struct sched_param param;
+	pthread_getschedparam(pthread_self(), &saved_policy, &param);
+	saved_priority = param.sched_priority;
+
+	if (lock_memory)
+	{
+		memory_locked = mlockall(MCL_CURRENT | MCL_FUTURE) == 0;
+		if (!memory_locked)
+			printf("ControlLoop: mlockall failed (errno %d)\n", errno);
+	}
+
+	if (cpu >= 0)
+	{
+		pthread_getaffinity_np(pthread_self(), sizeof(cpu_set_t), (cpu_set_t*)saved_affinity);
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		CPU_SET(cpu, &set);
+		cpu_pinned = pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+		if (!cpu_pinned)
+			printf("ControlLoop: could not pin thread to cpu %d\n", cpu);
+	}
+
+	if (priority > 0)
+	{
+		memset(&param, 0, sizeof(param));
+		param.sched_priority = priority;
+		if (pthread_setschedparam(pthread_self(), SCHED_FIFO, &param) != 0)
+			printf("ControlLoop: could not set SCHED_FIFO priority %d\n", priority);
+	}
+#endif
+}
+
+void ControlLoop::restoreRealtime()
+{
+#ifdef __unix__
+	if (priority > 0)
+	{
+		struct sched_param param;
+		memset(&param, 0, sizeof(param));
+		param.sched_priority = saved_priority;
+		pthread_setschedparam(pthread_self(), saved_policy, &param);
+	}
+	if (cpu_pinned)
+		pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), (const cpu_set_t*)saved_affinity);
+	if (memory_locked)
+		munlockall();
+#endif
+}
+
+/** @brief Run the callback at the fixed period, in the calling thread
+*
+* Returns after num_cycle callbacks, or when stop() is called (from the callback or another thread)
+*
+* @param[in] callback called with (context, cycle number) every period
+* @param[in] context passed to callback
+* @param[in] num_cycle number of cycles to run (-1 = until stop())
+*
+* @return returns nothing
+*/
+void ControlLoop::run(Callback callback, void* context, long long num_cycle)
+{
+	applyRealtime();
+
+	stats = ControlLoopStats();
+	running = true;
+
+	long long deadline = monotonicNanos() + period_ns;
+	for (long long cycle = 0; running && (num_cycle < 0 || cycle < num_cycle); cycle++)
+	{
+		sleepUntilNanos(deadline);
+		long long wakeup = monotonicNanos();
+
+		callback(context, cycle);
+		long long done = monotonicNanos();
+
+		stats.cycles++;
+		stats.wakeup_latency.add((wakeup - deadline) / 1000);
+		stats.callback_duration.add((done - wakeup) / 1000);
+
+		deadline += period_ns;
+		if (done > deadline)
+		{
+			// overrun: skip the deadlines that already passed instead of running late cycles back to back
+			long long missed = (done - deadline) / period_ns + 1;
+			stats.overruns++;
+			stats.missed_deadlines += missed;
+			deadline += missed * period_ns;
+		}
+	}
+	running = false;
+
+	restoreRealtime();
+}
+
+/** @brief Print the statistics of the last run
+*
+* @return returns nothing
+*/
+void ControlLoop::printStats() const
+{
+	printf("ControlLoop %.1f Hz: %lld cycles, %lld overruns, %lld missed deadlines\n", 1e9 / period_ns, stats.cycles, stats.overruns, stats.missed_deadlines);
+	printf("  wakeup latency [us]: mean %.1f, p50 %lld, p99 %lld, max %lld\n", stats.wakeup_latency.mean(),
+		stats.wakeup_latency.percentile(50), stats.wakeup_latency.percentile(99), stats.wakeup_latency.max());
+	printf("  callback duration [us]: mean %.1f, p50 %lld, p99 %lld, max %lld\n", stats.callback_duration.mean(),
+		stats.callback_duration.percentile(50), stats.callback_duration.percentile(99), stats.callback_duration.max());
+}
@@ -0,0 +1,103 @@
+#ifndef CONTROL_LOOP_HPP_
+#define CONTROL_LOOP_HPP_
+
+#include <atomic>
+
+/** Histogram of durations in microseconds
+*
+* Linear buckets of kBucketWidth microseconds, plus one overflow bucket
+*/
+class LatencyHistogram
+{
+public:
+	static const int kBucketWidth = 10;		//microseconds per bucket
+	static const int kNumBucket = 2000;		//covers 0 to 20ms. longer durations go into the overflow bucket
+
+	LatencyHistogram() { reset(); }
+
+	void reset();
+	void add(long long value_us);
+	long long percentile(double p) const;
+
+	long long count() const { return num_sample; }
+	long long max() const { return max_us; }
+	double mean() const { return num_sample > 0 ? (double)sum_us / num_sample : 0.0; }
+
+private:
+	long long buckets[kNumBucket + 1];
+	long long num_sample;
+	long long sum_us;
+	long long max_us;
+};
+
+/** Statistics of a ControlLoop run
+* @param[out] cycles number of callbacks run
+* @param[out] overruns number of cycles where the callback finished after the next deadline
+* @param[out] missed_deadlines number of deadlines skipped because of overruns
+* @param[out] wakeup_latency time between the deadline and the actual wakeup
+* @param[out] callback_duration time spent in the callback
+*/
+struct ControlLoopStats
+{
+	long long cycles = 0;
+	long long overruns = 0;
+	long long missed_deadlines = 0;
+	LatencyHistogram wakeup_latency;
+	LatencyHistogram callback_duration;
+};
+
+/** Runs a callback at a fixed period
+*
+* Every deadline is computed from the start time (absolute deadlines), so the loop does not drift. On linux the thread sleeps with clock_nanosleep(TIMER_ABSTIME),
+* and can optionally run with SCHED_FIFO, locked memory (mlockall) and a fixed CPU. \n
+* When the callback overruns, the missed deadlines are skipped (no burst of late cycles) and counted.
+*
+* Usage: \n
+* ControlLoop loop(10000000); // 100 Hz \n
+* loop.setRealtime(80, 2); // SCHED_FIFO priority 80 on CPU 2 \n
+* loop.run(myControl, &myState);
+*
+* The scheduling, affinity and memory lock of the thread are restored when run() returns, so threads started afterwards do not inherit them.
+*
+* @note SCHED_FIFO and mlockall need root or CAP_SYS_NICE / CAP_IPC_LOCK. If they fail, the loop still runs and a warning is printed
+*
+* Created by:
+* @author Er Jie Kai (EJK)
+ */
+class ControlLoop
+{
+public:
+	typedef void (*Callback)(void* context, long long cycle);
+
+	ControlLoop(long long period_ns);
+
+	void setPeriod(long long period_ns) { this->period_ns = period_ns; }
+	void setRealtime(int priority, int cpu = -1, bool lock_memory = true);
+	void run(Callback callback, void* context, long long num_cycle = -1);
+	void stop() { running = false; }
+
+	const ControlLoopStats& getStats() const { return stats; }
+	void printStats() const;
+
+private:
+	long long period_ns;
+	int priority = 0;		//SCHED_FIFO priority (0 = normal scheduling)
+	int cpu = -1;			//cpu to run on (-1 = any)
+	bool lock_memory = false;
+	std::atomic<bool> running;
+	ControlLoopStats stats;
+
+	// scheduling of the thread before run(), restored when run() returns
+	int saved_policy = 0;
+	int saved_priority = 0;
+	bool memory_locked = false;
+	bool cpu_pinned = false;
+#ifdef __unix__
+	unsigned char saved_affinity[128];	//cpu_set_t, kept opaque to keep <sched.h> out of the header
+#endif
+
+	void applyRealtime();
+	void restoreRealtime();
+};
+
+#endif /*CONTROL_LOOP_HPP_*/
@@ -0,0 +1,47 @@
+#include "custom_baudrate.hpp"
+
+#ifdef __unix__
+
+#include <sys/ioctl.h>
+#include <asm/termbits.h>
+
+/** @brief Apply termios settings with any baudrate (TCSETS2 with BOTHER), in one ioctl
+*
+* @param[in] fd the opened port
+* @param[in] iflag, oflag, cflag, lflag the flags of the struct termios. the speed bits of cflag are replaced
+* @param[in] cc the control characters of the struct termios
+* @param[in] num_cc number of control characters in cc
+* @param[in] baudrate the baudrate in bits per second
+*
+* @return returns 0 if successful, else -1
+*/
+int setCustomBaudrate(int fd, unsigned int iflag, unsigned int oflag, unsigned int cflag, unsigned int lflag, const unsigned char* cc, int num_cc, int baudrate)
+{
+	struct termios2 tio;
+	if (ioctl(fd, TCGETS2, &tio) != 0)
+		return -1;
+
+	tio.c_iflag = iflag;
+	tio.c_oflag = oflag;
+	tio.c_cflag = (cflag & ~(CBAUD | (CBAUD << IBSHIFT))) | BOTHER | (BOTHER << IBSHIFT);
+	tio.c_lflag = lflag;
+	for (int i = 0; i < num_cc && i < NCCS; i++)
+		tio.c_cc[i] = cc[i];
+	tio.c_ispeed = baudrate;
+	tio.c_ospeed = baudrate;
+	return ioctl(fd, TCSETS2, &tio) == 0 ? 0 : -1;
+}
+
+/** @brief Get the baudrate of a port, including the ones set with BOTHER
+*
+* @return returns the output baudrate in bits per second, or 0 if it cannot be read
+*/
+int getCustomBaudrate(int fd)
+{
+	struct termios2 tio;
+	if (ioctl(fd, TCGETS2, &tio) != 0)
+		return 0;
+	return (int)tio.c_ospeed;
+}
+
+#endif
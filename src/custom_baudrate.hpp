@@ -0,0 +1,19 @@
+#ifndef CUSTOM_BAUDRATE_HPP_
+#define CUSTOM_BAUDRATE_HPP_
+
+#ifdef __unix__
+
+/** Baudrates without a termios Bxxx constant (eg: the 666666 baud of herkulex motors), with the linux termios2 ioctls
+*
+* <asm/termbits.h> (struct termios2, BOTHER) cannot be included together with <termios.h>, so these functions live in their own file
+* and only take plain integers. The flags and control characters are the ones of the struct termios of the caller.
+*
+* Created by:
+* @author Er Jie Kai (EJK)
+ */
+int setCustomBaudrate(int fd, unsigned int iflag, unsigned int oflag, unsigned int cflag, unsigned int lflag, const unsigned char* cc, int num_cc, int baudrate);
+int getCustomBaudrate(int fd);
+
+#endif
+
+#endif /*CUSTOM_BAUDRATE_HPP_*/
@@ -1,17 +1,48 @@
 #include "herkulex_driver.hpp"
+#include <cmath>
+#include <chrono>
+#include <thread>
+
+/** @brief Get a monotonic timestamp in microseconds
+*
+* @return returns the current time in microseconds
+*/
+static long long nowMicros()
+{
+	return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+#if defined(_WIN32) || defined(WIN32)
 #include "enumser.h" //find valid comport
+#endif
 
 /** @brief Connect to the USB serial device and configure the port settings.
 *
 * This function will search all connected comport for a matching comport name and connect to it.
+* On linux, valid_com_name is the device path of the port (eg: /dev/ttyUSB0), its name (eg: ttyUSB0), or the USB attributes of the adapter
+* (eg: "serial=A50285BI", "0403:6001"). USB attributes are looked up by SerialPortFinder, which caches the tty it found in ~/.cache/herkulex_serial_ports
 *
 * @param[in] valid_com_port the com port name to match
+* @param[in] baudrate baudrate of the motors (115200 at the factory). See detectBaudrate() if it is not known
 *
 * @return returns nothing
 */
-HerkulexDriver::HerkulexDriver(std::string valid_com_name)
+HerkulexDriver::HerkulexDriver(std::string valid_com_name, int baudrate)
 {
-
+#ifdef __unix__
+	std::string device = SerialPortFinder().resolve(valid_com_name);
+	if (device == valid_com_name)
+		printf("Connecting to %s\n", device.c_str());
+	else
+		printf("Connecting to %s (%s)\n", device.c_str(), valid_com_name.c_str());
+	sp.Open(device.c_str());
+	if (!sp.good())
+	{
+		std::cerr << "[" << __FILE__ << ":" << __LINE__ << "] "
+			<< "Error: Could not open serial port: " << valid_com_name
+			<< std::endl;
+		exit(1);
+	}
+#else
 	int valid_port_num = getValidComPort(valid_com_name);
 
 	printf("Connecting to COM%d\n", valid_port_num);
@@ -23,10 +54,24 @@ HerkulexDriver::HerkulexDriver(std::string valid_com_name)
 			<< std::endl;
 		exit(1);
 	}
+#endif
+
+	this->baudrate = baudrate;
+	sp.configurePort(baudrate, 8, PARITY_NONE, 1, 0);
 
-	sp.configurePort(BAUD_115200, 8, PARITY_NONE, 1, 0);
+	estop_latched = false;
+	estop_count = 0;
+	estop_brake = false;
+	tx_largest_packet = 0;
+	estop_latency_us = -1;
+	estop_max_latency_us = -1;
+	const char torque_free[] = { (char)RegTorqueControl::kAddress, 1, 0x00 };
+	const char brake[] = { (char)RegTorqueControl::kAddress, 1, 0x40 };
+	estop_packet_size = PacketEncoder::encode(estop_packets[0], sizeof(estop_packets[0]), (char)kBroadcastID, kRAM_WRITE, torque_free, 3);
+	PacketEncoder::encode(estop_packets[1], sizeof(estop_packets[1]), (char)kBroadcastID, kRAM_WRITE, brake, 3);
 }
 
+#if defined(_WIN32) || defined(WIN32)
 /** @brief Get all the connected IMU on windows machine
 *
 * This function is only necessary on windows.\n
@@ -61,301 +106,1843 @@ int HerkulexDriver::getValidComPort(std::string valid_com_name)
 
 	return valid_com_port;
 }
+#endif
 
+/** @brief Encode a packet into the TX buffer and send it
+*
+* When a batch is open (beginBatch()), the packet is only queued. It is sent together with the rest of the batch in endBatch()
+*
+* @param[in] pID id of the motor
+* @param[in] cmd the herkulex command
+* @param[in] data the payload
+* @param[in] datalen length of the payload
+* @param[in] printCommand print the packet in hex
+*
+* @return returns nothing
+*/
 void HerkulexDriver::send(char pID, HerkulexCmd cmd, char* data, char datalen, bool printCommand)
 {
-	char packetsize = 7 + datalen;
-	char* command = new char[packetsize];
+	queueShadowWrites(); // keep the order of the writes
+	if (!tx.add(pID, cmd, data, (unsigned char)datalen))
+	{
+		flush(); // TX buffer full. send what has been queued and start again
+		if (!tx.add(pID, cmd, data, (unsigned char)datalen))
+			return; // too long for one packet
+	}
+
+	if (printCommand == true || print_commands == true)
+		printHexCommand(tx.data() + tx.size() - PacketEncoder::kHeaderSize - (unsigned char)datalen, PacketEncoder::kHeaderSize + (unsigned char)datalen);
+
+	if (!batching)
+		flush();
+}
+
+/** @brief Write all queued packets to the port in a single write
+*
+* @return returns nothing
+*/
+void HerkulexDriver::flush()
+{
+	queueShadowWrites();
+	writeTx();
+}
 
-	//checksum 1
-	char checksum1 = packetsize ^ pID ^ cmd;
-	for (int i = 0; i < datalen; i++)
-		checksum1 = checksum1 ^ data[i];
-	checksum1 = checksum1 & 0xFE;
+/** @brief Write the TX buffer to the port as it is
+*
+* An emergencyStop() from another thread or a signal handler can run between the estop_latched check and the end of the write.
+* The packets written after its stop packet would then override it, so the stop is sent again after them.
+*
+* @return returns nothing
+*/
+void HerkulexDriver::writeTx()
+{
+	unsigned int generation = estop_count.load(std::memory_order_acquire);
+	if (estop_latched)
+		tx.removeIf(isCommandPacket); // only reads go out until clearEmergencyStop()
+	if (tx.empty())
+		return;
 
-	//checksum 2
-	char checksum2 = ~checksum1 & 0xFE;
+	int largest = 0;
+	for (int i = 0; i < tx.size(); i += (unsigned char)tx.data()[i + 2])
+		largest = (unsigned char)tx.data()[i + 2] > largest ? (unsigned char)tx.data()[i + 2] : largest;
+	tx_largest_packet.store(largest, std::memory_order_relaxed);
+	sp.write(tx.data(), tx.size());
+	tx.clear();
+	if (estop_count.load(std::memory_order_acquire) != generation)
+		resendEmergencyStop();
+}
 
-	command[0] = 0xFF;
-	command[1] = 0xFF;
-	command[2] = packetsize;
-	command[3] = pID;
-	command[4] = cmd;
-	command[5] = checksum1;
-	command[6] = checksum2;
-	for (int i = 0; i < datalen; i++)
-		command[7 + i] = data[i];
-	
-	if(printCommand ==  true)
-		printHexCommand(command, packetsize);
+/** @brief Encode the dirty registers of the shadow into the TX buffer
+*
+* Every block of adjacent dirty registers of a motor becomes one RAM_WRITE (or EEP_WRITE) packet
+*
+* @return returns nothing
+*/
+void HerkulexDriver::queueShadowWrites()
+{
+	runPendingRecovery(); // recovery writes go out before anything else
+	if (!shadow.anyDirty())
+		return;
 
-	sp.write(command, packetsize);
+	for (int pID = 0; pID < RegisterShadow::kNumServo; pID++)
+	{
+		if (!shadow.isDirty(pID))
+			continue;
 
-	delete[] command;
+		for (int eep = 0; eep < 2; eep++)
+		{
+			int address = 0;
+			int len = 0;
+			const unsigned char* values = nullptr;
+			while (shadow.takeDirtyRun(pID, eep == 1, address, len, values))
+			{
+				char* data = tx.beginPacket(pID, eep ? kEEP_WRITE : kRAM_WRITE, 2 + len);
+				if (data == nullptr)
+				{
+					writeTx(); // TX buffer full. send what has been queued and start again
+					data = tx.beginPacket(pID, eep ? kEEP_WRITE : kRAM_WRITE, 2 + len);
+				}
+				data[0] = (char)address;
+				data[1] = (char)len;
+				memcpy(data + 2, values, len);
+				tx.endPacket();
+			}
+		}
+	}
 }
 
-void HerkulexDriver::read(char* buffer)
+/** @brief Enable or disable the register shadow
+*
+* When enabled, the driver remembers the register values it wrote or read for every motor, and does not send writes of values the motor already has.
+* Inside a batch (beginBatch()/endBatch()), adjacent registers written to the same motor are merged into one packet.
+*
+* @param[in] enabled true to enable the shadow
+*
+* @return returns nothing
+*/
+void HerkulexDriver::setShadowEnabled(bool enabled)
 {
-	sp.read(buffer);
+	flush();
+	shadow_enabled = enabled;
+	shadow.invalidateAll();
 }
 
-void HerkulexDriver::printHexCommand(char* data, char len)
+/** @brief Forget the register values known for a motor
+*
+* Call this when the motor may have changed its registers by itself
+*
+* @param[in] pID id of the motor (kBroadcastID for all motors)
+*
+* @return returns nothing
+*/
+void HerkulexDriver::invalidateShadow(char pID)
 {
-	printf("send command: ");
-	for (int i = 0; i < len; i++)
+	if ((unsigned char)pID == kBroadcastID)
 	{
-		unsigned char temp = data[i];
-		if (temp < 16)
-			printf("0%x ", temp);
-		else
-			printf("%x ", temp);
+		for (int i = 0; i < RegisterShadow::kNumServo; i++)
+			shadow.invalidate(i);
+	}
+	else
+	{
+		shadow.invalidate(pID);
 	}
-	printf("\n");
 }
 
-void HerkulexDriver::setLEDColour(char pID, LEDColour colour)
+/** @brief Forget everything known about an id: its register values, round trip time and cached status
+*
+* Call this when another motor may answer to the id (eg: after writing a new EEP id and rebooting)
+*
+* @param[in] pID id of the motor
+*
+* @return returns nothing
+*/
+void HerkulexDriver::forgetServo(char pID)
 {
-	char data[] = { 53, 1, colour };
-	send(pID, kRAM_WRITE, data, 3);
+	invalidateShadow(pID);
+	unsigned char id = (unsigned char)pID;
+	if (id >= kNumServo)
+		return;
+	rtt[id] = RttEstimator();
+	status_table[id] = StatusEntry();
 }
 
-/** @brief set the acknowledge policy
+/** @brief Start queueing commands instead of sending them one by one
 *
-* Sets ACK Packet reply policy(1) when Request Packet is received. \n
-* ACK Policy(RAM Register Address 1)\n
-* 0 : No reply to any Request Packet\n
-* 1 : Only reply to Read CMD\n (default)
-* 2 : Reply to all Request Packet\n
+* All commands until endBatch() are encoded back to back into one TX buffer and go out in a single write.
+* Reading functions (eg: getAbsoluteAngle) send the queued commands before waiting for their reply.
 *
-* @param[in] pID id of the motor
-* @param[in] policy the acknowledge policy
+* @return returns nothing
+*/
+void HerkulexDriver::beginBatch()
+{
+	batching = true;
+}
+
+/** @brief Send all the commands queued since beginBatch()
 *
-* @return return nothing
+* @return returns nothing
 */
-void HerkulexDriver::setAcknowledgePolicy(char pID, int policy)
+void HerkulexDriver::endBatch()
 {
-	char data[] = { 1, 1, policy };
-	send(pID, kRAM_WRITE, data, 3);
+	batching = false;
+	flush();
 }
 
-/** @brief set the control mode
+/** @brief Take the next valid packet from the framer, and record the status it carries
 *
-* Sets control mode (56): \n
-* 0 : Position control (default)
-* 1 : Turn/Velocity Control(Continuous rotation)
+* Every ACK packet ends with [status error][status detail], so the status table is updated by every reply without any STAT request
 *
-* @note Torque control must be set to "Torque ON" (0x60) for motor to move
+* @param[out] packet the packet
+*
+* @return returns false if there is no complete packet
+*/
+bool HerkulexDriver::nextPacket(HerkulexPacket& packet)
+{
+	if (!framer.next(packet))
+		return false;
+
+	int len = packet.dataLength();
+	if ((packet.cmd() & 0x40) && len >= 2 && packet.pID() < kNumServo)
+		harvestStatus(packet.pID(), ServoStatus(packet.data()[len - 2], packet.data()[len - 1]));
+	return true;
+}
+
+/** @brief Update the status table of a motor
+*
+* Calls the status callback when the status changed. When it changed to an error, the recovery policy is applied before the next packet is sent
 *
 * @param[in] pID id of the motor
-* @param[in] controlmode the control mode
+* @param[in] status the status from the ACK packet
 *
-* @return return nothing
+* @return returns nothing
 */
-void HerkulexDriver::setControlMode(char pID, int controlmode)
+void HerkulexDriver::harvestStatus(unsigned char pID, const ServoStatus& status)
+{
+	StatusEntry& entry = status_table[pID];
+	ServoStatus previous = entry.status;
+	bool changed = entry.updated_us < 0 || previous != status;
+
+	entry.status = status;
+	entry.updated_us = nowMicros();
+	if (!changed)
+		return;
+
+	if (status.hasError() && recovery_policy != kRecoverNone)
+	{
+		entry.recovery_pending = true;
+		any_recovery_pending = true;
+	}
+	if (status_callback != nullptr)
+		status_callback(status_context, (char)pID, previous, status);
+}
+
+/** @brief Apply the recovery policy to the motors whose status changed to an error
+*
+* @return returns nothing
+*/
+void HerkulexDriver::runPendingRecovery()
 {
-	char data[] = { 56, 1, controlmode };
-	send(pID, kRAM_WRITE, data, 3);
+	if (in_recovery || !any_recovery_pending)
+		return;
+
+	in_recovery = true;
+	any_recovery_pending = false;
+	for (int pID = 0; pID < kNumServo; pID++)
+	{
+		if (!status_table[pID].recovery_pending)
+			continue;
+		status_table[pID].recovery_pending = false;
+		handleStatus((char)pID, status_table[pID].status);
+	}
+	in_recovery = false;
 }
 
-/** @brief set the Torque Control
+/** @brief set the function called when the status reported by a motor changes
 *
-* Sets torque control (52): \n
-* 0 (0x00) : Torque free
-* 1 (0x40) : Brake on
-* 2 (0x60) : Torque On
+* @param[in] callback called with (context, pID, previous status, new status). Runs in the thread that received the reply
+* @param[in] context passed to callback
+*
+* @return returns nothing
+*/
+void HerkulexDriver::setStatusCallback(StatusChangeCallback callback, void* context)
+{
+	status_callback = callback;
+	status_context = context;
+}
+
+/** @brief get the latest status reported by a motor, without any bus traffic
 *
 * @param[in] pID id of the motor
-* @param[in] controlmode the control mode
+* @param[out] status the latest status
+* @param[out] age_us time since the status was received in microseconds (optional)
 *
-* @return return nothing
+* @return returns false if the motor never replied
 */
-void HerkulexDriver::setTorqueControl(char pID, int mode)
+bool HerkulexDriver::getCachedStatus(char pID, ServoStatus& status, long long* age_us)
 {
-	char torque_control_mode = 0;
-	if (mode == 0)
-		torque_control_mode = 0x00;
-	else if (mode == 1)
-		torque_control_mode = 0x40;
-	else if (mode == 2)
-		torque_control_mode = 0x60;
+	unsigned char id = (unsigned char)pID;
+	if (id >= kNumServo || status_table[id].updated_us < 0)
+		return false;
 
-	char data[] = { 52, 1, torque_control_mode };
-	send(pID, kRAM_WRITE, data, 3);
+	status = status_table[id].status;
+	if (age_us != nullptr)
+		*age_us = nowMicros() - status_table[id].updated_us;
+	return true;
 }
 
+/** @brief STAT reply sink. The status itself is recorded by nextPacket */
+static bool statusSink(void*, int, const HerkulexPacket* packet, long long)
+{
+	return packet != nullptr && packet->dataLength() == 2;
+}
 
-/** gets the absolute angle
-* Absolute position Raw Data (60)
-* Angle = r(Absolute Position) X 0.325
+/** @brief make sure the status of every motor is at most max_age_us old
 *
-* @param[in] pID id of the motor
+* Only the motors that did not reply to anything within max_age_us get a STAT request (pipelined).
 *
-* @return return the absolute angle of the motor
+* @param[in] pIDs ids of the motors
+* @param[in] num_ids number of ids
+* @param[in] max_age_us maximum age of the status in microseconds
+*
+* @return returns the number of STAT requests sent
 */
-float HerkulexDriver::getAbsoluteAngle(char pID)
+int HerkulexDriver::refreshStatus(const char* pIDs, int num_ids, long max_age_us)
 {
-	const int return_bytes = 2;
-	char data[] = { 60, return_bytes };
-	send(pID, kRAM_READ, data, 2);
-	char buffer[11 + return_bytes];//2 for header, 1 for packet size, 1 for pID, 1 for cmd, 2 for checksum, 1 for add, 1 for length, return_bytes for data, 1 for status error. 1 for status detail
-	read(buffer);
-	//printf("Return Buffer: ");
-	//for (int i = 9; i < 11 + return_bytes; i++)
-	//	printf("%x ", (unsigned char)buffer[i]);
-	//printf("\n");
-	unsigned short absolute_position = varc.Char2Short(buffer + 9);
-	//printf("Angle = %hd\n", absolute_position);
-	float absolute_angle = absolute_position * 0.325;
-	return absolute_angle;
+	char stale[kNumServo];
+	int num_stale = 0;
+	long long now = nowMicros();
+	for (int i = 0; i < num_ids && num_stale < kNumServo; i++)
+	{
+		unsigned char id = (unsigned char)pIDs[i];
+		if (id >= kNumServo)
+			continue;
+		if (status_table[id].updated_us < 0 || now - status_table[id].updated_us > max_age_us)
+			stale[num_stale++] = pIDs[i];
+	}
+
+	if (num_stale > 0)
+		pipelinedRequest(stale, num_stale, kSTAT, nullptr, 0, statusSink, nullptr);
+	return num_stale;
 }
 
-/** gets the calibrated angle
-* Calibrated position Data (58)
+/** @brief Wait for the reply (ACK) packet of a command
 *
-* @param[in] pID id of the motor
+* Reads from the port into the packet framer until a valid packet from pID with the ACK of cmd (cmd | 0x40) arrives.
+* Packets from other servos or for other commands are discarded.
 *
-* @return return the calibrated angle of the motor
+* @param[in] pID id of the motor that should reply
+* @param[in] cmd the command that was sent
+* @param[out] packet the reply packet. valid until the next call to receive
+* @param[in] address for reads, the register address the reply must start with. Late replies to older reads of other registers are discarded (-1 = any)
+* @param[in] timeout_us maximum time to wait in microseconds (-1 = reply_timeout_us)
+* @param[in] reply_size size of the expected reply packet. With setLowLatency(), reads wake up when it has arrived (0 = unknown)
+* @param[in] earliest_us a matching reply found before this time came faster than the request and the reply take on the wire:
+* it is a late reply to an earlier request, and is discarded (0 = none)
+*
+* @return returns true if the reply arrived before the timeout, else false
 */
-float HerkulexDriver::getCalibratedAngle(char pID)
+bool HerkulexDriver::receive(char pID, HerkulexCmd cmd, HerkulexPacket& packet, int address, long timeout_us, int reply_size, long long earliest_us)
 {
-	const int return_bytes = 2;
-	char data[] = { 58, return_bytes };
-	send(pID, kRAM_READ, data, 2);
-	char buffer[11 + return_bytes] = { 0 };//2 for header, 1 for packet size, 1 for pID, 1 for cmd, 2 for checksum, 1 for add, 1 for length, return_bytes for data, 1 for status error. 1 for status detail
-	read(buffer);
-	//printf("Return Buffer: ");
-	//for (int i = 9; i < 11 + return_bytes; i++)
-	//	printf("%x ", (unsigned char)buffer[i]);
-	//printf("\n");
-	unsigned short calibrated_position = varc.Char2Short(buffer + 9);
-	calibrated_position = calibrated_position & 0b000001111111111;
-	//float absolute_angle = absolute_position * 0.325;
-	return calibrated_position;
+	const unsigned char ack_cmd = (unsigned char)cmd | 0x40;
+	flush(); // make sure the request has actually been sent
+	if (timeout_us < 0)
+		timeout_us = reply_timeout_us;
+	std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() + std::chrono::microseconds(timeout_us);
+
+	while (true)
+	{
+		if (abortPending())
+		{
+			handleAbort(); // emergencyStop() was called. do not wait for the reply
+			return false;
+		}
+
+		while (nextPacket(packet))
+		{
+			if (packet.pID() == (unsigned char)pID && packet.cmd() == ack_cmd && (address < 0 || (packet.dataLength() > 0 && packet.data()[0] == address))
+				&& (earliest_us <= 0 || nowMicros() >= earliest_us))
+				return true;
+		}
+
+		long remaining_us = (long)std::chrono::duration_cast<std::chrono::microseconds>(deadline - std::chrono::steady_clock::now()).count();
+		if (remaining_us <= 0)
+			return false;
+
+		sp.setReadMinimum(reply_size_wakeup && reply_size > 0 ? reply_size - framer.available() : 1);
+		sp.setTimeout(remaining_us);
+		int nbr = sp.readsome(framer.writePtr(), framer.writeSpace());
+		framer.commit(nbr);
+	}
 }
 
-/** gets the status error and status detail
-* 
-* Status Error:
-* Bit Value Comment
-* 0   0X01  Exceed Input Voltage limit
-* 1   0X02  Exceed allowed POT limit
-* 2   0X04  Exceed Temperature limit
-* 3   0X08  Invalid Packet
-* 4   0X10  Overload detected
-* 5   0X20  Driver fault detected
-* 6   0X40  EEP REG distorted
-* 7   0X80  reserved
+/** @brief Send a read request (RAM_READ, EEP_READ or STAT) and wait for its reply, sending it again after a timeout
 *
-* Status Detail:
-* Bit Value Comment
-* 0   0X01  Moving flag
-* 1   0X02  Inposition flag
-* 2   0X04  Checksum Error
-* 3   0X08  Unknown Command
-* 4   0X10  Exceed REG range
-* 5   0X20  Garbage detected
-* 6   0X40  MOTOR_ON flag
-* 7   0X80  reserved
+* The timeout comes from the round trip time of the motor (see setAdaptiveTimeout()), so a lost reply costs about one round trip time.
+* The request is sent at most 1 + read_retries times. Only use it for requests that can safely be repeated.
 *
 * @param[in] pID id of the motor
+* @param[in] cmd the command
+* @param[in] data the payload
+* @param[in] datalen length of the payload
+* @param[out] packet the reply packet. valid until the next call to receive
+* @param[in] address see receive()
 *
-* return integer of combined status_error<<8 & status_detail
+* @return returns true if a reply arrived, else false
 */
-int HerkulexDriver::getError(char pID)
+bool HerkulexDriver::request(char pID, HerkulexCmd cmd, char* data, char datalen, HerkulexPacket& packet, int address)
+{
+	int request_size = PacketEncoder::kHeaderSize + datalen;
+	int reply_size = replySize(cmd, data, datalen);
+	long long first_sent_us = 0;
+	for (int attempt = 0; ; attempt++)
+	{
+		discardStale();
+		unsigned int handled = estop_handled;
+		long long sent_us = nowMicros();
+		if (attempt == 0)
+			first_sent_us = sent_us;
+		send(pID, cmd, data, datalen);
+		// the reply to the first attempt is as good as the reply to this one. only a reply faster than the first attempt is stale
+		if (receive(pID, cmd, packet, address, replyTimeout(pID), reply_size, probing ? 0 : first_sent_us + wireTime(request_size + reply_size)))
+		{
+			if (attempt == 0)
+				sampleRtt(pID, nowMicros() - sent_us);
+			else
+				expectLateReply(pID, request_size, reply_size); // this reply might belong to the first request, then the reply to the last one is still coming
+			return true;
+		}
+		if (estop_handled != handled)
+			return false; // aborted by emergencyStop()
+
+		recordTimeout(pID, request_size, reply_size);
+		if (attempt >= read_retries || probing)
+			return false;
+		retry_count++;
+		if ((unsigned char)pID < kNumServo)
+			rtt[(unsigned char)pID].retries++;
+	}
+}
+
+/** @brief timeout of the next request to a motor in microseconds */
+long HerkulexDriver::replyTimeout(char pID) const
 {
-	send(pID, kSTAT, NULL, 0);
-	char buffer[9];//2 for header, 1 for packet size, 1 for pID, 1 for cmd, 2 for checksum, 1 for status error. 1 for status detail
-	read(buffer);
-
-	char status_error = buffer[7];
-	if (status_error % 10 == 0x01)
-		printf("pID[%d] Status Error[%u]: Exceed input voltage limit\t", pID, status_error);
-	if (status_error % 10 == 0x02)
-		printf("pID[%d] Status Error[%u]: Exceed allowed potentiometer limit. (Angle exceeds safety threshold)\t", pID, status_error);
-	if (status_error % 10 == 0x04)
-		printf("pID[%d] Status Error[%u]: Exceed temperature limit\t", pID, status_error);
-	if (status_error % 10 == 0x08)
-		printf("pID[%d] Status Error[%u]: Invalid Packet\t", pID, status_error);
-	if (floor(status_error / 10.0) * 10 == 0x10)
-		printf("pID[%d] Status Error[%u]: Overload detected\t", pID, status_error);
-	if (floor(status_error / 10.0) * 10 == 0x20)
-		printf("pID[%d] Status Error[%u]: Driver fault detected\t", pID, status_error);
-	if (floor(status_error / 10.0) * 10 == 0x40)
-		printf("pID[%d] Status Error[%u]: EEP register distorted\t", pID, status_error);
-	if (floor(status_error / 10.0) * 10 == 0x80)
-		printf("pID[%d] Status Error[%u]: Reserved. (not used for error code)\t", pID, status_error);
-
-	char status_detail = buffer[8];
-	if (status_detail % 10 == 0x01)
-		printf("Status Detail[%u]: Moving flag\t", status_detail);
-	if (status_detail % 10 == 0x02)
-		printf("Status Detail[%u]: Inposition flag\t", status_detail);
-	if (status_detail % 10 == 0x04)
-		printf("Status Detail[%u]: Checksum error\t", status_detail);
-	if (status_detail % 10 == 0x08)
-		printf("Status Detail[%u]: Unkown command\t", status_detail);
-	if (floor(status_detail / 10.0) * 10 == 0x10)
-		printf("Status Detail[%u]: Exceed register range\t", status_detail);
-	if (floor(status_detail / 10.0) * 10 == 0x20)
-		printf("Status Detail[%u]: Garbage detected\t", status_detail);
-	if (floor(status_detail / 10.0) * 10 == 0x40)
-		printf("Status Detail[%u]: MOTOR_ON flag\t", status_detail);
-	if (floor(status_detail / 10.0) * 10 == 0x80)
-		printf("Status Detail[%u]: Reserved. (not used for error code)\t", status_detail);
-
-	int error = status_error << 8 + status_detail;
-	//printf("pid[%d] error code = %d %u %u ", pID, error, status_error, status_detail);
-	if (error>0)
-	{
-		printf("Error[%d] = %d\n", pID, error);
-		printf("Clear error? (y/n)");
-		char ch;
-		std::cin >> ch;
-		if (ch == 'y')
-			clearError(pID);
-	}
-	return error;
+	unsigned char id = (unsigned char)pID;
+	if (!adaptive_timeout || probing || id >= kNumServo)
+		return reply_timeout_us;
+	return (long)rtt[id].timeout(min_timeout_us, reply_timeout_us);
 }
 
-/** clear the status error and status detail
+void HerkulexDriver::sampleRtt(char pID, long long rtt_us)
+{
+	unsigned char id = (unsigned char)pID;
+	if (!probing && id < kNumServo)
+		rtt[id].sample(rtt_us);
+}
+
+void HerkulexDriver::recordTimeout(char pID, int request_size, int reply_size)
+{
+	unsigned char id = (unsigned char)pID;
+	expectLateReply(pID, request_size, reply_size);
+	if (probing)
+		return;
+	timeout_count++;
+	if (id < kNumServo)
+		rtt[id].backoff(reply_timeout_us);
+}
+
+/** @brief A reply to a request that timed out or was sent again may still arrive: discardStale() waits for it before the next request
+*
+* The reply can still be on the wire: the wait lasts its wire time plus the turnaround of the motor
+* (its round trip time minus the wire time of the request and of the reply, or min_timeout_us before its first reply).
 *
 * @param[in] pID id of the motor
+* @param[in] request_size size of the request packet
+* @param[in] reply_size size of the reply packet
 *
-* return returns nothing
+* @return returns nothing
 */
-int HerkulexDriver::clearError(char pID)
+void HerkulexDriver::expectLateReply(char pID, int request_size, int reply_size)
 {
-	char data[] = { 0x30, 2, 0,0 };// set register 0x30 & 0x31 (status error and status detail) to 0x00 and 0x00
-	send(pID, kRAM_WRITE, data, 4);
+	unsigned char id = (unsigned char)pID;
+	long long turnaround_us = min_timeout_us;
+	if (id < kNumServo && rtt[id].srtt_us >= 0)
+	{
+		turnaround_us = rtt[id].srtt_us - wireTime(request_size + reply_size);
+		if (turnaround_us < 0)
+			turnaround_us = 0;
+	}
+	long long until_us = nowMicros() + wireTime(reply_size) + turnaround_us;
+	if (!late_reply_possible || until_us > stale_until_us)
+		stale_until_us = until_us;
+	late_reply_possible = true;
+}
+
+/** @brief drop the replies that arrive after their request timed out, so that they are not taken as the reply of the next request
+*
+* Reads until the late replies still on the wire had the time to arrive (see expectLateReply()). The status they carry is still recorded.
+* An emergencyStop() that came while no reply was awaited is handled here, so that it does not abort the request about to be sent.
+*
+* @return returns nothing
+*/
+void HerkulexDriver::discardStale()
+{
+	if (abortPending())
+		handleAbort();
+	if (!late_reply_possible)
+		return;
+	late_reply_possible = false;
+
+	sp.setReadMinimum(1);
+	while (true)
+	{
+		long long remaining_us = stale_until_us - nowMicros();
+		sp.setTimeout(remaining_us > 0 ? (long)remaining_us : 0);
+		int nbr = sp.readsome(framer.writePtr(), framer.writeSpace());
+		if (nbr > 0)
+			framer.commit(nbr);
+		HerkulexPacket packet;
+		while (nextPacket(packet))
+			;
+		if (abortPending())
+			handleAbort();
+		else if (nbr <= 0 && remaining_us <= 0)
+			break;
+	}
+}
 
-	return getError(pID);
+/** @brief time to send bytes on the wire at the baudrate of the port in microseconds */
+long long HerkulexDriver::wireTime(int bytes) const
+{
+	return BusTiming(baudrate, 0).wireTime(bytes);
 }
 
-/** runs the Motor using S_JOG protocol
+/** @brief size of the reply packet to a request
 *
-* @note S_JOG is suppose to allow multiple motors to be commanded simultaneously. However, only the specied motor via data[3] (pID element) will move. Hence each motor must be commanded individually now.
+* STAT: [status error][status detail]. reads: [address][length] + length registers + [status error][status detail]
 *
-* @param[in] *sjog array of S_JOG_TAG structure
-* @param[in] num_sjog number of sjog elements in sjog array
+* @return returns the size in bytes
+*/
+int HerkulexDriver::replySize(HerkulexCmd cmd, const char* data, int datalen)
+{
+	if (cmd == kRAM_READ || cmd == kEEP_READ)
+		return PacketEncoder::kHeaderSize + 4 + (datalen >= 2 ? (unsigned char)data[1] : 0);
+	return PacketEncoder::kHeaderSize + 2;
+}
+
+/** @brief set how many times a timed out read is sent again
 *
-* return returns nothing
+* Only reads and STAT requests are sent again, never writes or motion commands. The scan of scanBus() never retries.
+*
+* @param[in] retries maximum number of retransmissions of one read (0 = no retry)
+*
+* @return returns nothing
 */
-void HerkulexDriver::runMotor(S_JOG_TAG* sjog, char num_sjog)
+void HerkulexDriver::setReadRetries(int retries)
+{
+	read_retries = retries < 0 ? 0 : retries;
+}
+
+/** @brief derive the reply timeout of every motor from its measured round trip time
+*
+* The timeout is srtt + 4 rttvar (see RttEstimator), between min_timeout_us and reply_timeout_us, and reply_timeout_us until the first reply of the motor.
+* With pipelined reads every motor is timed from the previous reply, because the motors ahead in the pipeline reply first. \n
+* When disabled, every request waits up to reply_timeout_us.
+*
+* @param[in] enabled true for adaptive timeouts
+* @param[in] min_timeout_us lower bound of the timeout in microseconds
+*
+* @return returns nothing
+*/
+void HerkulexDriver::setAdaptiveTimeout(bool enabled, long min_timeout_us)
 {
+	adaptive_timeout = enabled;
+	this->min_timeout_us = min_timeout_us;
+}
+
+/** @brief Set the low latency profile of the serial port (linux)
+*
+* Sets ASYNC_LOW_LATENCY and the USB latency timer of the adapter (see SerialStream::setLowLatency()), and makes every read
+* wake up only once its whole reply has arrived (see SerialStream::setReadMinimum()). \n
+* With the 16 ms default latency timer of FTDI adapters, every read takes at least one latency period whatever the baudrate.
+* Check the result with measureTurnaround().
+*
+* @param[in] enabled true to set the profile, false to restore the default
+* @param[in] latency_timer_ms USB latency timer in milliseconds
+*
+* @return returns the settings that are in effect (SerialStream::kAsyncLowLatency | SerialStream::kLatencyTimerSet)
+*/
+int HerkulexDriver::setLowLatency(bool enabled, int latency_timer_ms)
+{
+	reply_size_wakeup = enabled;
+	if (!enabled)
+		sp.setReadMinimum(1);
+	return sp.setLowLatency(enabled, latency_timer_ms);
+}
+
+/** @brief Measure the time from the write of a STAT request to the first byte, and to the whole reply
+*
+* The first byte time is the request on the wire + the turnaround of the motor + the latency of the adapter
+* (compare with BusTiming::wireTime() of the 7 byte request). No retries: a lost reply only counts as a timeout.
+*
+* @param[in] pID id of the motor
+* @param[in] samples number of STAT requests
+* @param[out] stats the measured times
+*
+* @return returns false if the motor never replied
+*/
+bool HerkulexDriver::measureTurnaround(char pID, int samples, TurnaroundStats& stats)
+{
+	stats = TurnaroundStats();
+	long long first_byte_sum = 0;
+	long long reply_sum = 0;
+	for (int i = 0; i < samples; i++)
+	{
+		discardStale();
+		send(pID, kSTAT, NULL, 0);
+		long long sent_us = nowMicros();
+
+		sp.setReadMinimum(1);
+		sp.setTimeout(reply_timeout_us);
+		int nbr = sp.readsome(framer.writePtr(), framer.writeSpace());
+		long long first_byte_us = nowMicros() - sent_us;
+		framer.commit(nbr);
+
+		HerkulexPacket packet;
+		if (nbr <= 0 || !receive(pID, kSTAT, packet, -1, (long)(reply_timeout_us - first_byte_us > 0 ? reply_timeout_us - first_byte_us : 0)))
+		{
+			stats.timeouts++;
+			expectLateReply(pID, PacketEncoder::kHeaderSize, PacketEncoder::kHeaderSize + 2);
+			continue;
+		}
+		long long reply_us = nowMicros() - sent_us;
+
+		if (stats.samples == 0 || first_byte_us < stats.first_byte_min_us)
+			stats.first_byte_min_us = first_byte_us;
+		if (first_byte_us > stats.first_byte_max_us)
+			stats.first_byte_max_us = first_byte_us;
+		if (reply_us > stats.reply_max_us)
+			stats.reply_max_us = reply_us;
+		first_byte_sum += first_byte_us;
+		reply_sum += reply_us;
+		stats.samples++;
+	}
+	if (stats.samples > 0)
+	{
+		stats.first_byte_mean_us = first_byte_sum / stats.samples;
+		stats.reply_mean_us = reply_sum / stats.samples;
+	}
+	return stats.samples > 0;
+}
+
+/** @brief get the round trip time, timeout and timeout/retry counters of a motor
+*
+* @param[in] pID id of the motor
+* @param[out] estimate the estimator of the motor
+*
+* @return returns false if the motor never replied
+*/
+bool HerkulexDriver::getRttEstimate(char pID, RttEstimator& estimate) const
+{
+	unsigned char id = (unsigned char)pID;
+	if (id >= kNumServo)
+		return false;
+	estimate = rtt[id];
+	return estimate.samples > 0;
+}
+
+void HerkulexDriver::printHexCommand(char* data, int len)
+{
+	printf("send command: ");
+	for (int i = 0; i < len; i++)
+	{
+		unsigned char temp = data[i];
+		if (temp < 16)
+			printf("0%x ", temp);
+		else
+			printf("%x ", temp);
+	}
+	printf("\n");
+}
+
+void HerkulexDriver::setLEDColour(char pID, LEDColour colour)
+{
+	write<RegLED>(pID, colour);
+}
+
+/** @brief set the acknowledge policy
+*
+* Sets ACK Packet reply policy(1) when Request Packet is received. \n
+* ACK Policy(RAM Register Address 1)\n
+* 0 : No reply to any Request Packet\n
+* 1 : Only reply to Read CMD\n (default)
+* 2 : Reply to all Request Packet\n
+*
+* @param[in] pID id of the motor
+* @param[in] policy the acknowledge policy
+*
+* @return return nothing
+*/
+void HerkulexDriver::setAcknowledgePolicy(char pID, int policy)
+{
+	write<RegAckPolicy>(pID, policy);
+}
+
+/** @brief set the control mode
+*
+* Sets control mode (56): \n
+* 0 : Position control (default)
+* 1 : Turn/Velocity Control(Continuous rotation)
+*
+* @note Torque control must be set to "Torque ON" (0x60) for motor to move
+*
+* @param[in] pID id of the motor
+* @param[in] controlmode the control mode
+*
+* @return return nothing
+*/
+void HerkulexDriver::setControlMode(char pID, int controlmode)
+{
+	write<RegControlMode>(pID, controlmode);
+}
+
+/** @brief set the Torque Control
+*
+* Sets torque control (52): \n
+* 0 (0x00) : Torque free
+* 1 (0x40) : Brake on
+* 2 (0x60) : Torque On
+*
+* @param[in] pID id of the motor
+* @param[in] controlmode the control mode
+*
+* @return return nothing
+*/
+void HerkulexDriver::setTorqueControl(char pID, int mode)
+{
+	write<RegTorqueControl>(pID, torqueControlValue(mode));
+}
+
+/** @brief convert the torque control mode (0, 1, 2) into the value of register 52 (0x00, 0x40, 0x60) */
+unsigned char HerkulexDriver::torqueControlValue(int mode)
+{
+	if (mode == 1)
+		return 0x40;
+	else if (mode == 2)
+		return 0x60;
+	return 0x00;
+}
+
+/** @brief set the LED colour of many motors in one TX burst. See writeGroup()
+*
+* @return returns the number of motors that have the colour (num_ids when verify is false)
+*/
+int HerkulexDriver::setLEDColour(const char* pIDs, int num_ids, LEDColour colour, bool broadcast, bool verify)
+{
+	return writeGroup<RegLED>(pIDs, num_ids, colour, broadcast, verify);
+}
+
+/** @brief set the acknowledge policy of many motors in one TX burst. See writeGroup()
+*
+* @note the check is skipped for policy 0, because the motors do not reply to reads anymore
+*
+* @return returns the number of motors that have the policy (num_ids when verify is false)
+*/
+int HerkulexDriver::setAcknowledgePolicy(const char* pIDs, int num_ids, int policy, bool broadcast, bool verify)
+{
+	return writeGroup<RegAckPolicy>(pIDs, num_ids, policy, broadcast, verify && policy != 0);
+}
+
+/** @brief set the control mode of many motors in one TX burst. See writeGroup()
+*
+* @return returns the number of motors that have the control mode (num_ids when verify is false)
+*/
+int HerkulexDriver::setControlMode(const char* pIDs, int num_ids, int controlmode, bool broadcast, bool verify)
+{
+	return writeGroup<RegControlMode>(pIDs, num_ids, controlmode, broadcast, verify);
+}
+
+/** @brief set the torque control of many motors in one TX burst. See writeGroup() and setTorqueControl()
+*
+* @return returns the number of motors that have the torque control mode (num_ids when verify is false)
+*/
+int HerkulexDriver::setTorqueControl(const char* pIDs, int num_ids, int mode, bool broadcast, bool verify)
+{
+	return writeGroup<RegTorqueControl>(pIDs, num_ids, torqueControlValue(mode), broadcast, verify);
+}
+
+
+/** gets the absolute angle
+* Absolute position Raw Data (60)
+* Angle = r(Absolute Position) X 0.325
+*
+* @param[in] pID id of the motor
+*
+* @return return the absolute angle of the motor. NAN if no valid reply was received
+*/
+float HerkulexDriver::getAbsoluteAngle(char pID)
+{
+	unsigned short absolute_position = 0;
+	if (!read<RegAbsolutePosition>(pID, absolute_position))
+		return NAN;
+
+	//printf("Angle = %hd\n", absolute_position);
+	float absolute_angle = RegAbsolutePosition::toUnits(absolute_position);
+	return absolute_angle;
+}
+
+/** gets the calibrated angle
+* Calibrated position Data (58)
+*
+* @param[in] pID id of the motor
+*
+* @return return the calibrated angle of the motor. NAN if no valid reply was received
+*/
+float HerkulexDriver::getCalibratedAngle(char pID)
+{
+	unsigned short calibrated_position = 0;
+	if (!read<RegCalibratedPosition>(pID, calibrated_position))
+		return NAN;
+
+	calibrated_position = calibrated_position & 0b000001111111111;
+	//float absolute_angle = absolute_position * 0.325;
+	return calibrated_position;
+}
+
+/** @brief set how many read requests are kept in flight by the pipelined reads
+*
+* The requests are written back to back, so the USB latency of the adapter is paid once per window instead of once per motor. \n
+* On a half-duplex bus every motor only answers after receiving its whole request. Use a small depth if replies collide with the following requests.
+*
+* @param[in] depth number of requests waiting for their reply at the same time (1 to kMaxPipelineDepth)
+*
+* @return return nothing
+*/
+void HerkulexDriver::setPipelineDepth(int depth)
+{
+	if (depth < 1)
+		depth = 1;
+	if (depth > kMaxPipelineDepth)
+		depth = kMaxPipelineDepth;
+	pipeline_depth = depth;
+}
+
+/** @brief send the same request to many motors and hand every reply to sink as it arrives
+*
+* Keeps up to pipeline_depth requests in flight. Replies are matched to their request by pID and command (cmd | 0x40),
+* in whatever order they arrive. A request that gets no reply before the timeout of its motor (see setAdaptiveTimeout()) is sent again, up to read_retries times,
+* then handed to sink with a null packet. Only use it for requests that can safely be repeated.
+*
+* @param[in] pIDs ids of the motors
+* @param[in] num_ids number of ids
+* @param[in] cmd the command sent to every motor
+* @param[in] request the payload of the request
+* @param[in] request_len length of the payload
+* @param[in] sink called once per motor with (context, index into pIDs, reply packet or nullptr on timeout, round trip time). returns true if the reply was valid
+* @param[in] context passed to sink
+*
+* @return returns the number of motors for which sink returned true
+*/
+int HerkulexDriver::pipelinedRequest(const char* pIDs, int num_ids, HerkulexCmd cmd, const char* request, int request_len, ReplySink sink, void* context)
+{
+	const unsigned char ack_cmd = (unsigned char)cmd | 0x40;
+	int next_to_send = 0;
+	int in_flight = 0;
+	int num_ok = 0;
+	long long last_reply_us = 0; //the replies come one after the other, so every motor is timed from the previous reply
+	const int request_size = PacketEncoder::kHeaderSize + request_len;
+	const int reply_size = replySize(cmd, request, request_len);
+	const long long min_round_trip_us = probing ? 0 : wireTime(request_size + reply_size); //a reply that comes sooner is a late reply to an earlier request
+	discardStale();
+
+	while (next_to_send < num_ids || in_flight > 0)
+	{
+		if (abortPending())
+		{
+			// emergencyStop() was called. give up on every request that has not been answered
+			handleAbort();
+			for (int i = 0; i < in_flight; i++)
+				sink(context, slots[i].index, nullptr, nowMicros() - slots[i].sent_us);
+			for (; next_to_send < num_ids; next_to_send++)
+				sink(context, next_to_send, nullptr, 0);
+			return num_ok;
+		}
+
+		// keep the pipeline full. all new requests go out in one write
+		bool was_batching = batching;
+		batching = true;
+		while (in_flight < pipeline_depth && next_to_send < num_ids)
+		{
+			send(pIDs[next_to_send], cmd, (char*)request, request_len);
+			slots[in_flight].index = next_to_send;
+			slots[in_flight].pID = pIDs[next_to_send];
+			slots[in_flight].sent_us = nowMicros();
+			slots[in_flight].first_sent_us = slots[in_flight].sent_us;
+			slots[in_flight].attempts = 0;
+			next_to_send++;
+			in_flight++;
+		}
+		batching = was_batching;
+		flush();
+
+		// match all the complete packets against the requests in flight
+		HerkulexPacket packet;
+		while (in_flight > 0 && nextPacket(packet))
+		{
+			if (packet.cmd() != ack_cmd)
+				continue;
+			if ((cmd == kRAM_READ || cmd == kEEP_READ) && (packet.dataLength() == 0 || packet.data()[0] != (unsigned char)request[0]))
+				continue; // late reply to an older read of other registers (see receive())
+			for (int i = 0; i < in_flight; i++)
+			{
+				if ((unsigned char)slots[i].pID != packet.pID())
+					continue;
+
+				long long now = nowMicros();
+				if (now - slots[i].first_sent_us < min_round_trip_us)
+					break; // see request()
+				long long start_us = slots[i].sent_us > last_reply_us ? slots[i].sent_us : last_reply_us;
+				if (slots[i].attempts == 0 && now - start_us >= wireTime(reply_size)) // a shorter time means the reply waited in the port behind the previous one
+					sampleRtt(slots[i].pID, now - start_us);
+				else if (slots[i].attempts > 0)
+					expectLateReply(slots[i].pID, request_size, reply_size); // see request()
+				if (sink(context, slots[i].index, &packet, now - slots[i].sent_us))
+					num_ok++;
+				last_reply_us = now;
+				slots[i] = slots[--in_flight];
+				break;
+			}
+		}
+
+		// time out the requests that waited too long (and send them again while retries are left), and find the earliest deadline of the rest
+		long long now = nowMicros();
+		long long earliest_deadline = -1;
+		bool resent = false;
+		for (int i = 0; i < in_flight; )
+		{
+			long long start_us = (probing || slots[i].sent_us > last_reply_us) ? slots[i].sent_us : last_reply_us;
+			long long deadline = start_us + replyTimeout(slots[i].pID);
+			if (deadline <= now)
+			{
+				recordTimeout(slots[i].pID, request_size, reply_size);
+				if (slots[i].attempts < read_retries && !probing)
+				{
+					was_batching = batching;
+					batching = true;
+					send(slots[i].pID, cmd, (char*)request, request_len);
+					batching = was_batching;
+					resent = true;
+					slots[i].attempts++;
+					slots[i].sent_us = now;
+					retry_count++;
+					if ((unsigned char)slots[i].pID < kNumServo)
+						rtt[(unsigned char)slots[i].pID].retries++;
+					deadline = now + replyTimeout(slots[i].pID);
+				}
+				else
+				{
+					sink(context, slots[i].index, nullptr, now - slots[i].sent_us);
+					slots[i] = slots[--in_flight];
+					continue;
+				}
+			}
+			if (earliest_deadline < 0 || deadline < earliest_deadline)
+				earliest_deadline = deadline;
+			i++;
+		}
+		if (resent)
+			flush();
+
+		if (in_flight > 0)
+		{
+			sp.setReadMinimum(1); // replies of several motors: handle every reply as soon as it arrives
+			sp.setTimeout((long)(earliest_deadline - now));
+			int nbr = sp.readsome(framer.writePtr(), framer.writeSpace());
+			framer.commit(nbr);
+		}
+	}
+	return num_ok;
+}
+
+/** @brief state shared with registerSink while readRegisters runs */
+struct RegisterSinkContext
+{
+	RegisterReply* results;
+	unsigned char reg;
+	unsigned char len;
+};
+
+/** @brief copies a RAM_READ/EEP_READ reply into the RegisterReply of its motor
+*
+* Reply data: [add][length][data ... ][status error][status detail]
+*/
+static bool registerSink(void* context, int index, const HerkulexPacket* packet, long long rtt_us)
+{
+	RegisterSinkContext* ctx = (RegisterSinkContext*)context;
+	RegisterReply& r = ctx->results[index];
+	r.rtt_us = rtt_us;
+	r.length = 0;
+	if (packet == nullptr)
+	{
+		r.status = kReplyTimeout;
+		return false;
+	}
+	if (packet->dataLength() != 4 + ctx->len || packet->data()[0] != ctx->reg || packet->data()[1] != ctx->len)
+	{
+		r.status = kReplyInvalid;
+		return false;
+	}
+
+	memcpy(r.data, packet->data() + 2, ctx->len);
+	r.length = ctx->len;
+	r.status_error = packet->data()[2 + ctx->len];
+	r.status_detail = packet->data()[3 + ctx->len];
+	r.status = kReplyOK;
+	return true;
+}
+
+/** @brief write adjacent registers of one motor, with the address and length known only at run time
+*
+* Same as write<Reg>(), including the shadow and batching, for callers that do not know the register at compile time (eg: TransactionScheduler).
+* With force, the write is sent even if the shadow says the motor already has the values (eg: torque off for safety: the motor may have changed it by itself).
+*
+* @param[in] pID id of the motor
+* @param[in] reg first register address
+* @param[in] values the bytes to write
+* @param[in] len number of bytes to write
+* @param[in] eep write the EEP registers instead of the RAM registers
+* @param[in] force bypass the shadow
+*
+* @return returns nothing
+*/
+void HerkulexDriver::writeRegisters(char pID, unsigned char reg, const unsigned char* values, unsigned char len, bool eep, bool force)
+{
+	if (shadow_enabled && !force && (unsigned char)pID != kBroadcastID)
+	{
+		if (shadow.update(pID, eep, reg, (const char*)values, len) && !batching)
+			flush(); // send now. inside a batch, adjacent dirty registers are merged when the batch is sent
+		return;
+	}
+
+	queueShadowWrites(); // keep the order of the writes
+	const HerkulexCmd cmd = eep ? kEEP_WRITE : kRAM_WRITE;
+	char* data = tx.beginPacket(pID, cmd, 2 + len);
+	if (data == nullptr)
+	{
+		flush(); // TX buffer full. send what has been queued and start again
+		data = tx.beginPacket(pID, cmd, 2 + len);
+		if (data == nullptr)
+			return; // too long for one packet
+	}
+
+	data[0] = (char)reg;
+	data[1] = (char)len;
+	memcpy(data + 2, values, len);
+	tx.endPacket();
+
+	if (shadow_enabled && (unsigned char)pID == kBroadcastID) // broadcast write: every motor now has this value
+		shadow.storeAll(eep, reg, values, len);
+	else if (shadow_enabled)
+		shadow.store(pID, eep, reg, values, len);
+
+	if (!batching)
+		flush();
+}
+
+/** @brief read the same registers from many motors with pipelined requests
+*
+* @param[in] pIDs ids of the motors
+* @param[in] num_ids number of ids
+* @param[in] reg first register address
+* @param[in] len number of bytes to read (max RegisterReply::kMaxLength)
+* @param[out] results array of num_ids results, in the same order as pIDs
+* @param[in] eep read the EEP registers instead of the RAM registers
+*
+* @return returns the number of motors that replied with valid data
+*/
+int HerkulexDriver::readRegisters(const char* pIDs, int num_ids, unsigned char reg, unsigned char len, RegisterReply* results, bool eep)
+{
+	if (len > RegisterReply::kMaxLength)
+		len = RegisterReply::kMaxLength;
+
+	for (int i = 0; i < num_ids; i++)
+	{
+		results[i].pID = pIDs[i];
+		results[i].status = kReplyTimeout;
+		results[i].length = 0;
+	}
+
+	RegisterSinkContext ctx = { results, reg, len };
+	char request[] = { (char)reg, (char)len };
+	return pipelinedRequest(pIDs, num_ids, eep ? kEEP_READ : kRAM_READ, request, 2, registerSink, &ctx);
+}
+
+/** @brief decodes a RAM_READ reply of ServoTelemetry::Range straight from the packet */
+static bool telemetrySink(void* context, int index, const HerkulexPacket* packet, long long rtt_us)
+{
+	ServoTelemetry& t = ((ServoTelemetry*)context)[index];
+	t.rtt_us = rtt_us;
+	t.valid = false;
+	if (packet == nullptr || packet->dataLength() != 4 + ServoTelemetry::Range::kLength || packet->data()[0] != ServoTelemetry::Range::kAddress)
+		return false;
+
+	typedef ServoTelemetry::Range Range;
+	const unsigned char* data = packet->data() + 2;
+	t.pID = (char)packet->pID();
+	t.status_error = Range::get<RegStatusError>(data);
+	t.status_detail = Range::get<RegStatusDetail>(data);
+	t.torque_control = Range::get<RegTorqueControl>(data);
+	t.led = Range::get<RegLED>(data);
+	t.voltage = Range::get<RegVoltage>(data);
+	t.temperature = Range::get<RegTemperature>(data);
+	t.control_mode = Range::get<RegControlMode>(data);
+	t.tick = Range::get<RegTick>(data);
+	t.calibrated_position = Range::get<RegCalibratedPosition>(data);
+	t.absolute_position = Range::get<RegAbsolutePosition>(data);
+	t.differential_position = Range::get<RegDifferentialPosition>(data);
+	t.pwm = Range::get<RegPWM>(data);
+	t.valid = true;
+	return true;
+}
+
+/** @brief read the full state of one motor with a single RAM_READ
+*
+* Reads RAM registers 48 (status error) to 65 (PWM) in one request, instead of one request per value.
+*
+* @param[in] pID id of the motor
+* @param[out] telemetry the decoded state. telemetry.valid is false if no valid reply was received
+*
+* @return returns true if a valid reply was received
+*/
+bool HerkulexDriver::readTelemetry(char pID, ServoTelemetry& telemetry)
+{
+	return readTelemetry(&pID, 1, &telemetry) == 1;
+}
+
+/** @brief read the full state of many motors with pipelined RAM_READ requests
+*
+* @param[in] pIDs ids of the motors
+* @param[in] num_ids number of ids
+* @param[out] telemetry array of num_ids results, in the same order as pIDs
+*
+* @return returns the number of motors that replied with valid data
+*/
+int HerkulexDriver::readTelemetry(const char* pIDs, int num_ids, ServoTelemetry* telemetry)
+{
+	for (int i = 0; i < num_ids; i++)
+	{
+		telemetry[i].pID = pIDs[i];
+		telemetry[i].valid = false;
+	}
+
+	char request[] = { ServoTelemetry::Range::kAddress, ServoTelemetry::Range::kLength };
+	return pipelinedRequest(pIDs, num_ids, kRAM_READ, request, 2, telemetrySink, telemetry);
+}
+
+/** @brief records the motors that answered a scan probe */
+static bool scanSink(void* context, int index, const HerkulexPacket* packet, long long rtt_us)
+{
+	ScanResult* probes = (ScanResult*)context;
+	if (packet == nullptr || packet->dataLength() != 2)
+		return false;
+	probes[index].status_error = packet->data()[0];
+	probes[index].status_detail = packet->data()[1];
+	probes[index].rtt_us = rtt_us;
+	return true;
+}
+
+/** @brief find every motor on the bus
+*
+* Sends pipelined STAT requests to ids 0 to 253 (kMaxPipelineDepth in flight), then reads the model number (EEP registers 0 and 1) of every motor that replied. \n
+* Every probe times out after the bus time of the STAT transactions in flight (from timing, the replies of the motors ahead of it come first), plus margin_us for the latency of the adapter,
+* so an absent id costs about one STAT time instead of reply_timeout_us. At 115200 a full scan takes about 0.5 s. \n
+* If corrupted bytes were received during a pass (replies colliding with requests), the ids that did not reply are probed again, up to max_pass passes.
+*
+* @note motors with ACK policy 0 never reply, and are not found. USB adapters that buffer replies (eg: the 16 ms latency timer of FTDI adapters) need a larger margin_us
+*
+* @param[out] found the motors found, in id order
+* @param[in] max_found size of found
+* @param[in] timing baudrate and turnaround of the bus
+* @param[in] margin_us time added to every probe timeout in microseconds
+* @param[in] max_pass maximum number of passes over the ids that did not reply
+*
+* @return returns the number of motors found
+*/
+int HerkulexDriver::scanBus(ScanResult* found, int max_found, const BusTiming& timing, long margin_us, int max_pass)
+{
+	ScanResult probes[kNumServo];
+	bool replied[kNumServo] = { false };
+	char pIDs[kNumServo];
+	int saved_depth = pipeline_depth;
+	long saved_timeout = reply_timeout_us;
+	pipeline_depth = kMaxPipelineDepth;
+	probing = true;
+
+	reply_timeout_us = (long)(timing.statTime() * kMaxPipelineDepth + margin_us);
+	for (int pass = 0; pass < max_pass; pass++)
+	{
+		int num_probe = 0;
+		for (int id = 0; id < kNumServo; id++)
+		{
+			if (!replied[id])
+				pIDs[num_probe++] = (char)id;
+		}
+		if (num_probe == 0)
+			break;
+
+		unsigned int corrupted = framer.checksumErrorCount() + framer.resyncCount();
+		ScanResult pass_probes[kNumServo];
+		for (int i = 0; i < num_probe; i++)
+			pass_probes[i].rtt_us = -1;
+		pipelinedRequest(pIDs, num_probe, kSTAT, nullptr, 0, scanSink, pass_probes);
+		for (int i = 0; i < num_probe; i++)
+		{
+			unsigned char id = (unsigned char)pIDs[i];
+			if (pass_probes[i].rtt_us >= 0)
+			{
+				replied[id] = true;
+				probes[id] = pass_probes[i];
+				probes[id].pID = (char)id;
+			}
+		}
+		if (abortPending() || framer.checksumErrorCount() + framer.resyncCount() == corrupted)
+			break; // no collision, the ids that did not reply are absent
+	}
+
+	int num_found = 0;
+	for (int id = 0; id < kNumServo && num_found < max_found; id++)
+	{
+		if (replied[id])
+		{
+			found[num_found] = probes[id];
+			pIDs[num_found++] = (char)id;
+		}
+	}
+
+	// model numbers, pipelined
+	reply_timeout_us = (long)(timing.readTime(RegEEPModel::kWidth) * kMaxPipelineDepth + margin_us);
+	const int kChunk = 32;
+	RegisterReply replies[kChunk];
+	for (int first = 0; first < num_found; first += kChunk)
+	{
+		int n = (num_found - first < kChunk) ? num_found - first : kChunk;
+		readRegisters(pIDs + first, n, RegEEPModel::kAddress, RegEEPModel::kWidth, replies, RegEEPModel::kEEP);
+		for (int i = 0; i < n; i++)
+		{
+			if (replies[i].status == kReplyOK)
+				found[first + i].model = RegEEPModel::decode(replies[i].data);
+		}
+	}
+
+	pipeline_depth = saved_depth;
+	reply_timeout_us = saved_timeout;
+	probing = false;
+	return num_found;
+}
+
+// STAT every id once with fixed timeouts, as scanBus(). replied[i] is set for the ids that answered. returns the number of replies
+int HerkulexDriver::probe(const char* pIDs, int num_ids, bool* replied, const BusTiming& timing, long margin_us)
+{
+	if (num_ids <= 0 || num_ids > kNumServo)
+		return 0;
+
+	ScanResult probes[kNumServo];
+	int saved_depth = pipeline_depth;
+	long saved_timeout = reply_timeout_us;
+	pipeline_depth = kMaxPipelineDepth;
+	reply_timeout_us = (long)(timing.statTime() * kMaxPipelineDepth + margin_us);
+	probing = true;
+
+	for (int i = 0; i < num_ids; i++)
+		probes[i].rtt_us = -1;
+	pipelinedRequest(pIDs, num_ids, kSTAT, nullptr, 0, scanSink, probes);
+	int num_replied = 0;
+	for (int i = 0; i < num_ids; i++)
+	{
+		replied[i] = probes[i].rtt_us >= 0;
+		num_replied += replied[i] ? 1 : 0;
+	}
+
+	pipeline_depth = saved_depth;
+	reply_timeout_us = saved_timeout;
+	probing = false;
+	return num_replied;
+}
+
+/** @brief Change the baudrate of the port. The motors keep theirs: see migrateBaudrate()
+*
+* The bytes received at the old baudrate are dropped, and the round trip times are measured again.
+*
+* @param[in] baudrate the baudrate in bits per second (eg: BAUD_666666)
+*
+* @return returns nothing
+*/
+void HerkulexDriver::setBaudrate(int baudrate)
+{
+	flush();
+	this->baudrate = baudrate;
+	sp.configurePort(baudrate, 8, PARITY_NONE, 1, 0);
+	sp.clear();
+	late_reply_possible = true;
+	for (int i = 0; i < kNumServo; i++)
+		rtt[i] = RttEstimator();
+}
+
+/** @brief Find the baudrate of every motor, by probing them with STAT at every baudrate of HerkulexBaudrate
+*
+* The current baudrate of the port is tried first, then the others from the fastest to the slowest. The port is set back to its baudrate at the end.
+*
+* @param[in] pIDs ids of the motors
+* @param[in] num_ids number of motors (1 to kNumServo)
+* @param[out] baudrates the baudrate of every motor. 0 if it did not reply at any baudrate
+* @param[in] turnaround_us reply delay of the motors, for the probe timeouts (see scanBus())
+* @param[in] margin_us time added to every probe timeout in microseconds
+*
+* @return returns the number of motors found, or -1 if num_ids is out of range
+*/
+int HerkulexDriver::detectBaudrate(const char* pIDs, int num_ids, int* baudrates, long turnaround_us, long margin_us)
+{
+	if (num_ids <= 0 || num_ids > kNumServo)
+		return -1;
+
+	int original = baudrate;
+	int num_found = 0;
+	char pending[kNumServo];
+	int pending_index[kNumServo];
+	bool replied[kNumServo];
+	for (int i = 0; i < num_ids; i++)
+		baudrates[i] = 0;
+
+	for (int r = -1; r < HerkulexBaudrate::kNumRate && num_found < num_ids; r++)
+	{
+		int rate = r < 0 ? original : HerkulexBaudrate::rate(r);
+		if (r >= 0 && rate == original)
+			continue;
+
+		int num_pending = 0;
+		for (int i = 0; i < num_ids; i++)
+		{
+			if (baudrates[i] == 0)
+			{
+				pending_index[num_pending] = i;
+				pending[num_pending++] = pIDs[i];
+			}
+		}
+		if (rate != baudrate)
+			setBaudrate(rate);
+		probe(pending, num_pending, replied, BusTiming(rate, turnaround_us), margin_us);
+		for (int k = 0; k < num_pending; k++)
+		{
+			if (replied[k])
+			{
+				baudrates[pending_index[k]] = rate;
+				num_found++;
+			}
+		}
+	}
+
+	if (baudrate != original)
+		setBaudrate(original);
+	return num_found;
+}
+
+/** @brief Move every motor of the bus, and the port, to another baudrate
+*
+* 1. every motor must reply at the current baudrate, else nothing is changed \n
+* 2. the new value of RegEEPBaudRate is written and read back, then every motor is rebooted (torque free, RAM reloaded from EEP) \n
+* 3. the port switches to the new baudrate and every motor must reply \n
+* If a motor is missing at the new baudrate, the motors that made it are written back to the old value and rebooted, and the bus goes back
+* to the old baudrate. A motor that still does not reply is looked for at every baudrate (see detectBaudrate()) and reported.
+*
+* @param[in] pIDs ids of all the motors of the bus
+* @param[in] num_ids number of motors (1 to kNumServo)
+* @param[in] baudrate the new baudrate. One of HerkulexBaudrate (eg: BAUD_666666) that the adapter supports
+* @param[in] turnaround_us reply delay of the motors, for the probe timeouts (see scanBus())
+* @param[in] margin_us time added to every probe timeout in microseconds
+*
+* @return returns the number of motors moved to the new baudrate (num_ids), or -1 if num_ids is out of range or the bus stayed at (or went back to) the old baudrate
+*/
+int HerkulexDriver::migrateBaudrate(const char* pIDs, int num_ids, int baudrate, long turnaround_us, long margin_us)
+{
+	if (num_ids <= 0 || num_ids > kNumServo)
+	{
+		printf("migrateBaudrate: %d ids, expected 1 to %d\n", num_ids, kNumServo);
+		return -1;
+	}
+
+	const int old_rate = this->baudrate;
+	const unsigned char old_code = HerkulexBaudrate::toCode(old_rate);
+	const unsigned char new_code = HerkulexBaudrate::toCode(baudrate);
+	if (new_code == 0 || old_code == 0)
+	{
+		printf("migrateBaudrate: %d baud is not a herkulex baudrate\n", new_code == 0 ? baudrate : old_rate);
+		return -1;
+	}
+	if (baudrate == old_rate)
+		return num_ids;
+
+	bool replied[kNumServo];
+	if (probe(pIDs, num_ids, replied, BusTiming(old_rate, turnaround_us), margin_us) < num_ids)
+	{
+		for (int i = 0; i < num_ids; i++)
+		{
+			if (!replied[i])
+				printf("migrateBaudrate: motor %d does not reply at %d baud, nothing changed\n", (unsigned char)pIDs[i], old_rate);
+		}
+		return -1;
+	}
+
+	// write the new baudrate into the EEP of every motor. they keep running at the old one until they reboot
+	int num_written = 0;
+	for (; num_written < num_ids; num_written++)
+	{
+		unsigned char code = 0;
+		write<RegEEPBaudRate>(pIDs[num_written], new_code);
+		if (!read<RegEEPBaudRate>(pIDs[num_written], code) || code != new_code)
+		{
+			printf("migrateBaudrate: motor %d did not take the new baudrate, nothing changed\n", (unsigned char)pIDs[num_written]);
+			for (int i = 0; i <= num_written; i++)
+				write<RegEEPBaudRate>(pIDs[i], old_code);
+			return -1;
+		}
+	}
+	for (int i = 0; i < num_ids; i++)
+		reboot(pIDs[i]);
+	flush();
+	std::this_thread::sleep_for(std::chrono::milliseconds((long long)kRebootMs));
+
+	setBaudrate(baudrate);
+	int num_replied = 0;
+	for (int attempt = 0; attempt < 3 && num_replied < num_ids; attempt++)
+	{
+		if (attempt > 0)
+			std::this_thread::sleep_for(std::chrono::milliseconds((long long)kRebootMs / 5)); // a motor may take longer to boot
+		char missing[kNumServo];
+		int missing_index[kNumServo];
+		int num_missing = 0;
+		for (int i = 0; i < num_ids; i++)
+		{
+			if (attempt == 0 || !replied[i])
+			{
+				missing_index[num_missing] = i;
+				missing[num_missing++] = pIDs[i];
+			}
+		}
+		bool found[kNumServo];
+		probe(missing, num_missing, found, BusTiming(baudrate, turnaround_us), margin_us);
+		for (int k = 0; k < num_missing; k++)
+		{
+			replied[missing_index[k]] = found[k];
+			num_replied += found[k] ? 1 : 0;
+		}
+	}
+	if (num_replied == num_ids)
+		return num_ids;
+
+	// fall back: write the old baudrate back into every motor that can be reached, so that the whole bus runs at one baudrate again
+	for (int i = 0; i < num_ids; i++)
+	{
+		if (!replied[i])
+			continue;
+		write<RegEEPBaudRate>(pIDs[i], old_code);
+		reboot(pIDs[i]);
+	}
+	flush();
+	std::this_thread::sleep_for(std::chrono::milliseconds((long long)kRebootMs));
+	setBaudrate(old_rate);
+
+	// the missing motors either did not reboot (old baudrate, new value in EEP) or came up at another baudrate
+	int baudrates[kNumServo];
+	detectBaudrate(pIDs, num_ids, baudrates, turnaround_us, margin_us);
+	bool rebooted = false;
+	for (int i = 0; i < num_ids; i++)
+	{
+		if (replied[i])
+			continue;
+		if (baudrates[i] == 0)
+		{
+			printf("migrateBaudrate: motor %d does not reply at any baudrate\n", (unsigned char)pIDs[i]);
+			continue;
+		}
+		if (baudrates[i] != this->baudrate)
+			setBaudrate(baudrates[i]);
+		write<RegEEPBaudRate>(pIDs[i], old_code);
+		if (baudrates[i] != old_rate)
+		{
+			reboot(pIDs[i]);
+			rebooted = true;
+		}
+	}
+	flush();
+	if (rebooted)
+		std::this_thread::sleep_for(std::chrono::milliseconds((long long)kRebootMs));
+	if (this->baudrate != old_rate)
+		setBaudrate(old_rate);
+	printf("migrateBaudrate: bus back at %d baud\n", old_rate);
+	return -1;
+}
+
+/** gets the status error and status detail with a STAT request
+*
+* Does not apply the recovery policy.
+*
+* STAT reply data: [status error][status detail]
+*
+* @param[in] pID id of the motor
+* @param[out] status the status of the motor. unchanged if no valid reply was received
+*
+* return returns true if a valid reply was received
+*/
+bool HerkulexDriver::readStatus(char pID, ServoStatus& status)
+{
+	HerkulexPacket reply;
+	if (!request(pID, kSTAT, NULL, 0, reply) || reply.dataLength() != 2)
+		return false;
+
+	status = ServoStatus(reply.data()[0], reply.data()[1]);
+	return true;
+}
+
+/** gets the status error and status detail, and applies the recovery policy if the motor reports an error
+*
+* Status Error:
+* Bit Value Comment
+* 0   0X01  Exceed Input Voltage limit
+* 1   0X02  Exceed allowed POT limit
+* 2   0X04  Exceed Temperature limit
+* 3   0X08  Invalid Packet
+* 4   0X10  Overload detected
+* 5   0X20  Driver fault detected
+* 6   0X40  EEP REG distorted
+* 7   0X80  reserved
+*
+* Status Detail:
+* Bit Value Comment
+* 0   0X01  Moving flag
+* 1   0X02  Inposition flag
+* 2   0X04  Checksum Error
+* 3   0X08  Unknown Command
+* 4   0X10  Exceed REG range
+* 5   0X20  Garbage detected
+* 6   0X40  MOTOR_ON flag
+* 7   0X80  reserved
+*
+* @param[in] pID id of the motor
+* @param[out] status the status of the motor
+*
+* return returns true if a valid reply was received
+*/
+bool HerkulexDriver::getStatus(char pID, ServoStatus& status)
+{
+	if (!readStatus(pID, status))
+		return false;
+
+	if ((unsigned char)pID < kNumServo)
+		status_table[(unsigned char)pID].recovery_pending = false;
+	handleStatus(pID, status);
+	return true;
+}
+
+/** gets the status error and status detail
+*
+* Same as getStatus, but returns the combined code. Use ServoStatus::describe() to get the flag names
+*
+* @param[in] pID id of the motor
+*
+* return integer of combined status_error<<8 | status_detail. -1 if no valid reply was received
+*/
+int HerkulexDriver::getError(char pID)
+{
+	ServoStatus status;
+	if (!getStatus(pID, status))
+		return -1;
+	return status.code();
+}
+
+/** @brief set what the driver does when a motor reports a status error
+*
+* @param[in] policy combination of RecoveryPolicy flags (eg: kRecoverTorqueOff | kRecoverEscalate)
+* @param[in] callback called with (context, pID, status) when kRecoverEscalate is set. Runs in the thread that read the status
+* @param[in] context passed to callback
+*
+* @return returns nothing
+*/
+void HerkulexDriver::setRecoveryPolicy(int policy, RecoveryCallback callback, void* context)
+{
+	recovery_policy = policy;
+	recovery_callback = callback;
+	recovery_context = context;
+}
+
+/** @brief apply the recovery policy to a status reported by a motor
+*
+* @param[in] pID id of the motor
+* @param[in] status the reported status
+*
+* @return returns nothing
+*/
+void HerkulexDriver::handleStatus(char pID, const ServoStatus& status)
+{
+	if (!status.hasError())
+		return;
+
+	invalidateShadow(pID); // the motor may have changed its registers (eg: torque off) when the error happened
+	if (recovery_policy & kRecoverTorqueOff)
+		write<RegTorqueControl>(pID, 0x00);
+	if (recovery_policy & kRecoverAutoClear)
+		write<RegStatus>(pID, 0);
+	if ((recovery_policy & kRecoverEscalate) && recovery_callback != nullptr)
+		recovery_callback(recovery_context, pID, status);
+}
+
+/** clear the status error and status detail
+*
+* @param[in] pID id of the motor
+*
+* return integer of combined status_error<<8 | status_detail read after clearing. -1 if no valid reply was received
+*/
+int HerkulexDriver::clearError(char pID)
+{
+	invalidateShadow(pID); // the motor may have changed its registers (eg: torque off) when the error happened
+	write<RegStatus>(pID, 0);// set register 0x30 & 0x31 (status error and status detail) to 0x00 and 0x00
+
+	ServoStatus status;
+	if (!readStatus(pID, status))
+		return -1;
+	return status.code();
+}
+
+/** @brief Make every motor torque free (or brake) immediately, from any thread or from a signal handler
+*
+* Sends one pre-encoded broadcast RAM_WRITE of register 52 (0x00 torque free, 0x40 brake) straight to the port,
+* after discarding everything still waiting to be sent. The packet is sent estop_repeat times (default 2) in one write, or more if the last write had longer packets:
+* a packet cut in the middle by the discard swallows the bytes that follow it up to its size, so enough copies are sent for one to come after it. \n
+* Reads waiting for a reply in the driver thread return as failed right away. \n
+* Until clearEmergencyStop(), the driver only sends reads: all writes and jogs are dropped. If the driver thread was writing at that moment,
+* it sends the stop again after its write, so that no packet sent in the meantime overrides it. \n
+* The time from the call to the last byte leaving the port (tcdrain) is recorded, see getEmergencyStopLatency().
+*
+* Only uses atomics, clock_gettime, tcflush, write, poll and tcdrain, which are async-signal-safe.
+*
+* @param[in] brake true to brake the motors (0x40) instead of making them torque free (0x00)
+*
+* @return returns nothing
+*/
+void HerkulexDriver::emergencyStop(bool brake)
+{
+	long long trigger_us = nowMicros();
+	estop_latched = true;
+	estop_brake = brake;
+	estop_count.fetch_add(1, std::memory_order_release);
+	sp.interrupt();
+
+	char burst[kEstopBurstSize];
+	sp.writeUrgent(burst, emergencyStopBurst(brake, burst));
+
+	long long latency_us = nowMicros() - trigger_us;
+	estop_latency_us = latency_us;
+	long long max_us = estop_max_latency_us.load();
+	while (latency_us > max_us && !estop_max_latency_us.compare_exchange_weak(max_us, latency_us))
+	{
+	}
+}
+
+/** @brief Allow writes and jogs again after emergencyStop()
+*
+* The motors stay torque free until torque is turned on again (setTorqueControl()). Call from the thread that uses the driver
+*
+* @return returns nothing
+*/
+void HerkulexDriver::clearEmergencyStop()
+{
+	handleAbort();
+	shadow.invalidateAll(); // writes were dropped while stopped
+	estop_latched = false;
+}
+
+/** @brief Set how many copies of the emergency stop packet are sent
+*
+* @param[in] repeat number of copies (1 to 4). 1 gives the lowest latency, but the packet can be lost if the stop cuts another packet in half
+*
+* @return returns nothing
+*/
+void HerkulexDriver::setEmergencyStopRepeat(int repeat)
+{
+	estop_repeat = repeat < 1 ? 1 : (repeat > 4 ? 4 : repeat);
+}
+
+/** @brief Time from the emergencyStop() call to the last byte of the stop packet leaving the port
+*
+* @param[out] max_us the largest latency so far (optional)
+*
+* @return returns the latency of the last emergency stop in microseconds, or -1 if there was none
+*/
+long long HerkulexDriver::getEmergencyStopLatency(long long* max_us) const
+{
+	if (max_us != nullptr)
+		*max_us = estop_max_latency_us;
+	return estop_latency_us;
+}
+
+/** @brief Forget the traffic in progress when emergencyStop() was called. Driver thread only
+*
+* @return returns nothing
+*/
+void HerkulexDriver::handleAbort()
+{
+	estop_handled = estop_count.load(std::memory_order_acquire);
+	tx.clear();
+	framer.reset(); // replies to the aborted requests are not waited for
+	sp.clearInterrupt();
+}
+
+/** @brief Send the stop packet of the last emergencyStop() again, after discarding everything still waiting to be sent. Driver thread only
+*
+* @return returns nothing
+*/
+void HerkulexDriver::resendEmergencyStop()
+{
+	char burst[kEstopBurstSize];
+	sp.writeUrgent(burst, emergencyStopBurst(estop_brake, burst));
+}
+
+/** @brief Fill burst with the copies of the stop packet to send in one write: estop_repeat, or enough for one copy to come after the longest packet of the last write if it was cut after its size byte
+*
+* The copies go out in a single writeUrgent(), as each tcflush() would discard the copies of the write before it.
+*
+* @param[in] brake true for the brake packet instead of the torque free packet
+* @param[out] burst buffer of kEstopBurstSize bytes
+*
+* @return returns the number of bytes filled
+*/
+int HerkulexDriver::emergencyStopBurst(bool brake, char* burst) const
+{
+	int swallowed = tx_largest_packet.load(std::memory_order_relaxed) - 3;
+	int copies = (swallowed + estop_packet_size - 1) / estop_packet_size + 1;
+	if (copies < estop_repeat)
+		copies = estop_repeat;
+	if (copies * estop_packet_size > kEstopBurstSize)
+		copies = kEstopBurstSize / estop_packet_size;
+	for (int i = 0; i < copies; i++)
+		memcpy(burst + i * estop_packet_size, estop_packets[brake ? 1 : 0], estop_packet_size);
+	return copies * estop_packet_size;
+}
+
+/** @brief true for packets that change the state of a motor (everything except EEP_READ, RAM_READ and STAT) */
+bool HerkulexDriver::isCommandPacket(const char* packet)
+{
+	unsigned char cmd = (unsigned char)packet[4];
+	return cmd != kEEP_READ && cmd != kRAM_READ && cmd != kSTAT;
+}
+
+/** reboot the motor
+*
+* The RAM registers are reloaded from the EEP registers, so everything known about the motor is forgotten
+*
+* @param[in] pID id of the motor
+*
+* return returns nothing
+*/
+void HerkulexDriver::reboot(char pID)
+{
+	send(pID, kREBOOT, NULL, 0);
+	invalidateShadow(pID);
+}
+
+/** restore the factory default EEP registers
+*
+* ROLLBACK data: [ID skip][Baud skip]. When skip is 1, the id or baudrate is kept
+*
+* @param[in] pID id of the motor
+* @param[in] skip_id keep the current id
+* @param[in] skip_baud keep the current baudrate
+*
+* return returns nothing
+*/
+void HerkulexDriver::rollback(char pID, bool skip_id, bool skip_baud)
+{
+	char data[] = { (char)(skip_id ? 1 : 0), (char)(skip_baud ? 1 : 0) };
+	send(pID, kROLLBACK, data, 2);
+	invalidateShadow(pID);
+}
+
+/** runs the Motors using S_JOG protocol
+*
+* All the motors are commanded with one packet sent to the broadcast ID (0xFE), and start moving at the same time.
+* Every entry has its own position, mode and LED. The operating time of sjog[0] is used for all the motors.
+*
+* S_JOG data: [time] then for every motor [position LSB][position MSB][SET][pID]
+*
+* @param[in] *sjog array of S_JOG_TAG structure
+* @param[in] num_sjog number of sjog elements in sjog array (max 53)
+*
+* return returns nothing
+*/
+void HerkulexDriver::runMotor(S_JOG_TAG* sjog, char num_sjog)
+{
+	jog(kS_JOG, sjog, num_sjog);
+}
+
+/** runs the Motors using I_JOG protocol
+*
+* Same as runMotor, but every motor uses the operating time of its own entry.
+*
+* I_JOG data: for every motor [position LSB][position MSB][SET][pID][time]
+*
+* @param[in] *ijog array of S_JOG_TAG structure
+* @param[in] num_ijog number of ijog elements in ijog array (max 43)
+*
+* return returns nothing
+*/
+void HerkulexDriver::runMotorIndividual(S_JOG_TAG* ijog, char num_ijog)
+{
+	jog(kI_JOG, ijog, num_ijog);
+}
+
+/** encodes a S_JOG or I_JOG packet for all the entries and sends it to the broadcast ID
+*
+* SET byte: bit 1 = mode, bit 2 to 4 = LED (green, blue, red)
+*
+* @param[in] cmd kS_JOG or kI_JOG
+* @param[in] *entries array of S_JOG_TAG structure
+* @param[in] num_entries number of elements in entries
+*
+* return returns nothing
+*/
+void HerkulexDriver::jog(HerkulexCmd cmd, S_JOG_TAG* entries, char num_entries)
+{
+	queueShadowWrites(); // keep the order of the writes
+	const int entry_size = (cmd == kS_JOG) ? 4 : 5;
+	const int offset = (cmd == kS_JOG) ? 1 : 0; // S_JOG starts with the shared operating time
+	int datalen = entry_size * num_entries + offset;
+
+	char* data = tx.beginPacket(kBroadcastID, cmd, datalen);
+	if (data == nullptr)
+	{
+		flush(); // TX buffer full. send what has been queued and start again
+		data = tx.beginPacket(kBroadcastID, cmd, datalen);
+		if (data == nullptr)
+			return; // too many entries for one packet
+	}
 
-	char* data = new char[4 * num_sjog + 1];
-	data[0] = sjog[0].time;
-	for (int i = 0; i < num_sjog; i++)
+	if (cmd == kS_JOG)
+		data[0] = entries[0].time;
+	for (int i = 0; i < num_entries; i++)
 	{
 		char pos[2];
-		varc.Short2Char(sjog[i].pos, pos);
-		data[i * 4 + 1] = pos[1];
-		data[i * 4 + 2] = pos[0];
-		data[i * 4 + 3] = (sjog[0].mode << 1) + (sjog[0].led << 2);
-		data[i * 4 + 4] = sjog[i].pID;
+		varc.Short2Char(entries[i].pos, pos);
+		char* entry = data + offset + i * entry_size;
+		entry[0] = pos[1];
+		entry[1] = pos[0];
+		entry[2] = (entries[i].mode << 1) + (entries[i].led << 2);
+		entry[3] = entries[i].pID;
+		if (cmd == kI_JOG)
+			entry[4] = entries[i].time;
 	}
+	tx.endPacket();
 
-	send(sjog[0].pID, kS_JOG, data, 4 * num_sjog + 1, true);
+	if (print_commands)
+		printHexCommand(tx.data() + tx.size() - PacketEncoder::kHeaderSize - datalen, PacketEncoder::kHeaderSize + datalen);
 
-	delete[] data;
+	if (!batching)
+		flush();
 }
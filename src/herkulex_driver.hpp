@@ -2,7 +2,16 @@
 #define HERKULEX_DRIVER_HPP_
 
 #include "serial_stream.hpp"
+#include "serial_port_finder.hpp"
 #include "variable_conversion.hpp"
+#include "packet_framer.hpp"
+#include "packet_encoder.hpp"
+#include "herkulex_registers.hpp"
+#include "register_shadow.hpp"
+#include "servo_status.hpp"
+#include "bus_timing.hpp"
+#include "rtt_estimator.hpp"
+#include <atomic>
 
 enum LEDColour
 {
@@ -11,10 +20,10 @@ enum LEDColour
 	kRed = 0x04
 };
 
-/** Data structure for programming motor movement using S_JOG
+/** Data structure for programming motor movement using S_JOG or I_JOG
 * @param[in] pID id of the motor
 * @param[in] pos (1) position of the motor when mode = 0 (0 to 1023). (2) speed of the motor when mode = 1 (0 to 1023)
-* @param[in] time operating time to reach position or continue speed (0 to 255 ticks). every tick = 11.2ms
+* @param[in] time operating time to reach position or continue speed (0 to 255 ticks). every tick = 11.2ms. (S_JOG uses the time of the first entry for all motors)
 * @param[in] led led colour (green = 0x01, blue = 0x02, red = 0x04)
 * @param[in] mode the control mode (position control = 0, continuous rotation = 1)
 */
@@ -25,14 +34,14 @@ struct S_JOG_TAG {
 	LEDColour led = kGreen;		//led colour (green = 0x01, blue = 0x02, red = 0x04)
 	char mode = 0;				//the control mode (position control = 0, continuous rotation = 1)
 
-	S_JOG_TAG::S_JOG_TAG() {}
+	S_JOG_TAG() {}
 
-	S_JOG_TAG::S_JOG_TAG(char pID, unsigned short pos, char time, LEDColour led, char mode)
+	S_JOG_TAG(char pID, unsigned short pos, char time, LEDColour led, char mode)
 	{
 		set(pID, pos, time, led, mode);
 	}
 
-	void S_JOG_TAG::set(char pID, unsigned short pos, char time, LEDColour led, char mode)
+	void set(char pID, unsigned short pos, char time, LEDColour led, char mode)
 	{
 		this->pID = pID;
 		this->pos = pos;
@@ -43,10 +52,109 @@ struct S_JOG_TAG {
 };
 
 
+enum ReplyStatus
+{
+	kReplyOK = 0,		//valid reply received
+	kReplyTimeout = 1,	//no reply before the timeout
+	kReplyInvalid = 2	//reply received, but with the wrong length
+};
+
+/** Result of reading registers from one motor
+* @param[in] pID id of the motor
+* @param[out] status kReplyOK, kReplyTimeout or kReplyInvalid
+* @param[out] data the register values (only valid when status == kReplyOK)
+* @param[out] length number of bytes in data
+* @param[out] status_error status error byte sent with the reply
+* @param[out] status_detail status detail byte sent with the reply
+* @param[out] rtt_us time between sending the request and receiving the reply in microseconds
+*/
+struct RegisterReply {
+	static const int kMaxLength = 64; //maximum number of registers read at once
+
+	char pID = 0;
+	ReplyStatus status = kReplyTimeout;
+	unsigned char data[kMaxLength];
+	int length = 0;
+	unsigned char status_error = 0;
+	unsigned char status_detail = 0;
+	long long rtt_us = 0;
+};
+
+/** One motor found by HerkulexDriver::scanBus()
+* @param[out] pID id of the motor
+* @param[out] model EEP registers 0 (model number 1, low byte) and 1 (model number 2, high byte). eg: 0x0101 = DRS-0101, 0x0102 = DRS-0201. 0 if it could not be read
+* @param[out] status_error status error sent with the STAT reply
+* @param[out] status_detail status detail sent with the STAT reply
+* @param[out] rtt_us round trip time of the STAT request in microseconds
+*/
+struct ScanResult {
+	char pID = 0;
+	unsigned short model = 0;
+	unsigned char status_error = 0;
+	unsigned char status_detail = 0;
+	long long rtt_us = 0;
+};
+
+/** Write-to-reply times measured by HerkulexDriver::measureTurnaround()
+* @param[out] samples number of replies received
+* @param[out] timeouts number of requests without reply
+* @param[out] first_byte_min_us, first_byte_mean_us, first_byte_max_us time from the write of the request to the first byte of the reply
+* @param[out] reply_mean_us, reply_max_us time from the write of the request to the whole reply
+*/
+struct TurnaroundStats
+{
+	int samples = 0;
+	int timeouts = 0;
+	long long first_byte_min_us = 0;
+	long long first_byte_mean_us = 0;
+	long long first_byte_max_us = 0;
+	long long reply_mean_us = 0;
+	long long reply_max_us = 0;
+};
+
+/** State of one motor, decoded from a single RAM_READ of registers 48 to 65
+* @param[out] pID id of the motor
+* @param[out] valid false if no valid reply was received
+* @param[out] status_error status error (48)
+* @param[out] status_detail status detail (49)
+* @param[out] torque_control torque control (52). 0x00 = torque free, 0x40 = brake on, 0x60 = torque on
+* @param[out] led LED colour (53)
+* @param[out] voltage raw input voltage (54). Voltage = r X 0.074V
+* @param[out] temperature raw temperature (55)
+* @param[out] control_mode current control mode (56). 0 = position, 1 = continuous rotation
+* @param[out] tick operating time tick (57)
+* @param[out] calibrated_position calibrated position (58)
+* @param[out] absolute_position absolute position raw data (60). Angle = r X 0.325
+* @param[out] differential_position velocity (62)
+* @param[out] pwm PWM output (64)
+* @param[out] rtt_us time between sending the request and receiving the reply in microseconds
+*/
+struct ServoTelemetry {
+	typedef HerkulexRegisterRange<RegStatusError, RegPWM> Range; //registers 48 to 65
+
+	char pID;
+	bool valid;
+	unsigned char status_error;
+	unsigned char status_detail;
+	unsigned char torque_control;
+	unsigned char led;
+	unsigned char voltage;
+	unsigned char temperature;
+	unsigned char control_mode;
+	unsigned char tick;
+	unsigned short calibrated_position;
+	unsigned short absolute_position;
+	short differential_position;
+	short pwm;
+	long long rtt_us;
+
+	float absoluteAngle() const { return RegAbsolutePosition::toUnits(absolute_position); }
+	float inputVoltage() const { return RegVoltage::toUnits(voltage); }
+};
+
 /** Uses serial_stream.hpp to send comamnds to herkulex
 *
-* @note for linux, use LibSerial
-* @see http://libserial.sourceforge.net/
+* @note on linux, the constructor takes the device path of the port (eg: /dev/ttyUSB0) instead of the windows friendly name
 *
 * This class is written to mimic the SerialStream.h member functions. Hence, the member functions name are all the same, and not following google style guide
 *
@@ -60,6 +168,9 @@ struct S_JOG_TAG {
  */
 class HerkulexDriver
 {
+public:
+	static const int kNumServo = 254; //valid ids are 0 to 253
+
 private:
 	enum HerkulexCmd
 	{
@@ -76,28 +187,313 @@ private:
 
 	int num_motor;
 	SerialStream sp;
+	int baudrate = BAUD_115200; //baudrate of the port
 
 	VariableConversion varc;
+	PacketFramer framer;
+	PacketEncoder tx;
+	bool batching = false; //when true, send() only queues the packet into tx until endBatch()
+	long reply_timeout_us = 100000; //maximum time to wait for a reply packet, and the timeout of motors without any RTT sample
+	long min_timeout_us = 1000; //minimum adaptive timeout
+	bool adaptive_timeout = true; //when true, the timeout of every motor is derived from its measured round trip time
+	int read_retries = 2; //number of times a read is sent again after a timeout
+	bool probing = false; //scanBus() is running: fixed timeouts, no retries and no RTT statistics
+	RttEstimator rtt[kNumServo];
+	unsigned int timeout_count = 0;
+	unsigned int retry_count = 0;
+	bool late_reply_possible = false; //a request timed out, so its reply might still arrive
+	long long stale_until_us = 0; //time until which that reply might still arrive. see expectLateReply()
+	bool reply_size_wakeup = false; //when true, reads wake up when the whole reply has arrived. see setLowLatency()
+	int pipeline_depth = 4; //maximum number of read requests waiting for their reply at the same time
+	RegisterShadow shadow;
+	bool shadow_enabled = false; //when true, register writes go through the shadow and redundant writes are not sent
+	bool print_commands = false; //when true, every sent packet is printed in hex
 
+	int recovery_policy = kRecoverNone;
+	RecoveryCallback recovery_callback = nullptr;
+	void* recovery_context = nullptr;
+
+	bool readStatus(char pID, ServoStatus& status);
+	void handleStatus(char pID, const ServoStatus& status);
+
+	struct StatusEntry
+	{
+		ServoStatus status;
+		long long updated_us = -1; //time the status was last received. -1 = never
+		bool recovery_pending = false; //the status changed to an error, and the recovery policy has not been applied yet
+	};
+	StatusEntry status_table[kNumServo]; //latest status reported by every motor, taken from every ACK packet
+	StatusChangeCallback status_callback = nullptr;
+	void* status_context = nullptr;
+	bool in_recovery = false;
+	bool any_recovery_pending = false;
+
+	bool nextPacket(HerkulexPacket& packet);
+	void harvestStatus(unsigned char pID, const ServoStatus& status);
+	void runPendingRecovery();
+
+	static const int kMaxPipelineDepth = 16;
+	struct PipelineSlot
+	{
+		int index; //index of the request in the pIDs array
+		char pID;
+		long long sent_us; //time the request was sent
+		long long first_sent_us; //time the request was first sent, before any retry
+		int attempts; //number of times the request was sent again
+	};
+	PipelineSlot slots[kMaxPipelineDepth]; //requests waiting for their reply
+
+	typedef bool (*ReplySink)(void* context, int index, const HerkulexPacket* packet, long long rtt_us);
+	int pipelinedRequest(const char* pIDs, int num_ids, HerkulexCmd cmd, const char* request, int request_len, ReplySink sink, void* context);
+
+#if defined(_WIN32) || defined(WIN32)
 	int getValidComPort(std::string valid_com_name);
+#endif
 	void send(char pID, HerkulexCmd cmd, char* data, char datalen, bool printCommand = false);
-	void read(char* buffer);
-	void printHexCommand(char* data, char len);
+	void flush();
+	void writeTx();
+	void queueShadowWrites();
+	bool receive(char pID, HerkulexCmd cmd, HerkulexPacket& packet, int address = -1, long timeout_us = -1, int reply_size = 0, long long earliest_us = 0);
+	bool request(char pID, HerkulexCmd cmd, char* data, char datalen, HerkulexPacket& packet, int address = -1);
+	long replyTimeout(char pID) const;
+	void sampleRtt(char pID, long long rtt_us);
+	void recordTimeout(char pID, int request_size, int reply_size);
+	void expectLateReply(char pID, int request_size, int reply_size);
+	void discardStale();
+	long long wireTime(int bytes) const;
+	static int replySize(HerkulexCmd cmd, const char* data, int datalen);
+	int probe(const char* pIDs, int num_ids, bool* replied, const BusTiming& timing, long margin_us);
+	void printHexCommand(char* data, int len);
+
+	// emergency stop. see emergencyStop()
+	std::atomic<bool> estop_latched;
+	std::atomic<unsigned int> estop_count; //number of emergencyStop() calls
+	std::atomic<bool> estop_brake; //the last emergencyStop() asked for brake instead of torque free
+	std::atomic<int> tx_largest_packet; //size of the longest packet of the last write. a stop that cuts it can lose that many bytes
+	unsigned int estop_handled = 0; //estop_count when the driver thread last aborted its reads
+	static const int kEstopBurstSize = (PacketEncoder::kMaxPacketSize / (PacketEncoder::kHeaderSize + 3) + 2) * (PacketEncoder::kHeaderSize + 3); //room for enough stop packets to follow the longest packet
+	char estop_packets[2][PacketEncoder::kHeaderSize + 3]; //pre-encoded broadcast RAM_WRITE of register 52: [0] torque free, [1] brake
+	int estop_packet_size = 0;
+	int estop_repeat = 2;
+	std::atomic<long long> estop_latency_us;
+	std::atomic<long long> estop_max_latency_us;
+
+	bool abortPending() const { return estop_count.load(std::memory_order_acquire) != estop_handled; }
+	void handleAbort();
+	void resendEmergencyStop();
+	int emergencyStopBurst(bool brake, char* burst) const;
+	static bool isCommandPacket(const char* packet);
+	static unsigned char torqueControlValue(int mode);
+	void jog(HerkulexCmd cmd, S_JOG_TAG* entries, char num_entries);
 
 public:
-	HerkulexDriver(std::string valid_com_name);
+	static const unsigned char kBroadcastID = 0xFE; //every motor accepts packets sent to this id
+	static const int kRebootMs = 500; //time for a motor to boot after REBOOT
+
+	HerkulexDriver(std::string valid_com_name, int baudrate = BAUD_115200);
+	void beginBatch();
+	void endBatch();
+
 	void setLEDColour(char pID, LEDColour colour);
 	void setAcknowledgePolicy(char pID, int policy = 1);
 	void setControlMode(char pID, int controlmode = 0); 
 	void setTorqueControl(char pID, int mode = 0);
 
+	int setLEDColour(const char* pIDs, int num_ids, LEDColour colour, bool broadcast = false, bool verify = true);
+	int setAcknowledgePolicy(const char* pIDs, int num_ids, int policy, bool broadcast = false, bool verify = true);
+	int setControlMode(const char* pIDs, int num_ids, int controlmode, bool broadcast = false, bool verify = true);
+	int setTorqueControl(const char* pIDs, int num_ids, int mode, bool broadcast = false, bool verify = true);
+
 	float getAbsoluteAngle(char pID);
 	float getCalibratedAngle(char pID);
 	int getError(char pID);
+	bool getStatus(char pID, ServoStatus& status);
 
 	int clearError(char pID);
+	void setRecoveryPolicy(int policy, RecoveryCallback callback = nullptr, void* context = nullptr);
+	void setStatusCallback(StatusChangeCallback callback, void* context = nullptr);
+	bool getCachedStatus(char pID, ServoStatus& status, long long* age_us = nullptr);
+	int refreshStatus(const char* pIDs, int num_ids, long max_age_us);
+	void setPrintCommands(bool print) { print_commands = print; }
+	void reboot(char pID);
+	void rollback(char pID, bool skip_id = true, bool skip_baud = true);
+
+	void setShadowEnabled(bool enabled);
+	void invalidateShadow(char pID);
+	void forgetServo(char pID);
+	unsigned int getSuppressedWriteCount() { return shadow.suppressedCount(); }
+
+	void setPipelineDepth(int depth);
+	void setReadRetries(int retries);
+	void setAdaptiveTimeout(bool enabled, long min_timeout_us = 1000);
+	bool getRttEstimate(char pID, RttEstimator& estimate) const;
+	unsigned int getTimeoutCount() const { return timeout_count; }
+	unsigned int getRetryCount() const { return retry_count; }
+	int setLowLatency(bool enabled, int latency_timer_ms = 1);
+	bool measureTurnaround(char pID, int samples, TurnaroundStats& stats);
+	int scanBus(ScanResult* found, int max_found, const BusTiming& timing, long margin_us = 2000, int max_pass = 3);
+
+	void setBaudrate(int baudrate);
+	int getBaudrate() const { return baudrate; }
+	int detectBaudrate(const char* pIDs, int num_ids, int* baudrates, long turnaround_us = 100, long margin_us = 2000);
+	int migrateBaudrate(const char* pIDs, int num_ids, int baudrate, long turnaround_us = 100, long margin_us = 2000);
+	int readRegisters(const char* pIDs, int num_ids, unsigned char reg, unsigned char len, RegisterReply* results, bool eep = false);
+	void writeRegisters(char pID, unsigned char reg, const unsigned char* values, unsigned char len, bool eep = false, bool force = false);
+	bool readTelemetry(char pID, ServoTelemetry& telemetry);
+	int readTelemetry(const char* pIDs, int num_ids, ServoTelemetry* telemetry);
+
+	template <class Reg> void write(char pID, typename Reg::value_type value);
+	template <class Reg> bool read(char pID, typename Reg::value_type& value);
+	template <class Reg> int writeGroup(const char* pIDs, int num_ids, typename Reg::value_type value, bool broadcast = false, bool verify = true);
+	template <class Reg> int verifyGroup(const char* pIDs, int num_ids, typename Reg::value_type expected, char* failed_ids = nullptr);
+
+	void emergencyStop(bool brake = false);
+	bool isEmergencyStopped() const { return estop_latched; }
+	void clearEmergencyStop();
+	void setEmergencyStopRepeat(int repeat);
+	long long getEmergencyStopLatency(long long* max_us = nullptr) const;
 
 	void runMotor(S_JOG_TAG* sjog, char num_sjog);
+	void runMotorIndividual(S_JOG_TAG* ijog, char num_ijog);
 };
 
+/** @brief write one register
+*
+* The packet size and payload layout come from the register type, eg: write<RegTorqueControl>(pID, 0x60) \n
+* When the shadow is enabled, the write is skipped if the motor is already known to have this value.
+* Inside a batch, adjacent registers written to the same motor are merged into one packet.
+*
+* @param[in] pID id of the motor
+* @param[in] value the value to write
+*
+* @return return nothing
+*/
+template <class Reg>
+void HerkulexDriver::write(char pID, typename Reg::value_type value)
+{
+	if (shadow_enabled && (unsigned char)pID != kBroadcastID)
+	{
+		char bytes[Reg::kWidth];
+		Reg::encode(value, bytes);
+		if (shadow.update(pID, Reg::kEEP, Reg::kAddress, bytes, Reg::kWidth) && !batching)
+			flush(); // send now. inside a batch, adjacent dirty registers are merged when the batch is sent
+		return;
+	}
+
+	queueShadowWrites(); // keep the order of the writes
+	const HerkulexCmd cmd = Reg::kEEP ? kEEP_WRITE : kRAM_WRITE;
+	char* data = tx.beginPacket(pID, cmd, 2 + Reg::kWidth);
+	if (data == nullptr)
+	{
+		flush(); // TX buffer full. send what has been queued and start again
+		data = tx.beginPacket(pID, cmd, 2 + Reg::kWidth);
+	}
+
+	data[0] = (char)Reg::kAddress;
+	data[1] = (char)Reg::kWidth;
+	Reg::encode(value, data + 2);
+	tx.endPacket();
+
+	if (shadow_enabled) // broadcast write: every motor now has this value
+		shadow.storeAll(Reg::kEEP, Reg::kAddress, (const unsigned char*)data + 2, Reg::kWidth);
+
+	if (!batching)
+		flush();
+}
+
+/** @brief read one register
+*
+* Reply data: [add][length][data ... ][status error][status detail]
+*
+* @param[in] pID id of the motor
+* @param[out] value the value of the register. unchanged if no valid reply was received
+*
+* @return returns true if a valid reply was received
+*/
+template <class Reg>
+bool HerkulexDriver::read(char pID, typename Reg::value_type& value)
+{
+	const HerkulexCmd cmd = Reg::kEEP ? kEEP_READ : kRAM_READ;
+	char data[] = { (char)Reg::kAddress, (char)Reg::kWidth };
+
+	HerkulexPacket reply;
+	if (!request(pID, cmd, data, 2, reply, Reg::kAddress) || reply.size != Reg::kReplyPacketSize)
+		return false;
+
+	value = Reg::decode(reply.data() + 2);
+	if (shadow_enabled)
+		shadow.store(pID, Reg::kEEP, Reg::kAddress, reply.data() + 2, Reg::kWidth);
+	return true;
+}
+
+/** @brief write the same register value to many motors in one TX burst, then check it with one pipelined read sweep
+*
+* With broadcast = true, a single packet is sent to kBroadcastID and pIDs are only used for the check. \n
+* Else one packet per motor is encoded back to back and sent with a single write. \n
+* The check reads the register back from every motor with pipelined requests. Every reply also carries the status of the motor (see getCachedStatus()).
+*
+* @note the check needs ACK policy 1 or 2. After setting ACK policy 0, pass verify = false
+*
+* @param[in] pIDs ids of the motors
+* @param[in] num_ids number of motors
+* @param[in] value the value to write
+* @param[in] broadcast send one packet to every motor on the bus instead of one packet per motor
+* @param[in] verify read the register back from every motor
+*
+* @return returns the number of motors that have the value (num_ids when verify is false)
+*/
+template <class Reg>
+int HerkulexDriver::writeGroup(const char* pIDs, int num_ids, typename Reg::value_type value, bool broadcast, bool verify)
+{
+	if (broadcast)
+	{
+		write<Reg>((char)kBroadcastID, value);
+	}
+	else
+	{
+		bool was_batching = batching;
+		batching = true;
+		for (int i = 0; i < num_ids; i++)
+			write<Reg>(pIDs[i], value);
+		batching = was_batching;
+		if (!batching)
+			flush();
+	}
+
+	if (!verify)
+		return num_ids;
+	return verifyGroup<Reg>(pIDs, num_ids, value);
+}
+
+/** @brief read a register from many motors with pipelined requests and compare it with the expected value
+*
+* @param[in] pIDs ids of the motors
+* @param[in] num_ids number of motors
+* @param[in] expected the expected value
+* @param[out] failed_ids the ids of the motors that did not reply or have another value (optional, num_ids entries)
+*
+* @return returns the number of motors that have the expected value
+*/
+template <class Reg>
+int HerkulexDriver::verifyGroup(const char* pIDs, int num_ids, typename Reg::value_type expected, char* failed_ids)
+{
+	const int kChunk = 32;
+	RegisterReply replies[kChunk];
+	int num_ok = 0;
+	int num_failed = 0;
+	for (int first = 0; first < num_ids; first += kChunk)
+	{
+		int n = (num_ids - first < kChunk) ? num_ids - first : kChunk;
+		readRegisters(pIDs + first, n, Reg::kAddress, Reg::kWidth, replies, Reg::kEEP);
+		for (int i = 0; i < n; i++)
+		{
+			if (replies[i].status == kReplyOK && Reg::decode(replies[i].data) == expected)
+				num_ok++;
+			else if (failed_ids != nullptr)
+				failed_ids[num_failed++] = pIDs[first + i];
+		}
+	}
+	return num_ok;
+}
+
 #endif /*HERKULEX_DRIVER_HPP_*/
\ No newline at end of file
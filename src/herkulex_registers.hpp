@@ -0,0 +1,145 @@
+#ifndef HERKULEX_REGISTERS_HPP_
+#define HERKULEX_REGISTERS_HPP_
+
+/** Compile-time description of one herkulex register
+*
+* Everything needed to encode a write or decode a read is a compile-time constant, so HerkulexDriver::write<Reg>() and
+* HerkulexDriver::read<Reg>() build fixed-size packets without any lookup or branch on the register.
+*
+* @tparam Address register address
+* @tparam Width number of bytes (1 or 2). 2 byte registers are little endian
+* @tparam EEP true for EEP registers, false for RAM registers
+* @tparam T the value type. signed types are sign extended on decode
+* @tparam ScaleNum, ScaleDen physical value = raw value X ScaleNum / ScaleDen
+*
+* Created by:
+* @author Er Jie Kai (EJK)
+ */
+template <unsigned char Address, unsigned char Width, bool EEP, typename T, int ScaleNum = 1, int ScaleDen = 1>
+struct HerkulexRegister
+{
+	typedef T value_type;
+
+	enum
+	{
+		kAddress = Address,
+		kWidth = Width,
+		kEEP = EEP,
+		kSigned = (T(-1) < T(0)),
+		kWritePacketSize = 7 + 2 + Width,	//header + [add][length] + data
+		kReadPacketSize = 7 + 2,			//header + [add][length]
+		kReplyPacketSize = 7 + 4 + Width	//header + [add][length] + data + [status error][status detail]
+	};
+
+	/** @brief write the value into the packet data in little endian */
+	static void encode(T value, char* output)
+	{
+		output[0] = (char)(value & 0xFF);
+		if (Width == 2)
+			output[1] = (char)((value >> 8) & 0xFF);
+	}
+
+	/** @brief read the value from the packet data in little endian */
+	static T decode(const unsigned char* input)
+	{
+		return (Width == 2) ? (T)(input[0] | (input[1] << 8)) : (T)input[0];
+	}
+
+	/** @brief convert a raw value into its physical unit */
+	static float toUnits(T raw)
+	{
+		return raw * (float)ScaleNum / (float)ScaleDen;
+	}
+};
+
+/** A block of adjacent registers of the same memory, from First to Last (inclusive)
+*
+* Used to read or write many registers with one packet
+*/
+template <class First, class Last>
+struct HerkulexRegisterRange
+{
+	static_assert((bool)First::kEEP == (bool)Last::kEEP, "register range must not mix RAM and EEP registers");
+	static_assert((int)Last::kAddress >= (int)First::kAddress, "register range must go from the lowest to the highest address");
+
+	enum
+	{
+		kAddress = First::kAddress,
+		kLength = Last::kAddress + Last::kWidth - First::kAddress,
+		kEEP = First::kEEP
+	};
+
+	/** @brief decode register Reg from the data of a reply to this range */
+	template <class Reg>
+	static typename Reg::value_type get(const unsigned char* data)
+	{
+		static_assert((int)Reg::kAddress >= (int)kAddress && (int)(Reg::kAddress + Reg::kWidth) <= (int)(kAddress + kLength), "register is outside of the range");
+		return Reg::decode(data + (Reg::kAddress - kAddress));
+	}
+};
+
+///////////////////// EEP registers (DRS-0101/0201) /////////////////////
+typedef HerkulexRegister<0, 2, true, unsigned short> RegEEPModel;					//model number 1 and 2
+typedef HerkulexRegister<2, 2, true, unsigned short> RegEEPVersion;				//firmware version 1 and 2
+typedef HerkulexRegister<4, 1, true, unsigned char> RegEEPBaudRate;				//communication speed
+typedef HerkulexRegister<6, 1, true, unsigned char> RegEEPID;						//id of the motor after reboot
+typedef HerkulexRegister<7, 1, true, unsigned char> RegEEPAckPolicy;				//ACK policy after reboot
+
+/** Values of RegEEPBaudRate. A motor runs at 2000000 / (code + 1) bits per second, the codes are the ones listed in the manual
+*
+* The baudrate register is only read at boot: a new value takes effect after REBOOT. 1000000 baud is only supported by the DRS-0401/0601
+*/
+struct HerkulexBaudrate
+{
+	static const int kNumRate = 8;
+
+	/** @brief the baudrates from the fastest to the slowest */
+	static int rate(int index)
+	{
+		static const int rates[kNumRate] = { 1000000, 666666, 500000, 400000, 250000, 200000, 115200, 57600 };
+		return (index >= 0 && index < kNumRate) ? rates[index] : 0;
+	}
+
+	/** @brief the baudrate of a value of RegEEPBaudRate. 0 if the value is not listed */
+	static int fromCode(unsigned char code)
+	{
+		for (int i = 0; i < kNumRate; i++)
+		{
+			if (toCode(rate(i)) == code)
+				return rate(i);
+		}
+		return 0;
+	}
+
+	/** @brief the value of RegEEPBaudRate for a baudrate. 0 if the motors do not support it */
+	static unsigned char toCode(int baudrate)
+	{
+		static const unsigned char codes[kNumRate] = { 0x01, 0x02, 0x03, 0x04, 0x07, 0x09, 0x10, 0x22 };
+		for (int i = 0; i < kNumRate; i++)
+		{
+			if (rate(i) == baudrate)
+				return codes[i];
+		}
+		return 0;
+	}
+};
+
+///////////////////// RAM registers (DRS-0101/0201) /////////////////////
+typedef HerkulexRegister<0, 1, false, unsigned char> RegID;						//id of the motor
+typedef HerkulexRegister<1, 1, false, unsigned char> RegAckPolicy;				//0 = no reply, 1 = reply to read only, 2 = reply to all
+typedef HerkulexRegister<48, 1, false, unsigned char> RegStatusError;				//status error
+typedef HerkulexRegister<49, 1, false, unsigned char> RegStatusDetail;			//status detail
+typedef HerkulexRegister<48, 2, false, unsigned short> RegStatus;					//status error (low byte) and status detail (high byte)
+typedef HerkulexRegister<52, 1, false, unsigned char> RegTorqueControl;			//0x00 = torque free, 0x40 = brake on, 0x60 = torque on
+typedef HerkulexRegister<53, 1, false, unsigned char> RegLED;						//green = 0x01, blue = 0x02, red = 0x04
+typedef HerkulexRegister<54, 1, false, unsigned char, 74, 1000> RegVoltage;		//input voltage. V = r X 0.074
+typedef HerkulexRegister<55, 1, false, unsigned char> RegTemperature;				//raw temperature
+typedef HerkulexRegister<56, 1, false, unsigned char> RegControlMode;				//0 = position control, 1 = continuous rotation
+typedef HerkulexRegister<57, 1, false, unsigned char> RegTick;					//operating time tick
+typedef HerkulexRegister<58, 2, false, unsigned short> RegCalibratedPosition;		//calibrated position
+typedef HerkulexRegister<60, 2, false, unsigned short, 13, 40> RegAbsolutePosition;	//absolute position raw data. Angle = r X 0.325
+typedef HerkulexRegister<62, 2, false, short> RegDifferentialPosition;			//velocity
+typedef HerkulexRegister<64, 2, false, short> RegPWM;								//PWM output
+typedef HerkulexRegister<68, 2, false, unsigned short> RegAbsoluteGoalPosition;	//goal position
+
+#endif /*HERKULEX_REGISTERS_HPP_*/
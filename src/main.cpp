@@ -6,6 +6,175 @@
 
 #include "herkulex_driver.hpp"
 #include "KeyboardFunctions.hpp"
+#include "servo_bus_simulator.hpp"
+#include "control_loop.hpp"
+#include "bus_io_thread.hpp"
+#include "polling_scheduler.hpp"
+#include "transaction_scheduler.hpp"
+#include "servo_network.hpp"
+#include "bus_load_planner.hpp"
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <thread>
+
+#ifdef __unix__
+#include <fstream>
+#include <ftw.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define Sleep(ms) usleep((ms) * 1000)
+#define HERKULEX_PORT "/dev/ttyUSB0" // device path of the usb serial adapter
+#else
+#define HERKULEX_PORT "USB Serial Port" // friendly name of the usb serial adapter
+#endif
+
+// counts heap allocations of every thread, so that testEncodeBenchmark and testBatchAllocations can show that encoding and sending do not allocate
+static std::atomic<unsigned long long> heap_allocations(0);
+
+void* operator new(std::size_t size)
+{
+	heap_allocations.fetch_add(1, std::memory_order_relaxed);
+	void* p = malloc(size == 0 ? 1 : size);
+	if (p == nullptr)
+		throw std::bad_alloc();
+	return p;
+}
+
+void operator delete(void* p) noexcept
+{
+	free(p);
+}
+
+void operator delete(void* p, std::size_t) noexcept
+{
+	free(p);
+}
+
+static int failed_checks = 0; // checks failed by the automatic tests, reported by main
+
+/** @brief Print the result of one check of an automatic test and count the failures
+*
+* @param[in] ok result of the check
+* @param[in] what behavior checked
+*
+* @return returns ok
+*/
+bool check(bool ok, const char* what)
+{
+	printf("%s: %s\n", ok ? "PASS" : "FAIL", what);
+	if (!ok)
+		failed_checks++;
+	return ok;
+}
+
+/** @brief Microbenchmark of the packet encoder
+*
+* Does not need any motor to be connected.
+*
+* Every tick encodes a LED, a torque and a S_JOG packet for 20 motors back to back into one TX buffer with PacketEncoder alone.
+* Prints the time per tick and the number of heap allocations per tick (should be 0). testBatchAllocations checks the same through HerkulexDriver
+*
+* @return returns nothing
+*/
+void testEncodeBenchmark()
+{
+	const int num_motor = 20;
+	const int num_tick = 100000;
+	PacketEncoder tx;
+	unsigned long long total_bytes = 0;
+
+	unsigned long long allocations_before = heap_allocations.load();
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	for (int tick = 0; tick < num_tick; tick++)
+	{
+		tx.clear();
+		for (int id = 1; id <= num_motor; id++)
+		{
+			char led[] = { 53, 1, kGreen };
+			tx.add(id, 0x03, led, 3); //RAM_WRITE
+			char torque[] = { 52, 1, 0x60 };
+			tx.add(id, 0x03, torque, 3); //RAM_WRITE
+
+			char* sjog = tx.beginPacket(id, 0x06, 5); //S_JOG
+			sjog[0] = 60;
+			sjog[1] = (char)((tick + id) & 0xFF);
+			sjog[2] = (char)(((tick + id) >> 8) & 0x03);
+			sjog[3] = kGreen << 2;
+			sjog[4] = id;
+			tx.endPacket();
+		}
+		total_bytes += tx.size();
+	}
+	std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+	unsigned long long allocations = heap_allocations.load() - allocations_before;
+
+	double ns_per_tick = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count() / (double)num_tick;
+	printf("Encoded %d packets (%d bytes) per tick: %.1f ns/tick, %.3f heap allocations/tick\n",
+		3 * num_motor, (int)(total_bytes / num_tick), ns_per_tick, allocations / (double)num_tick);
+	check(allocations == 0, "encoding does not allocate");
+	check(tx.packetCount() == 3 * num_motor, "every packet of a tick fits in the TX buffer");
+}
+
+/** @brief Feed the packet framer valid packets mixed with noise, a corrupted packet and a packet split over two reads
+*
+* Does not need any motor to be connected
+*
+* @return returns nothing
+*/
+void testPacketFramer()
+{
+	PacketEncoder tx;
+	const unsigned char noise[] = { 0x00, 0xFF, 0x12, 0xFF };
+	char position[] = { 60, 2 };
+	tx.add(1, 0x04, position, 2); // RAM_READ
+	int first_size = tx.size();
+	tx.add(2, 0x07, nullptr, 0); // STAT, corrupted below
+	tx.add(3, 0x04, position, 2); // RAM_READ
+	tx.data()[first_size + 5] ^= 0x02; // wrong checksum1
+
+	PacketFramer framer;
+	char stream[PacketEncoder::kCapacity];
+	int length = 0;
+	memcpy(stream, noise, sizeof(noise));
+	length += sizeof(noise);
+	memcpy(stream + length, tx.data(), tx.size());
+	length += tx.size();
+
+	int split = length - 3; // the last packet arrives in two reads
+	char received[4];
+	int num_received = 0;
+	HerkulexPacket packet;
+	for (int part = 0; part < 2; part++)
+	{
+		int begin = part == 0 ? 0 : split;
+		int end = part == 0 ? split : length;
+		memcpy(framer.writePtr(), stream + begin, end - begin);
+		framer.commit(end - begin);
+		while (framer.next(packet) && num_received < 4)
+			received[num_received++] = (char)packet.pID();
+	}
+
+	printf("Packet framer: %d packets, %u resyncs, %u checksum errors, %d bytes left\n", num_received, framer.resyncCount(), framer.checksumErrorCount(),
+		framer.available());
+	check(num_received == 2 && received[0] == 1 && received[1] == 3, "frames recovered after noise, a corrupted packet and a split read");
+	check(framer.resyncCount() > 0 && framer.checksumErrorCount() == 1, "noise and corrupted packet counted");
+}
+
+/** @brief Recovery callback used by the tests. Prints the status of the motor that reported an error
+*
+* @return returns nothing
+*/
+void printServoError(void*, char pID, const ServoStatus& status)
+{
+	char text[256];
+	status.describe(text, sizeof(text));
+	printf("pID[%d] %s\n", pID, text);
+}
 
 /** @brief Blink all the specified motors
 *
@@ -17,7 +186,7 @@
 */
 void testBlink()
 {
-	HerkulexDriver hlx("USB Serial Port");
+	HerkulexDriver hlx(HERKULEX_PORT);
 	KeyboardFunctions kb;
 
 	printf("Blinking.");
@@ -59,14 +228,12 @@ void testBlink()
 */
 void testRead()
 {
-	HerkulexDriver hlx("USB Serial Port");
+	HerkulexDriver hlx(HERKULEX_PORT);
 	KeyboardFunctions kb;
-	hlx.setAcknowledgePolicy(1, 1);
-	hlx.setAcknowledgePolicy(2, 1);
-	hlx.setAcknowledgePolicy(3, 1);
-	hlx.setTorqueControl(1, 0);
-	hlx.setTorqueControl(2, 0);
-	hlx.setTorqueControl(3, 0);
+	const char motors[] = { 1, 2, 3 };
+	hlx.setAcknowledgePolicy(motors, 3, 1); // one packet for all 3 motors, checked with one pipelined read sweep
+	hlx.setTorqueControl(motors, 3, 0);
+	hlx.setRecoveryPolicy(kRecoverAutoClear | kRecoverEscalate, printServoError); // clear errors by itself and print them
 	while (1)
 	{
 		//////// Read calibrated angle between 0 to 1023 ////////////
@@ -76,14 +243,26 @@ void testRead()
 		//printf("Angle 1=%hd\t2=%hd\t3=%hd\n", angle1, angle2, angle3);
 
 		//////// Read absolute angle between 0deg to 360 deg ////////////
-		float angle1 = hlx.getAbsoluteAngle(1);
-		float angle2 = hlx.getAbsoluteAngle(2);
-		float angle3 = hlx.getAbsoluteAngle(3);
-		printf("Angle 1=%f\t2=%f\t3=%f\n", angle1, angle2, angle3);
+		//float angle1 = hlx.getAbsoluteAngle(1);
+		//float angle2 = hlx.getAbsoluteAngle(2);
+		//float angle3 = hlx.getAbsoluteAngle(3);
+		//printf("Angle 1=%f\t2=%f\t3=%f\n", angle1, angle2, angle3);
 
-		hlx.getError(1);
-		hlx.getError(2);
-		hlx.getError(3);
+		//////// Read absolute angle of all motors with pipelined requests ////////////
+		const char pIDs[] = { 1, 2, 3 };
+		RegisterReply replies[3];
+		hlx.readRegisters(pIDs, 3, 60, 2, replies); // Absolute position (60), 2 bytes
+		for (int i = 0; i < 3; i++)
+		{
+			if (replies[i].status == kReplyOK)
+				printf("Angle %d=%f\t", replies[i].pID, (replies[i].data[0] | (replies[i].data[1] << 8)) * 0.325);
+			else
+				printf("Angle %d=no reply\t", replies[i].pID);
+		}
+		printf("\n");
+
+		// the status of every motor came with its angle reply. STAT is only sent to motors that did not reply in the last 100ms
+		hlx.refreshStatus(pIDs, 3, 100000);
 
 		if (kb.getNonBlockingTriggers() == KB_ESCAPE) //Press escape to quit
 			break;
@@ -100,14 +279,13 @@ void testRead()
 */
 void testMove()
 {
-	HerkulexDriver hlx("USB Serial Port");
+	HerkulexDriver hlx(HERKULEX_PORT);
 	KeyboardFunctions kb;
-	hlx.setAcknowledgePolicy(1, 1); // acknowledge when Read_only
-	hlx.setAcknowledgePolicy(2, 1); // acknowledge when Read_only
-	hlx.setAcknowledgePolicy(3, 1); // acknowledge when Read_only
-	hlx.setTorqueControl(1, 2); // Torque ON
-	hlx.setTorqueControl(2, 2); // Torque ON
-	hlx.setTorqueControl(3, 2); // Torque ON
+	const char motors[] = { 1, 2, 3 };
+	if (hlx.setAcknowledgePolicy(motors, 3, 1) != 3) // acknowledge when Read_only
+		printf("Not all motors replied\n");
+	hlx.setTorqueControl(motors, 3, 2); // Torque ON
+	hlx.setRecoveryPolicy(kRecoverAutoClear | kRecoverEscalate, printServoError); // clear errors by itself and print them
 
 	S_JOG_TAG* sjog = new S_JOG_TAG[3];
 	while (1)
@@ -115,9 +293,7 @@ void testMove()
 		sjog[0].set(1, 100, 60, kRed, 0); //pID, angle, operating time, operating mode
 		sjog[1].set(2, 100, 60, kRed, 0);
 		sjog[2].set(3, 100, 60, kRed, 0);
-		hlx.runMotor(sjog, 1);
-		hlx.runMotor(sjog + 1, 1);
-		hlx.runMotor(sjog + 2, 1);
+		hlx.runMotor(sjog, 3);
 		Sleep(1000);
 		if (kb.getNonBlockingTriggers() == KB_ESCAPE) //Press escape to quit
 			break;
@@ -125,9 +301,7 @@ void testMove()
 		sjog[0].set(1, 500, 60, kGreen, 0);
 		sjog[1].set(2, 500, 60, kGreen, 0);
 		sjog[2].set(3, 500, 60, kGreen, 0);
-		hlx.runMotor(sjog, 1);
-		hlx.runMotor(sjog + 1, 1);
-		hlx.runMotor(sjog + 2, 1);
+		hlx.runMotor(sjog, 3);
 		Sleep(1000);
 		if (kb.getNonBlockingTriggers() == KB_ESCAPE) //Press escape to quit
 			break;
@@ -135,9 +309,7 @@ void testMove()
 		sjog[0].set(1, 1000, 60, kBlue, 0);
 		sjog[1].set(2, 1000, 60, kBlue, 0);
 		sjog[2].set(3, 1000, 60, kBlue, 0);
-		hlx.runMotor(sjog, 1);
-		hlx.runMotor(sjog + 1, 1);
-		hlx.runMotor(sjog + 2, 1);
+		hlx.runMotor(sjog, 3);
 		Sleep(1000);
 		if (kb.getNonBlockingTriggers() == KB_ESCAPE) //Press escape to quit
 			break;
@@ -145,9 +317,7 @@ void testMove()
 		sjog[0].set(1, 500, 60, kGreen, 0);
 		sjog[1].set(2, 500, 60, kGreen, 0);
 		sjog[2].set(3, 500, 60, kGreen, 0);
-		hlx.runMotor(sjog, 1);
-		hlx.runMotor(sjog + 1, 1);
-		hlx.runMotor(sjog + 2, 1);
+		hlx.runMotor(sjog, 3);
 		Sleep(1000);
 		if (kb.getNonBlockingTriggers() == KB_ESCAPE) //Press escape to quit
 			break;
@@ -162,9 +332,1257 @@ void testMove()
 	delete[] sjog;
 }
 
+#ifdef __unix__
+/** @brief Add motors to a simulator and start it
+*
+* @param[in] sim the simulator
+* @param[in] pIDs ids of the simulated motors
+* @param[in] num_ids number of motors
+* @param[in] turnaround_us time between the end of a request and the start of its reply
+*
+* @return returns true if the simulator started. A failed start counts as a failed check
+*/
+bool startSimulator(ServoBusSimulator& sim, const char* pIDs, int num_ids, long turnaround_us = 100)
+{
+	for (int i = 0; i < num_ids; i++)
+		sim.addServo((unsigned char)pIDs[i]);
+	sim.setBaudrate(115200);
+	sim.setTurnaround(turnaround_us);
+	if (sim.start())
+		return true;
+	check(false, "simulator started");
+	return false;
+}
+
+/** @brief Open the port of a simulated bus twice with the same SerialStream
+*
+* Does not need any motor to be connected. The second Open() closes the first descriptor, so it gets the same (lowest free) descriptor number back.
+*
+* @return returns nothing
+*/
+void testSerialStreamReopen()
+{
+	const char pIDs[] = { 1 };
+	ServoBusSimulator sim;
+	if (!startSimulator(sim, pIDs, 1))
+		return;
+
+	SerialStream sp;
+	int first = sp.Open(sim.slavePath()) == 0 ? sp.fd : -1;
+	int second = sp.Open(sim.slavePath()) == 0 ? sp.fd : -1;
+	printf("SerialStream opened twice: descriptor %d, then %d\n", first, second);
+	check(first >= 0 && second == first, "reopening a port closes its previous descriptor");
+}
+
+/** @brief Count the heap allocations of the command path of the driver against 20 simulated motors
+*
+* Does not need any motor to be connected. Every tick sends, in one batch, a LED and a torque write to every motor and one S_JOG for all of them
+* (beginBatch(), setLEDColour(), setTorqueControl(), runMotor(), endBatch()), so it also counts the write to the port.
+* The count covers every thread, so the simulator is included: it does not allocate either.
+*
+* @return returns nothing
+*/
+void testBatchAllocations()
+{
+	const int num_motor = 20;
+	const int num_tick = 1000;
+	char pIDs[num_motor];
+	for (int i = 0; i < num_motor; i++)
+		pIDs[i] = (char)(i + 1);
+	ServoBusSimulator sim;
+	if (!startSimulator(sim, pIDs, num_motor))
+		return;
+
+	HerkulexDriver hlx(sim.slavePath());
+	S_JOG_TAG sjog[num_motor];
+	unsigned long long allocations_before = 0;
+	std::chrono::steady_clock::time_point start;
+	for (int tick = -1; tick < num_tick; tick++)
+	{
+		if (tick == 0) // the first tick is a warm up
+		{
+			allocations_before = heap_allocations.load();
+			start = std::chrono::steady_clock::now();
+		}
+		hlx.beginBatch();
+		for (int i = 0; i < num_motor; i++)
+		{
+			hlx.setLEDColour(pIDs[i], kGreen);
+			hlx.setTorqueControl(pIDs[i], 2);
+			sjog[i].set(pIDs[i], (unsigned short)(312 + (tick + i) % 400), 1, kGreen, 0);
+		}
+		hlx.runMotor(sjog, num_motor);
+		hlx.endBatch();
+	}
+	unsigned long long allocations = heap_allocations.load() - allocations_before;
+	double us_per_tick = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count() / num_tick;
+
+	unsigned char torque = 0xFF;
+	for (int i = 0; i < 5 && !hlx.read<RegTorqueControl>(pIDs[num_motor - 1], torque); i++)
+		;
+	printf("Driver batch of %d writes and one S_JOG: %.1f us/tick, %.3f heap allocations/tick\n", 2 * num_motor, us_per_tick, allocations / (double)num_tick);
+	check(allocations == 0, "the command path of the driver does not allocate");
+	check(torque == 0x60 && sim.commandCount(0x06) == (unsigned int)num_tick + 1, "every batch reached the motors");
+}
+
+/** @brief Benchmark the driver against simulated motors
+*
+* Does not need any motor to be connected. 3 motors (pID = 1, 2, 3) are simulated behind a pseudo-terminal at 115200 baud with 100us turnaround.
+*
+* Measures the rate of single reads, pipelined reads and full telemetry reads
+*
+* @return returns nothing
+*/
+void testSimulator()
+{
+	ServoBusSimulator sim;
+	const char pIDs[] = { 1, 2, 3 };
+	if (!startSimulator(sim, pIDs, 3))
+		return;
+
+	HerkulexDriver hlx(sim.slavePath());
+	hlx.setAdaptiveTimeout(false); // no spurious retry skews the rates. see testAdaptiveTimeout
+	const int num_cycle = 200;
+
+	int single_ok = 0;
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	for (int i = 0; i < num_cycle; i++)
+	{
+		for (int m = 0; m < 3; m++)
+			single_ok += std::isnan(hlx.getAbsoluteAngle(pIDs[m])) ? 0 : 1;
+	}
+	double single_s = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	int pipelined_ok = 0;
+	RegisterReply replies[3];
+	start = std::chrono::steady_clock::now();
+	for (int i = 0; i < num_cycle; i++)
+		pipelined_ok += hlx.readRegisters(pIDs, 3, RegAbsolutePosition::kAddress, RegAbsolutePosition::kWidth, replies);
+	double pipelined_s = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	int telemetry_ok = 0;
+	ServoTelemetry telemetry[3];
+	start = std::chrono::steady_clock::now();
+	for (int i = 0; i < num_cycle; i++)
+		telemetry_ok += hlx.readTelemetry(pIDs, 3, telemetry);
+	double telemetry_s = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	printf("Simulated bus, 3 motors: getAbsoluteAngle %.1f cycles/s, readRegisters %.1f cycles/s, readTelemetry %.1f cycles/s\n",
+		num_cycle / single_s, num_cycle / pipelined_s, num_cycle / telemetry_s);
+	printf("Simulator: %u packets, %u replies, %u checksum errors\n", sim.packetCount(), sim.replyCount(), sim.checksumErrorCount());
+	check(single_ok == 3 * num_cycle, "every single read replied");
+	check(pipelined_ok == 3 * num_cycle, "every pipelined read replied");
+	check(telemetry_ok == 3 * num_cycle, "every telemetry read replied");
+	check(sim.checksumErrorCount() == 0 && sim.replyCount() == (unsigned int)(9 * num_cycle), "one valid request per reply");
+}
+
+/** Data shared with controlCycle by testControlLoop */
+struct ControlLoopDemo
+{
+	HerkulexDriver* hlx;
+	RegisterReply positions[3];
+};
+
+/** @brief One cycle of testControlLoop: reads the position of the 3 motors and sends a new goal every second
+*
+* @return returns nothing
+*/
+void controlCycle(void* context, long long cycle)
+{
+	ControlLoopDemo* demo = (ControlLoopDemo*)context;
+	const char pIDs[] = { 1, 2, 3 };
+	demo->hlx->readRegisters(pIDs, 3, RegAbsolutePosition::kAddress, RegAbsolutePosition::kWidth, demo->positions);
+
+	if (cycle % 100 == 0)
+	{
+		unsigned short pos = (cycle / 100) % 2 ? 312 : 712;
+		S_JOG_TAG sjog[3];
+		for (int i = 0; i < 3; i++)
+			sjog[i].set(pIDs[i], pos, 50, kGreen, 0);
+		demo->hlx->runMotor(sjog, 3);
+	}
+}
+
+/** @brief Run a 100 Hz control loop against simulated motors and print its jitter statistics
+*
+* Does not need any motor to be connected. 3 motors (pID = 1, 2, 3) are simulated at 115200 baud. \n
+* Run as root to also get SCHED_FIFO and mlockall.
+*
+* @return returns nothing
+*/
+void testControlLoop()
+{
+	ServoBusSimulator sim;
+	const char pIDs[] = { 1, 2, 3 };
+	if (!startSimulator(sim, pIDs, 3))
+		return;
+
+	HerkulexDriver hlx(sim.slavePath());
+	hlx.setTorqueControl(pIDs, 3, 2); // Torque ON
+
+	ControlLoopDemo demo;
+	demo.hlx = &hlx;
+
+	ControlLoop loop(10000000); // 100 Hz
+	loop.setRealtime(80);
+	loop.run(controlCycle, &demo, 300);
+	loop.printStats();
+	const ControlLoopStats& stats = loop.getStats();
+	check(stats.cycles == 300, "300 cycles run");
+	check(stats.overruns < 30, "less than 10% of the cycles overran");
+	int replied = 0;
+	for (int i = 0; i < 3; i++)
+		replied += demo.positions[i].status == kReplyOK ? 1 : 0;
+	check(replied == 3, "positions read in the last cycle");
+}
+
+/** @brief One cycle of testBusIoThread: reads the latest telemetry and queues a new goal every second. Never touches the serial port
+*
+* @return returns nothing
+*/
+void asyncControlCycle(void* context, long long cycle)
+{
+	BusIoThread* bus = (BusIoThread*)context;
+	const BusSnapshot& snapshot = bus->snapshot();
+	(void)snapshot.telemetry[0].absoluteAngle();
+
+	if (cycle % 100 == 0)
+	{
+		unsigned short pos = (cycle / 100) % 2 ? 312 : 712;
+		S_JOG_TAG sjog[3];
+		for (int i = 0; i < 3; i++)
+			sjog[i].set(i + 1, pos, 50, kGreen, 0);
+		bus->runMotor(sjog, 3);
+	}
+}
+
+/** @brief Run a 100 Hz control loop while a bus I/O thread reads the telemetry of 3 simulated motors at 50 Hz
+*
+* Does not need any motor to be connected. The control loop only uses the command queue and the telemetry snapshot,
+* so its callback duration stays in microseconds while the bus transfers run in parallel. \n
+* At the same time, 3 reader threads read the motor states from the shared ServoStateTable, to measure the cost of one read.
+*
+* @return returns nothing
+*/
+void testBusIoThread()
+{
+	ServoBusSimulator sim;
+	const char pIDs[] = { 1, 2, 3 };
+	if (!startSimulator(sim, pIDs, 3))
+		return;
+
+	BusIoThread bus(sim.slavePath());
+	bus.setPolledServos(pIDs, 3);
+	for (int i = 0; i < 3; i++)
+		bus.setTorqueControl(pIDs[i], 2); // Torque ON
+	bus.start(20000000); // 50 Hz
+
+	const int num_reader = 3;
+	std::atomic<bool> reading(true);
+	long long reads[num_reader] = { 0 };
+	double read_s[num_reader] = { 0 };
+	std::thread readers[num_reader];
+	for (int r = 0; r < num_reader; r++)
+	{
+		readers[r] = std::thread([&, r]() {
+			const ServoStateTable& states = bus.stateTable();
+			ServoTelemetry telemetry;
+			std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+			while (reading)
+			{
+				states.read(r + 1, telemetry);
+				reads[r]++;
+			}
+			read_s[r] = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		});
+	}
+
+	ControlLoop loop(10000000); // 100 Hz
+	loop.run(asyncControlCycle, &bus, 300);
+	reading = false;
+	for (int r = 0; r < num_reader; r++)
+		readers[r].join();
+	bus.stop();
+
+	const BusSnapshot& snapshot = bus.snapshot();
+	printf("Bus I/O thread: %lld cycles, %u dropped commands, motor 1 at %.1f deg\n", snapshot.cycle + 1, bus.droppedCommandCount(), snapshot.telemetry[0].absoluteAngle());
+	const ControlLoopStats& io_stats = bus.getStats();
+	printf("I/O cycle [us]: mean %.1f, p99 %lld, %lld overruns\n", io_stats.callback_duration.mean(), io_stats.callback_duration.percentile(99), io_stats.overruns);
+	loop.printStats();
+	for (int r = 0; r < num_reader; r++)
+		printf("State table reader %d: %lld reads, %.1f ns/read\n", r, reads[r], read_s[r] * 1e9 / reads[r]);
+
+	int valid = 0;
+	for (int i = 0; i < 3; i++)
+		valid += snapshot.telemetry[i].valid ? 1 : 0;
+	check(snapshot.cycle + 1 >= 100, "I/O thread ran about 50 cycles per second");
+	check(valid == 3, "telemetry of every motor published");
+	check(bus.droppedCommandCount() == 0, "no command dropped");
+	check(reads[0] > 0 && reads[1] > 0 && reads[2] > 0, "state table read by every reader");
+}
+
+/** Data shared with pollingCycle by testPollingScheduler */
+struct PollingDemo
+{
+	HerkulexDriver* hlx;
+	PollingScheduler* poller;
+};
+
+/** @brief One cycle of testPollingScheduler: moves the 3 motors for 1 second out of every 3, and polls within 8ms of bus time
+*
+* @return returns nothing
+*/
+void pollingCycle(void* context, long long cycle)
+{
+	PollingDemo* demo = (PollingDemo*)context;
+	if (cycle % 300 == 0)
+	{
+		unsigned short pos = (cycle / 300) % 2 ? 312 : 712;
+		S_JOG_TAG sjog[3];
+		for (int i = 0; i < 3; i++)
+			sjog[i].set(i + 1, pos, 90, kGreen, 0); // 90 ticks = 1 second
+		demo->hlx->runMotor(sjog, 3);
+	}
+	demo->poller->poll(*demo->hlx, 8000);
+}
+
+/** @brief Poll 3 simulated motors with a PollingScheduler in a 100 Hz loop
+*
+* Does not need any motor to be connected. Position is polled at 20 Hz (100 Hz while moving), status at 10 Hz and voltage/temperature at 1 Hz.
+*
+* @return returns nothing
+*/
+void testPollingScheduler()
+{
+	ServoBusSimulator sim;
+	const char pIDs[] = { 1, 2, 3 };
+	if (!startSimulator(sim, pIDs, 3))
+		return;
+
+	HerkulexDriver hlx(sim.slavePath());
+	hlx.setTorqueControl(pIDs, 3, 2); // Torque ON
+
+	PollingScheduler poller(sim.getTiming());
+	for (char pID = 1; pID <= 3; pID++)
+		poller.addServo(pID);
+	poller.setRate(kPollPosition, 20, 100);
+	poller.setRate(kPollStatus, 10);
+	poller.setRate(kPollHealth, 1);
+
+	PollingDemo demo;
+	demo.hlx = &hlx;
+	demo.poller = &poller;
+	ControlLoop loop(10000000); // 100 Hz
+	loop.run(pollingCycle, &demo, 600);
+
+	poller.printStats();
+	loop.printStats();
+	const PollingScheduler::Stats& stats = poller.getStats();
+	check(stats.failed_reads * 100 <= stats.reads, "at most 1% of the polls failed");
+	check(stats.group_reads[kPollPosition] > 3 * 6 * 20 * 3 / 2, "position polled faster while moving"); // 3 motors for 6 seconds at 20 Hz, 100 Hz while moving
+	check(stats.group_reads[kPollHealth] >= 3 * 5 && stats.group_reads[kPollHealth] <= 3 * 8, "health polled at 1 Hz");
+	check(stats.group_reads[kPollStatus] == 0, "status taken from the position and health replies");
+	check(stats.planned_us <= stats.budget_us, "polls fit in the bus time budget");
+}
+
+/** Data shared with transactionCycle by testTransactionScheduler */
+struct TransactionDemo
+{
+	TransactionScheduler* scheduler;
+	long long setpoints = 0;
+	long long reads = 0;
+	long long replies = 0;
+	long long dropped = 0;
+	long long max_planned_us = 0;
+};
+
+/** @brief Counts the replies of the reads of testTransactionScheduler
+*
+* @return returns nothing
+*/
+void countReply(void* context, const RegisterReply& reply)
+{
+	TransactionDemo* demo = (TransactionDemo*)context;
+	if (reply.status == kReplyOK)
+		demo->replies++;
+	else
+		demo->dropped++;
+}
+
+/** @brief Reply callback of testTransactionScheduler that submits a read of the next motor from inside runCycle(), whether the read was answered or not
+*
+* @return returns nothing
+*/
+void followUpRead(void* context, const RegisterReply& reply)
+{
+	TransactionDemo* demo = (TransactionDemo*)context;
+	countReply(context, reply);
+	long long deadline_us = TransactionScheduler::nowMicros() + 10000;
+	if (demo->scheduler->submitRead(reply.pID % 3 + 1, RegVoltage::kAddress, 2, deadline_us, countReply, demo))
+		demo->reads++;
+}
+
+/** @brief One cycle of testTransactionScheduler: a setpoint and 3 position reads every cycle, plus a burst of 30 health reads every second
+*
+* @return returns nothing
+*/
+void transactionCycle(void* context, long long cycle)
+{
+	TransactionDemo* demo = (TransactionDemo*)context;
+	TransactionScheduler& scheduler = *demo->scheduler;
+	long long now = TransactionScheduler::nowMicros();
+
+	S_JOG_TAG sjog[3];
+	for (int i = 0; i < 3; i++)
+		sjog[i].set(i + 1, (unsigned short)(512 + 200 * sin(cycle * 0.05)), 1, kGreen, 0);
+	if (scheduler.submitJog(sjog, 3, now + 10000))
+		demo->setpoints++;
+
+	for (char pID = 1; pID <= 3; pID++)
+	{
+		if (scheduler.submitRead(pID, RegAbsolutePosition::kAddress, RegAbsolutePosition::kWidth, now + 10000, countReply, demo))
+			demo->reads++;
+	}
+
+	if (cycle % 100 == 0) // telemetry spike
+	{
+		for (int i = 0; i < 30; i++)
+		{
+			if (scheduler.submitRead(1 + i % 3, RegVoltage::kAddress, 2, now + 30000, countReply, demo))
+				demo->reads++;
+		}
+	}
+
+	BusCycleReport report = scheduler.runCycle(8000);
+	if (report.planned_us > demo->max_planned_us)
+		demo->max_planned_us = report.planned_us;
+}
+
+/** @brief Send setpoints and polls to 3 simulated motors through a TransactionScheduler in a 100 Hz loop
+*
+* Does not need any motor to be connected. Every second a burst of reads asks for more bus time than the cycle has:
+* the setpoints still go out every cycle, and the reads that do not fit are deferred, then dropped when stale.
+*
+* @return returns nothing
+*/
+void testTransactionScheduler()
+{
+	ServoBusSimulator sim;
+	const char pIDs[] = { 1, 2, 3 };
+	if (!startSimulator(sim, pIDs, 3))
+		return;
+
+	HerkulexDriver hlx(sim.slavePath());
+	TransactionScheduler scheduler(hlx, sim.getTiming());
+	scheduler.submitTorqueOff(HerkulexDriver::kBroadcastID);
+	scheduler.runCycle(8000);
+	hlx.setTorqueControl(pIDs, 3, 2); // Torque ON
+
+	TransactionDemo demo;
+	demo.scheduler = &scheduler;
+	ControlLoop loop(10000000); // 100 Hz
+	loop.run(transactionCycle, &demo, 300);
+
+	printf("Setpoints submitted %lld, reads replied %lld, reads dropped %lld, max planned bus time per cycle %lld us\n",
+		demo.setpoints, demo.replies, demo.dropped, demo.max_planned_us);
+	scheduler.printStats();
+	loop.printStats();
+
+	Sleep(20); // the simulator handles the last burst
+	const BusCycleReport& totals = scheduler.getTotals();
+	check(demo.setpoints == 300 && sim.commandCount(0x06) == 300, "a setpoint sent every cycle");
+	check(totals.deferred > 0 && demo.dropped > 0, "reads deferred, then dropped, during the bursts");
+	check(demo.replies + demo.dropped + scheduler.pending() == demo.reads, "every read replied, dropped or still queued");
+	check(demo.max_planned_us <= 8000, "planned bus time within the budget");
+
+	// a read submitted by a callback is sent in the next cycle. the callbacks run whether the reads are answered or not
+	for (int i = 0; i < 10 && scheduler.pending() > 0; i++)
+		scheduler.runCycle(1000000);
+	long long handled = demo.replies + demo.dropped;
+	if (scheduler.submitRead(1, RegVoltage::kAddress, 2, TransactionScheduler::nowMicros() + 10000, followUpRead, &demo))
+		demo.reads++;
+	scheduler.runCycle(8000);
+	int queued = scheduler.pending();
+	scheduler.runCycle(8000);
+	check(queued == 1 && scheduler.pending() == 0 && demo.replies + demo.dropped == handled + 2, "a read submitted by a reply callback is kept and sent in the next cycle");
+
+	// torque off is sent even when the shadow of the driver says the torque is already off
+	hlx.setShadowEnabled(true);
+	unsigned int writes = sim.commandCount(0x03); //RAM_WRITE
+	for (int i = 0; i < 2; i++)
+	{
+		scheduler.submitTorqueOff(1);
+		scheduler.runCycle(8000);
+	}
+	// the simulator has handled the writes once it answers a read sent after them
+	unsigned char torque = 0xFF;
+	for (int i = 0; i < 5 && !hlx.read<RegTorqueControl>(1, torque); i++)
+		;
+	check(sim.commandCount(0x03) - writes == 2 && torque == 0x00, "every torque off sent");
+}
+
+static HerkulexDriver* estop_driver = nullptr; //driver stopped by onEmergencySignal
+
+/** @brief Signal handler of testEmergencyStop
+*
+* @return returns nothing
+*/
+void onEmergencySignal(int)
+{
+	if (estop_driver != nullptr)
+		estop_driver->emergencyStop();
+}
+
+/** @brief Trigger emergency stops on 3 simulated motors from another thread and from a signal handler, while the main thread is reading
+*
+* Does not need any motor to be connected. The motors answer after 20ms, so the stop always arrives while a read is waiting for its reply.
+*
+* @return returns nothing
+*/
+void testEmergencyStop()
+{
+	ServoBusSimulator sim;
+	const char pIDs[] = { 1, 2, 3 };
+	if (!startSimulator(sim, pIDs, 3, 20000))
+		return;
+
+	HerkulexDriver hlx(sim.slavePath());
+	hlx.setTorqueControl(pIDs, 3, 2); // Torque ON
+
+	// stop from another thread while the main thread waits for a reply
+	std::thread detector([&hlx]() {
+		Sleep(5);
+		hlx.emergencyStop();
+	});
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	float angle = hlx.getAbsoluteAngle(1);
+	double read_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	detector.join();
+	printf("Emergency stop from a thread: read aborted after %.1f ms (angle %.1f), latency %lld us\n", read_ms, angle, hlx.getEmergencyStopLatency());
+	check(std::isnan(angle) && read_ms < 20, "read aborted before its reply");
+
+	// writes are dropped until the stop is cleared
+	hlx.setTorqueControl(1, 2);
+	unsigned char torque = 0xFF;
+	hlx.read<RegTorqueControl>(1, torque);
+	printf("Torque of motor 1 while stopped: 0x%02x\n", torque);
+	check(torque == 0x00, "torque off, and writes dropped while stopped");
+	hlx.clearEmergencyStop();
+
+	// stop from a signal handler
+	hlx.setTorqueControl(1, 2);
+	estop_driver = &hlx;
+	signal(SIGINT, onEmergencySignal);
+	raise(SIGINT);
+	signal(SIGINT, SIG_DFL);
+	estop_driver = nullptr;
+	long long max_us = 0;
+	long long latency_us = hlx.getEmergencyStopLatency(&max_us);
+	torque = 0xFF;
+	hlx.read<RegTorqueControl>(1, torque);
+	printf("Emergency stop from a signal handler: latency %lld us (max %lld us), torque of motor 1: 0x%02x\n", latency_us, max_us, torque);
+	check(torque == 0x00, "torque off after a stop from a signal handler");
+	hlx.clearEmergencyStop();
+}
+
+/** @brief Stop 3 simulated motors from another thread while the main thread streams torque on and jog packets, 100 times
+*
+* Does not need any motor to be connected. Wherever the stop falls in the stream, the last torque write the motors receive must be the stop.
+*
+* @return returns nothing
+*/
+void testEmergencyStopRace()
+{
+	ServoBusSimulator sim;
+	const char pIDs[] = { 1, 2, 3 };
+	if (!startSimulator(sim, pIDs, 3))
+		return;
+
+	HerkulexDriver hlx(sim.slavePath());
+	const int num_trial = 100;
+	int num_stopped = 0;
+	long long num_burst = 0;
+	for (int trial = 0; trial < num_trial; trial++)
+	{
+		std::thread detector([&hlx, trial]() {
+			std::this_thread::sleep_for(std::chrono::microseconds(200 + (trial * 137) % 2000));
+			hlx.emergencyStop();
+		});
+		for (int after_stop = 0; after_stop < 3; num_burst++)
+		{
+			S_JOG_TAG sjog[3];
+			hlx.beginBatch();
+			for (int i = 0; i < 3; i++)
+			{
+				hlx.setTorqueControl(pIDs[i], 2); // Torque ON
+				sjog[i].set(pIDs[i], (unsigned short)(312 + (num_burst % 400)), 1, kGreen, 0);
+			}
+			hlx.runMotor(sjog, 3);
+			hlx.endBatch();
+			if (hlx.isEmergencyStopped())
+				after_stop++;
+		}
+		detector.join();
+
+		int num_free = 0;
+		for (int i = 0; i < 3; i++)
+		{
+			unsigned char torque = 0xFF;
+			if (hlx.read<RegTorqueControl>(pIDs[i], torque) && torque == 0x00)
+				num_free++;
+		}
+		if (num_free == 3 && sim.lastRamWrite(RegTorqueControl::kAddress) == 0x00)
+			num_stopped++;
+		hlx.clearEmergencyStop();
+	}
+	printf("Emergency stop during a stream of %lld torque on and jog bursts: %d/%d stops were the last torque write\n", num_burst, num_stopped, num_trial);
+	check(num_stopped == num_trial, "no torque on sent after an emergency stop from another thread");
+}
+
+/** @brief Compare the startup of 24 simulated motors with one packet per motor and one packet per setting
+*
+* Does not need any motor to be connected. Startup = ACK policy, control mode, LED and torque on, then a check that every motor has the settings.
+*
+* @return returns nothing
+*/
+void testGroupConfig()
+{
+	const int num_motor = 24;
+	ServoBusSimulator sim;
+	char pIDs[num_motor];
+	for (int i = 0; i < num_motor; i++)
+		pIDs[i] = (char)(i + 1);
+	if (!startSimulator(sim, pIDs, num_motor))
+		return;
+
+	HerkulexDriver hlx(sim.slavePath());
+
+	// one packet per motor and setting, checked one motor at a time
+	unsigned int packets = sim.packetCount();
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	int ready = 0;
+	for (int i = 0; i < num_motor; i++)
+	{
+		hlx.setAcknowledgePolicy(pIDs[i], 1);
+		hlx.setControlMode(pIDs[i], 0);
+		hlx.setLEDColour(pIDs[i], kBlue);
+		hlx.setTorqueControl(pIDs[i], 2);
+		unsigned char torque = 0;
+		if (hlx.read<RegTorqueControl>(pIDs[i], torque) && torque == 0x60)
+			ready++;
+	}
+	double single_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	unsigned int single_packets = sim.packetCount() - packets;
+	printf("Startup one motor at a time: %d/%d ready, %u packets, %.1f ms\n", ready, num_motor, single_packets, single_ms);
+	check(ready == num_motor, "every motor ready, one motor at a time");
+
+	// one broadcast packet per setting, checked with one pipelined sweep
+	hlx.setTorqueControl(pIDs, num_motor, 0, true, false);
+	packets = sim.packetCount();
+	start = std::chrono::steady_clock::now();
+	hlx.beginBatch();
+	hlx.setAcknowledgePolicy(pIDs, num_motor, 1, true, false);
+	hlx.setControlMode(pIDs, num_motor, 0, true, false);
+	hlx.setLEDColour(pIDs, num_motor, kBlue, true, false);
+	hlx.endBatch();
+	ready = hlx.setTorqueControl(pIDs, num_motor, 2, true);
+	double group_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	unsigned int group_packets = sim.packetCount() - packets;
+	printf("Startup with broadcast: %d/%d ready, %u packets, %.1f ms\n", ready, num_motor, group_packets, group_ms);
+	check(ready == num_motor, "every motor ready with broadcast");
+	check(group_packets < single_packets / 2, "broadcast startup uses less than half the packets");
+}
+
+/** @brief Find the motors of a simulated bus with ids spread over the whole id range
+*
+* Does not need any motor to be connected
+*
+* @return returns nothing
+*/
+void testBusScan()
+{
+	const unsigned char ids[] = { 0, 1, 2, 3, 17, 42, 100, 219, 253 };
+	const int num_motor = sizeof(ids);
+	ServoBusSimulator sim;
+	BusTiming timing(115200, 100);
+	if (!startSimulator(sim, (const char*)ids, num_motor, timing.turnaround_us))
+		return;
+
+	HerkulexDriver hlx(sim.slavePath());
+	ScanResult found[HerkulexDriver::kNumServo];
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	int num_found = hlx.scanBus(found, HerkulexDriver::kNumServo, timing);
+	double elapsed_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+	printf("Bus scan: %d/%d motors found in %.1f ms (%u packets)\n", num_found, num_motor, elapsed_ms, sim.packetCount());
+	for (int i = 0; i < num_found; i++)
+	{
+		printf("  id %3d: model 0x%04X, status %02X %02X, rtt %lld us\n", (unsigned char)found[i].pID, found[i].model, found[i].status_error, found[i].status_detail,
+			found[i].rtt_us);
+	}
+
+	int num_matched = 0;
+	for (int i = 0; i < num_motor; i++)
+	{
+		for (int f = 0; f < num_found; f++)
+		{
+			if ((unsigned char)found[f].pID == ids[i])
+			{
+				num_matched++;
+				break;
+			}
+		}
+	}
+	check(num_found == num_motor && num_matched == num_motor, "every simulated id found by the scan, and nothing else");
+}
+
+/** @brief Read from a simulated bus that loses one reply in 25, with a fixed timeout and no retry, then with adaptive timeouts and retries
+*
+* Does not need any motor to be connected
+*
+* @return returns nothing
+*/
+void testAdaptiveTimeout()
+{
+	const char pIDs[] = { 1, 2, 3 };
+	const int num_cycle = 200;
+	ServoBusSimulator sim;
+	sim.setDropRate(25);
+	if (!startSimulator(sim, pIDs, 3))
+		return;
+
+	HerkulexDriver hlx(sim.slavePath());
+	int failed_reads[2];
+	double total_time_ms[2];
+	for (int adaptive = 0; adaptive <= 1; adaptive++)
+	{
+		hlx.setAdaptiveTimeout(adaptive == 1);
+		hlx.setReadRetries(adaptive == 1 ? 2 : 0);
+		unsigned int timeouts = hlx.getTimeoutCount();
+		unsigned int retries = hlx.getRetryCount();
+		int failed = 0;
+		double worst_ms = 0;
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		for (int cycle = 0; cycle < num_cycle; cycle++)
+		{
+			std::chrono::steady_clock::time_point cycle_start = std::chrono::steady_clock::now();
+			ServoTelemetry telemetry[3];
+			failed += 3 - hlx.readTelemetry(pIDs, 3, telemetry);
+			if (std::isnan(hlx.getAbsoluteAngle(1)))
+				failed++;
+			double cycle_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - cycle_start).count();
+			if (cycle_ms > worst_ms)
+				worst_ms = cycle_ms;
+		}
+		double total_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+		printf("%s: %d/%d reads failed, %u timeouts, %u retries, %.0f ms total, worst cycle %.1f ms\n", adaptive ? "Adaptive timeout, 2 retries" : "Fixed 100 ms timeout, no retry",
+			failed, num_cycle * 4, hlx.getTimeoutCount() - timeouts, hlx.getRetryCount() - retries, total_ms, worst_ms);
+		failed_reads[adaptive] = failed;
+		total_time_ms[adaptive] = total_ms;
+	}
+	check(failed_reads[0] > 0 && failed_reads[1] < failed_reads[0], "retries recover lost replies");
+	check(total_time_ms[1] < total_time_ms[0], "adaptive timeouts wait less than the fixed timeout");
+
+	// the late reply to a timed out or retried read must not be taken as the reply of the next read of the same register
+	int num_stale = 0;
+	int num_replied = 0;
+	for (int i = 0; i < 300; i++)
+	{
+		unsigned char colour = (unsigned char)(1 << (i % 3));
+		hlx.write<RegLED>(1, colour);
+		unsigned char led = 0xFF;
+		if (hlx.read<RegLED>(1, led))
+		{
+			num_replied++;
+			num_stale += led != colour ? 1 : 0;
+		}
+	}
+	printf("LED read back after every write: %d replies, %d with the value of an earlier read\n", num_replied, num_stale);
+	check(num_replied > 0 && num_stale == 0, "no read returns the late reply to an earlier read");
+
+	for (int i = 0; i < 3; i++)
+	{
+		RttEstimator estimate;
+		if (hlx.getRttEstimate(pIDs[i], estimate))
+			printf("  motor %d: srtt %lld us, rttvar %lld us, timeout %lld us, %u timeouts, %u retries\n", pIDs[i], estimate.srtt_us, estimate.rttvar_us, estimate.rto_us,
+				estimate.timeouts, estimate.retries);
+	}
+}
+
+/** @brief Control cycle of testServoNetwork: move all 12 motors every second and read their gathered telemetry
+*
+* @param[in] context the ServoNetwork
+* @param[in] cycle number of the cycle
+*
+* @return returns nothing
+*/
+void networkControlCycle(void* context, long long cycle)
+{
+	ServoNetwork* network = (ServoNetwork*)context;
+	const NetworkSnapshot& snapshot = network->snapshot();
+	(void)snapshot.telemetry[0].absoluteAngle();
+
+	if (cycle % 100 == 0)
+	{
+		unsigned short pos = (cycle / 100) % 2 ? 312 : 712;
+		S_JOG_TAG sjog[12];
+		for (int i = 0; i < 12; i++)
+			sjog[i].set(i + 1, pos, 50, kGreen, 0);
+		network->runMotor(sjog, 12);
+	}
+}
+
+/** @brief Read the telemetry of 12 simulated motors on 1 bus, then on 2 buses, as fast as the buses allow
+*
+* Does not need any motor to be connected. The motors are found by ServoNetwork::discover(), which scans the buses in parallel.
+*
+* @return returns nothing
+*/
+void testServoNetwork()
+{
+	BusTiming timing(115200, 100);
+	double refresh_hz[2];
+	for (int num_bus = 1; num_bus <= 2; num_bus++)
+	{
+		ServoBusSimulator sims[2];
+		ServoNetwork network;
+		for (int b = 0; b < num_bus; b++)
+		{
+			char pIDs[12];
+			int num_ids = 0;
+			for (int id = 1; id <= 12; id++)
+			{
+				if ((id - 1) * num_bus / 12 == b)
+					pIDs[num_ids++] = (char)id;
+			}
+			if (!startSimulator(sims[b], pIDs, num_ids, timing.turnaround_us))
+				return;
+			network.addBus(sims[b].slavePath());
+		}
+
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		int num_routed = network.discover(timing);
+		double discover_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+		for (int id = 1; id <= 12; id++)
+			network.setTorqueControl(id, 2); // Torque ON
+		network.start(1000000); // the I/O threads run back to back
+
+		ControlLoop loop(10000000); // 100 Hz
+		start = std::chrono::steady_clock::now();
+		loop.run(networkControlCycle, &network, 200);
+		network.stop();
+		double elapsed_s = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+		// the state table keeps the last valid telemetry of every motor: a timeout in the last I/O cycle does not count
+		const NetworkSnapshot& snapshot = network.snapshot();
+		int valid = 0;
+		for (int id = 1; id <= 12; id++)
+		{
+			ServoTelemetry telemetry;
+			valid += network.read(id, telemetry) ? 1 : 0;
+		}
+		long long cycles = snapshot.bus_cycle[0] + 1;
+		printf("Buses: %d, %d motors routed in %.0f ms, %d/%d valid, telemetry of every motor refreshed at %.1f Hz, %u dropped commands\n", num_bus, num_routed,
+			discover_ms, valid, snapshot.num_servo, cycles / elapsed_s, network.droppedCommandCount());
+		check(num_routed == 12 && valid == 12, num_bus == 1 ? "12 motors routed on 1 bus, all with valid telemetry" : "12 motors routed on 2 buses, all with valid telemetry");
+		refresh_hz[num_bus - 1] = cycles / elapsed_s;
+	}
+	check(refresh_hz[1] > 1.5 * refresh_hz[0], "2 buses refresh the telemetry faster than 1 bus");
+}
+
+/** @brief Balance 12 simulated motors wired unevenly to 2 buses: 6 fast joints and 2 slow joints on bus 0, 4 slow joints on bus 1
+*
+* Does not need any motor to be connected. After the plan, the motors are renumbered so that their id tells which bus they belong to.
+*
+* @return returns nothing
+*/
+void testBusLoadPlanner()
+{
+	BusTiming timing(115200, 100);
+	ServoBusSimulator sims[2];
+	const char pIDs[] = { 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12 };
+
+	ServoNetwork network;
+	BusLoadPlanner planner;
+	for (int b = 0; b < 2; b++)
+	{
+		if (!startSimulator(sims[b], b == 0 ? pIDs : pIDs + 8, b == 0 ? 8 : 4, timing.turnaround_us))
+			return;
+		network.addBus(sims[b].slavePath());
+		planner.addBus(timing);
+	}
+
+	for (int id = 1; id <= 12; id++)
+	{
+		bool fast = id <= 6;
+		ServoDemand demand;
+		demand.pID = id;
+		demand.bus = id <= 8 ? 0 : 1;
+		demand.command_hz = fast ? 50 : 20;
+		demand.poll_hz[kPollPosition] = fast ? 50 : 20;
+		demand.poll_hz[kPollStatus] = fast ? 10 : 5;
+		demand.poll_hz[kPollHealth] = 1;
+		planner.addServo(demand);
+	}
+
+	double worst = planner.plan();
+	planner.printReport();
+	printf("Busiest bus after the plan: %.1f%%\n", 100 * worst);
+	check(worst > 0 && worst <= 1, "the plan fits on the buses");
+
+	int num_expected = 0;
+	bool expected[2][HerkulexDriver::kNumServo] = { { false } };
+	for (int id = 1; id <= 12; id++)
+	{
+		ServoStatus status;
+		network.bus(id <= 8 ? 0 : 1).driver().getStatus(id, status); // round trip time and status of the old ids, to be forgotten
+		num_expected += planner.getPlannedId(id) != id ? 1 : 0;
+		expected[id <= 8 ? 0 : 1][(unsigned char)planner.getPlannedId(id)] = true;
+	}
+
+	int num_renumbered = planner.renumber(network);
+	printf("Renumbered %d motors. Ids now answering:", num_renumbered);
+	int num_answering = 0;
+	bool as_planned = true;
+	for (int b = 0; b < 2; b++)
+	{
+		ScanResult found[HerkulexDriver::kNumServo];
+		int num_found = network.bus(b).driver().scanBus(found, HerkulexDriver::kNumServo, timing);
+		printf(" bus %d {", b);
+		for (int i = 0; i < num_found; i++)
+		{
+			printf(i == 0 ? "%d" : ", %d", (unsigned char)found[i].pID);
+			as_planned = as_planned && expected[b][(unsigned char)found[i].pID];
+		}
+		printf("}");
+		num_answering += num_found;
+	}
+	printf("\n");
+	check(num_renumbered == num_expected, "every renumbered motor counted");
+	check(num_answering == 12, "every motor answers after the renumbering");
+	check(as_planned, "every motor answers at its planned id");
+	check(sims[0].idCollisionCount() + sims[1].idCollisionCount() == 0, "no id given twice");
+
+	bool forgotten = true;
+	for (int id = 1; id <= 12; id++)
+	{
+		RttEstimator estimate;
+		ServoStatus status;
+		HerkulexDriver& hlx = network.bus(id <= 8 ? 0 : 1).driver();
+		if (planner.getPlannedId(id) != id && !expected[id <= 8 ? 0 : 1][id])
+			forgotten = forgotten && !hlx.getRttEstimate(id, estimate) && !hlx.getCachedStatus(id, status);
+	}
+	check(forgotten, "round trip time and status of the old ids forgotten");
+
+	// a motor that is not on the bus is not renumbered
+	BusLoadPlanner missing;
+	missing.addBus(timing);
+	ServoDemand demand;
+	demand.pID = 100;
+	demand.command_hz = 20;
+	missing.addServo(demand);
+	missing.plan();
+	check(missing.renumber(network) == 0, "a motor that does not answer is not counted");
+}
+
+// write text to path, creating the file
+static bool writeFile(const std::string& path, const std::string& text)
+{
+	FILE* file = fopen(path.c_str(), "w");
+	if (file == nullptr)
+		return false;
+	fputs(text.c_str(), file);
+	fclose(file);
+	return true;
+}
+
+static int removeEntry(const char* path, const struct stat*, int, struct FTW*)
+{
+	return remove(path);
+}
+
+/** @brief Create one fake USB serial adapter in a fake sysfs and dev tree
+*
+* @param[in] root root of the fake tree (contains sys and dev)
+* @param[in] name name of the tty (eg: ttyUSB0)
+* @param[in] usb_dir name of the USB device directory in sys/devices/usb1
+* @param[in] serial serial number of the adapter
+* @param[in] product product string of the adapter
+*
+* @return returns false if a file could not be created
+*/
+static bool makeFakeAdapter(const std::string& root, const std::string& name, const std::string& usb_dir, const std::string& serial, const std::string& product)
+{
+	std::string device_dir = root + "/sys/devices/usb1/" + usb_dir;
+	std::string interface_dir = device_dir + "/" + usb_dir + ":1.0";
+	mkdir(device_dir.c_str(), 0755);
+	mkdir(interface_dir.c_str(), 0755);
+	mkdir((interface_dir + "/" + name).c_str(), 0755);
+	mkdir((root + "/sys/class/tty/" + name).c_str(), 0755);
+	return writeFile(device_dir + "/idVendor", "0403\n") && writeFile(device_dir + "/idProduct", "6001\n") && writeFile(device_dir + "/serial", serial + "\n")
+		&& writeFile(device_dir + "/manufacturer", "FTDI\n") && writeFile(device_dir + "/product", product + "\n")
+		&& symlink((interface_dir + "/" + name).c_str(), (root + "/sys/class/tty/" + name + "/device").c_str()) == 0
+		&& writeFile(root + "/dev/" + name, "");
+}
+
+/** @brief Check the serial port finder on a fake sysfs and dev tree with two adapters that have the same product string
+*
+* ttyUSB0 (serial A1, with a /dev/serial/by-id link), ttyUSB1 (serial A2) and ttyS0 (not a USB device).
+*
+* @return returns nothing
+*/
+void testSerialPortFinderFakeTree()
+{
+	char root_template[] = "/tmp/herkulex_finder_XXXXXX";
+	if (mkdtemp(root_template) == nullptr)
+	{
+		check(false, "fake sysfs tree created");
+		return;
+	}
+	std::string root = root_template;
+	const char* dirs[] = { "/sys", "/sys/class", "/sys/class/tty", "/sys/devices", "/sys/devices/usb1", "/sys/devices/platform", "/sys/devices/platform/serial8250",
+		"/sys/class/tty/ttyS0", "/dev", "/dev/serial", "/dev/serial/by-id" };
+	for (size_t i = 0; i < sizeof(dirs) / sizeof(dirs[0]); i++)
+		mkdir((root + dirs[i]).c_str(), 0755);
+	bool created = makeFakeAdapter(root, "ttyUSB0", "1-1", "A1", "FT232R USB UART") && makeFakeAdapter(root, "ttyUSB1", "1-2", "A2", "FT232R USB UART")
+		&& symlink((root + "/sys/devices/platform/serial8250").c_str(), (root + "/sys/class/tty/ttyS0/device").c_str()) == 0
+		&& writeFile(root + "/dev/ttyS0", "")
+		&& symlink("../../ttyUSB0", (root + "/dev/serial/by-id/usb-FTDI_FT232R_USB_UART_A1-if00-port0").c_str()) == 0;
+	if (check(created, "fake sysfs tree created"))
+	{
+		SerialPortMatch match = SerialPortFinder::parse("vid=0403,pid=6001,serial=A1");
+		check(match.vid == 0x0403 && match.pid == 0x6001 && match.serial == "A1" && match.product.empty(), "parse key=value match");
+		match = SerialPortFinder::parse("0403:6001");
+		check(match.vid == 0x0403 && match.pid == 0x6001 && match.serial.empty() && match.product.empty(), "parse vid:pid match");
+		match = SerialPortFinder::parse("FT232R USB UART");
+		check(match.vid == -1 && match.pid == -1 && match.serial.empty() && match.product == "FT232R USB UART", "parse product string");
+
+		SerialPortFinder finder(root + "/sys", root + "/dev");
+		finder.setCacheFile(root + "/cache");
+		std::vector<SerialPortInfo> ports;
+		int num_ports = finder.enumerate(ports);
+		check(num_ports == 2 && ports[0].name == "ttyUSB0" && ports[1].name == "ttyUSB1", "both USB adapters found, not the other tty");
+		check(num_ports == 2 && ports[0].vid == 0x0403 && ports[0].pid == 0x6001 && ports[0].serial == "A1" && ports[1].serial == "A2"
+			&& ports[0].product == "FT232R USB UART" && ports[0].device == root + "/dev/ttyUSB0", "USB attributes read");
+		check(num_ports == 2 && ports[0].by_id == root + "/dev/serial/by-id/usb-FTDI_FT232R_USB_UART_A1-if00-port0" && ports[1].by_id.empty(), "by-id link found");
+		if (num_ports == 2)
+		{
+			check(SerialPortFinder::matches(ports[1], SerialPortFinder::parse("serial=A2")) && !SerialPortFinder::matches(ports[0], SerialPortFinder::parse("serial=A2")),
+				"match on serial number");
+			check(SerialPortFinder::matches(ports[0], SerialPortFinder::parse("FT232R USB UART")) && SerialPortFinder::matches(ports[1], SerialPortFinder::parse("0403:6001"))
+				&& !SerialPortFinder::matches(ports[0], SerialPortFinder::parse("0403:6015")), "match on product string and vid:pid");
+		}
+
+		check(finder.resolve("FT232R USB UART").empty(), "no device when several adapters match");
+		check(finder.resolve("ttyUSB1") == root + "/dev/ttyUSB1" && finder.resolve("/dev/ttyACM0") == "/dev/ttyACM0", "device names and paths are not looked up");
+		check(finder.resolve("serial=A2") == root + "/dev/ttyUSB1", "adapter found by serial number");
+		std::ifstream cache_file(root + "/cache");
+		std::string cache((std::istreambuf_iterator<char>(cache_file)), std::istreambuf_iterator<char>());
+		check(cache == "serial=A2\tttyUSB1\n", "cache written");
+
+		// the cached tty is used as it is while it still matches: the two adapters are not enumerated
+		writeFile(root + "/cache", "FT232R USB UART\tttyUSB0\nserial=A2\tttyUSB1\n");
+		check(finder.resolve("FT232R USB UART") == root + "/dev/ttyUSB0", "cached tty used without enumerating");
+
+		// swap the adapters: the cached tty does not match anymore
+		writeFile(root + "/sys/devices/usb1/1-1/serial", "A2\n");
+		writeFile(root + "/sys/devices/usb1/1-2/serial", "A1\n");
+		check(finder.resolve("serial=A2") == root + "/dev/ttyUSB0", "stale cache entry enumerated again");
+		check(finder.resolve("serial=A2") == root + "/dev/ttyUSB0" && finder.resolve("serial=A1") == root + "/dev/ttyUSB1", "cache updated");
+
+		// unplug an adapter: its cached tty is gone
+		remove((root + "/sys/class/tty/ttyUSB0/device").c_str());
+		check(finder.resolve("serial=A2").empty(), "no device once the cached adapter is unplugged");
+	}
+	nftw(root.c_str(), removeEntry, 16, FTW_DEPTH | FTW_PHYS);
+	struct stat info;
+	check(stat(root.c_str(), &info) != 0, "fake sysfs tree removed");
+}
+
+/** @brief Check the finder on a fake tree (see testSerialPortFinderFakeTree()), then list the real USB serial adapters, and find the first one by its serial number, without then with the cache
+*
+* @return returns nothing
+*/
+void testSerialPortFinder()
+{
+	testSerialPortFinderFakeTree();
+
+	SerialPortFinder finder;
+	std::vector<SerialPortInfo> ports;
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	int num_ports = finder.enumerate(ports);
+	double enumerate_us = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+	printf("%d USB serial adapters found in %.0f us\n", num_ports, enumerate_us);
+	for (int i = 0; i < num_ports; i++)
+	{
+		printf("  %s %04x:%04x serial=%s product=%s %s\n", ports[i].device.c_str(), ports[i].vid, ports[i].pid, ports[i].serial.c_str(), ports[i].product.c_str(),
+			ports[i].by_id.c_str());
+	}
+	if (num_ports == 0 || ports[0].serial.empty())
+		return;
+
+	std::string spec = "serial=" + ports[0].serial;
+	for (int pass = 0; pass < 2; pass++)
+	{
+		start = std::chrono::steady_clock::now();
+		std::string device = finder.resolve(spec);
+		double resolve_us = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+		printf("%s -> %s in %.0f us (%s)\n", spec.c_str(), device.c_str(), resolve_us, pass == 0 ? "first lookup" : "cached");
+	}
+}
+
+/** @brief Turnaround and polling rate of the default serial profile (16 ms USB latency timer) and of the low latency profile (1 ms)
+*
+* The latency timer of the simulated adapter stands for the one setLowLatency() sets on a real FTDI adapter: the pseudo terminal has none
+*
+* @return returns nothing
+*/
+void testLowLatency()
+{
+	const char pIDs[] = { 1, 2, 3 };
+	const int num_read = 150;
+	ServoBusSimulator sim;
+	if (!startSimulator(sim, pIDs, 3))
+		return;
+
+	HerkulexDriver hlx(sim.slavePath());
+	BusTiming timing = sim.getTiming();
+	long long wire_us = timing.wireTime(BusTiming::kHeaderSize) + timing.turnaround_us + timing.wireTime(1);
+	double read_hz[2] = { 0, 0 };
+	long long first_byte_us[2] = { 0, 0 };
+	for (int low_latency = 0; low_latency <= 1; low_latency++)
+	{
+		sim.setLatencyTimer(low_latency ? 1 : 16);
+		int applied = hlx.setLowLatency(low_latency == 1);
+		if (low_latency)
+		{
+			printf("Low latency profile on %s: ASYNC_LOW_LATENCY %s, latency timer %s\n", sim.slavePath(),
+				(applied & SerialStream::kAsyncLowLatency) ? "set" : "not supported", (applied & SerialStream::kLatencyTimerSet) ? "set" : "not available");
+		}
+
+		TurnaroundStats stats;
+		if (!check(hlx.measureTurnaround(pIDs[0], 50, stats), "turnaround measured"))
+			continue;
+
+		int failed = 0;
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		for (int i = 0; i < num_read; i++)
+		{
+			if (std::isnan(hlx.getAbsoluteAngle(pIDs[i % 3])))
+				failed++;
+		}
+		double total_s = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		printf("%s: first byte %lld/%lld/%lld us (min/mean/max, %lld us on the wire), whole reply %lld us, %.0f getAbsoluteAngle per second, %d failed\n",
+			low_latency ? "1 ms latency timer" : "16 ms latency timer", stats.first_byte_min_us, stats.first_byte_mean_us, stats.first_byte_max_us, wire_us,
+			stats.reply_mean_us, num_read / total_s, failed);
+		check(failed == 0, "every read replied");
+		read_hz[low_latency] = num_read / total_s;
+		first_byte_us[low_latency] = stats.first_byte_mean_us;
+	}
+	check(first_byte_us[1] < first_byte_us[0] && read_hz[1] > 2 * read_hz[0], "the 1 ms latency timer answers sooner and reads faster");
+}
+
+/** @brief Telemetry cycles per second of 6 motors
+*
+* @return returns the number of readTelemetry() cycles per second
+*/
+double telemetryRate(HerkulexDriver& hlx, const char* pIDs, int num_ids)
+{
+	const int num_cycle = 100;
+	ServoTelemetry telemetry[6];
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	for (int cycle = 0; cycle < num_cycle; cycle++)
+		hlx.readTelemetry(pIDs, num_ids, telemetry);
+	return num_cycle / std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+/** @brief Find the baudrate of every motor, bring a motor left at 57600 back to the bus rate, then move the whole bus to 666666 baud
+*
+* @return returns nothing
+*/
+void testBaudrate()
+{
+	const char pIDs[] = { 1, 2, 3, 4, 5, 6 };
+	ServoBusSimulator sim;
+	if (!startSimulator(sim, pIDs, 6))
+		return;
+
+	HerkulexDriver hlx(sim.slavePath());
+	hlx.write<RegEEPBaudRate>(6, HerkulexBaudrate::toCode(BAUD_57600)); // eg: a motor configured for another robot
+	hlx.reboot(6);
+	std::this_thread::sleep_for(std::chrono::milliseconds((long long)HerkulexDriver::kRebootMs));
+
+	int baudrates[6];
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	int num_found = hlx.detectBaudrate(pIDs, 6, baudrates);
+	double detect_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	printf("detectBaudrate: %d/6 motors found in %.0f ms:", num_found, detect_ms);
+	int num_expected = 0;
+	for (int i = 0; i < 6; i++)
+	{
+		printf(" %d@%d", pIDs[i], baudrates[i]);
+		num_expected += baudrates[i] == (i == 5 ? BAUD_57600 : BAUD_115200) ? 1 : 0;
+	}
+	printf("\n");
+	check(num_found == 6 && num_expected == 6, "motors 1 to 5 found at 115200, motor 6 at 57600");
+
+	int migrated = hlx.migrateBaudrate(pIDs, 6, BAUD_666666);
+	printf("migrate to 666666 with motor 6 at 57600: %d\n", migrated);
+	check(migrated == -1 && hlx.getBaudrate() == BAUD_115200, "migration refused while a motor is at another baudrate");
+	hlx.setBaudrate(BAUD_57600);
+	migrated = hlx.migrateBaudrate(pIDs + 5, 1, BAUD_115200);
+	printf("migrate motor 6 from 57600 to 115200: %d\n", migrated);
+	check(migrated == 1, "motor 6 moved back to 115200");
+	hlx.setBaudrate(BAUD_115200);
+
+	double slow_hz = telemetryRate(hlx, pIDs, 6);
+	start = std::chrono::steady_clock::now();
+	migrated = hlx.migrateBaudrate(pIDs, 6, BAUD_666666);
+	double migrate_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	printf("migrate to 666666: %d motors in %.0f ms, port at %d baud\n", migrated, migrate_ms, hlx.getBaudrate());
+	double fast_hz = telemetryRate(hlx, pIDs, 6);
+	printf("Telemetry of 6 motors: %.0f Hz at 115200, %.0f Hz at %d\n", slow_hz, fast_hz, hlx.getBaudrate());
+	check(migrated == 6 && hlx.getBaudrate() == BAUD_666666, "whole bus migrated to 666666");
+
+	num_found = hlx.detectBaudrate(pIDs, 6, baudrates);
+	num_expected = 0;
+	for (int i = 0; i < 6; i++)
+		num_expected += baudrates[i] == BAUD_666666 ? 1 : 0;
+	check(num_found == 6 && num_expected == 6, "every motor found at 666666 after the migration");
+	check(fast_hz > 2 * slow_hz, "telemetry faster at 666666");
+}
+#endif
+
 // main used for testing
-void main()
+int main()
 {
+	testEncodeBenchmark();
+	testPacketFramer();
+#ifdef __unix__
+	testSimulator();
+	testBatchAllocations();
+	testSerialStreamReopen();
+	testControlLoop();
+	testBusIoThread();
+	testPollingScheduler();
+	testTransactionScheduler();
+	testEmergencyStop();
+	testEmergencyStopRace();
+	testGroupConfig();
+	testBusScan();
+	testAdaptiveTimeout();
+	testServoNetwork();
+	testBusLoadPlanner();
+	testSerialPortFinder();
+	testLowLatency();
+	testBaudrate();
+#endif
+	if (failed_checks == 0)
+		printf("All checks passed\n");
+	else
+		printf("%d checks FAILED\n", failed_checks);
+	printf("Press enter to go to next test\n");
+	getchar();
 	testBlink();
 	printf("Press enter to go to next test\n");
 	getchar();
@@ -172,4 +1590,5 @@ void main()
 	printf("Press enter to go to next test\n");
 	getchar();
 	testMove();
+	return failed_checks == 0 ? 0 : 1;
 }
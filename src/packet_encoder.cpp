@@ -0,0 +1,170 @@
+#include "packet_encoder.hpp"
+#include <cstring> //for memcpy
+
+PacketEncoder::PacketEncoder()
+{
+	buffer = internal_buffer;
+	capacity = kCapacity;
+	clear();
+}
+
+/** @brief Use caller provided storage instead of the internal buffer
+*
+* @param[in] storage the buffer to encode into. must stay valid while the encoder is used
+* @param[in] capacity size of storage in bytes
+*/
+PacketEncoder::PacketEncoder(char* storage, int capacity)
+{
+	buffer = storage;
+	this->capacity = capacity;
+	clear();
+}
+
+/** @brief Computes and writes checksum1 and checksum2 of a complete packet
+*
+* checksum1 = (packet size ^ pID ^ cmd ^ data[0] ^ ... ^ data[n]) & 0xFE \n
+* checksum2 = (~checksum1) & 0xFE
+*
+* @param[in/out] packet the packet, with the size, pID, cmd and data already filled in
+*
+* @return returns nothing
+*/
+void PacketEncoder::writeChecksum(char* packet)
+{
+	unsigned char packetsize = (unsigned char)packet[2];
+	char checksum1 = packet[2] ^ packet[3] ^ packet[4];
+	for (int i = kHeaderSize; i < packetsize; i++)
+		checksum1 = checksum1 ^ packet[i];
+	checksum1 = checksum1 & 0xFE;
+
+	packet[5] = checksum1;
+	packet[6] = ~checksum1 & 0xFE;
+}
+
+/** @brief Encode one packet into a caller provided buffer
+*
+* @param[out] output where the packet is written
+* @param[in] capacity size of output
+* @param[in] pID id of the motor
+* @param[in] cmd the herkulex command
+* @param[in] data the payload
+* @param[in] datalen length of the payload
+*
+* @return returns the packet size, or 0 if it does not fit
+*/
+int PacketEncoder::encode(char* output, int capacity, char pID, unsigned char cmd, const char* data, int datalen)
+{
+	int packetsize = kHeaderSize + datalen;
+	if (datalen < 0 || packetsize > kMaxPacketSize || packetsize > capacity)
+		return 0;
+
+	output[0] = (char)0xFF;
+	output[1] = (char)0xFF;
+	output[2] = (char)packetsize;
+	output[3] = pID;
+	output[4] = (char)cmd;
+	if (datalen > 0)
+		memcpy(output + kHeaderSize, data, datalen);
+	writeChecksum(output);
+
+	return packetsize;
+}
+
+/** @brief Append one packet to the buffer
+*
+* @param[in] pID id of the motor
+* @param[in] cmd the herkulex command
+* @param[in] data the payload
+* @param[in] datalen length of the payload
+*
+* @return returns false if the packet does not fit in the remaining space
+*/
+bool PacketEncoder::add(char pID, unsigned char cmd, const char* data, int datalen)
+{
+	int packetsize = encode(buffer + length, capacity - length, pID, cmd, data, datalen);
+	if (packetsize == 0)
+		return false;
+
+	length += packetsize;
+	packet_count++;
+	return true;
+}
+
+/** @brief Reserve a packet whose payload is written in place
+*
+* The payload must be written to the returned pointer before calling endPacket()
+*
+* @param[in] pID id of the motor
+* @param[in] cmd the herkulex command
+* @param[in] datalen length of the payload
+*
+* @return returns the pointer to the payload area, or nullptr if the packet does not fit
+*/
+char* PacketEncoder::beginPacket(char pID, unsigned char cmd, int datalen)
+{
+	int packetsize = kHeaderSize + datalen;
+	if (open_packet >= 0 || datalen < 0 || packetsize > kMaxPacketSize || packetsize > capacity - length)
+		return nullptr;
+
+	char* packet = buffer + length;
+	packet[0] = (char)0xFF;
+	packet[1] = (char)0xFF;
+	packet[2] = (char)packetsize;
+	packet[3] = pID;
+	packet[4] = (char)cmd;
+
+	open_packet = length;
+	return packet + kHeaderSize;
+}
+
+/** @brief Finish the packet started by beginPacket()
+*
+* @return returns nothing
+*/
+void PacketEncoder::endPacket()
+{
+	if (open_packet < 0)
+		return;
+
+	char* packet = buffer + open_packet;
+	writeChecksum(packet);
+	length += (unsigned char)packet[2];
+	packet_count++;
+	open_packet = -1;
+}
+
+/** @brief Remove packets from the buffer
+*
+* The remaining packets keep their order. Does nothing while a packet is open (beginPacket())
+*
+* @param[in] drop called with every complete packet. Returns true if the packet must be removed
+*
+* @return returns the number of packets removed
+*/
+int PacketEncoder::removeIf(bool (*drop)(const char* packet))
+{
+	if (open_packet >= 0)
+		return 0;
+
+	int read = 0;
+	int kept = 0;
+	int removed = 0;
+	while (read < length)
+	{
+		int size = (unsigned char)buffer[read + 2];
+		if (drop(buffer + read))
+		{
+			removed++;
+		}
+		else
+		{
+			if (kept != read)
+				memmove(buffer + kept, buffer + read, size);
+			kept += size;
+		}
+		read += size;
+	}
+	length = kept;
+	packet_count -= removed;
+	return removed;
+}
@@ -0,0 +1,54 @@
+#ifndef PACKET_ENCODER_HPP_
+#define PACKET_ENCODER_HPP_
+
+/** Encodes herkulex packets back to back into one contiguous TX buffer
+*
+* The storage is either the encoder's own fixed buffer, or a buffer provided by the caller. No heap allocation is done.
+* Several packets (eg: LED, torque and S_JOG for many servos) can be encoded into the same buffer and sent with a single write.
+*
+* Packet layout: \n
+* [0xFF][0xFF][packet size][pID][cmd][checksum1][checksum2][data ...]
+*
+* Usage: \n
+* add() copies the payload. \n
+* beginPacket() returns a pointer where the payload is written in place, and endPacket() fills in the checksums.
+*
+* Created by:
+* @author Er Jie Kai (EJK)
+ */
+class PacketEncoder
+{
+public:
+	static const int kCapacity = 1024;		//size of the internal buffer
+	static const int kHeaderSize = 7;		//header, size, pID, cmd, checksum1, checksum2
+	static const int kMaxPacketSize = 223;	//largest packet accepted by the herkulex servos
+
+	PacketEncoder();
+	PacketEncoder(char* storage, int capacity);
+
+	static int encode(char* output, int capacity, char pID, unsigned char cmd, const char* data, int datalen);
+
+	bool add(char pID, unsigned char cmd, const char* data, int datalen);
+	char* beginPacket(char pID, unsigned char cmd, int datalen);
+	void endPacket();
+	int removeIf(bool (*drop)(const char* packet));
+
+	void clear() { length = 0; packet_count = 0; open_packet = -1; }
+	char* data() { return buffer; }
+	int size() const { return length; }
+	int space() const { return capacity - length; }
+	int packetCount() const { return packet_count; }
+	bool empty() const { return length == 0; }
+
+private:
+	char internal_buffer[kCapacity];
+	char* buffer;
+	int capacity;
+	int length;
+	int packet_count;
+	int open_packet; //offset of the packet started by beginPacket(). -1 when no packet is open
+
+	static void writeChecksum(char* packet);
+};
+
+#endif /*PACKET_ENCODER_HPP_*/
@@ -0,0 +1,117 @@
+#include "packet_framer.hpp"
+#include <cstring> //for memcpy
+
+PacketFramer::PacketFramer()
+{
+	reset();
+}
+
+/** @brief Discard all buffered bytes and statistics
+*
+* @return returns nothing
+*/
+void PacketFramer::reset()
+{
+	head = 0;
+	tail = 0;
+	packet_count = 0;
+	resync_count = 0;
+	checksum_error_count = 0;
+}
+
+/** @brief Pointer to where the next received bytes should be written
+*
+* @return returns the pointer into the ring buffer. Up to writeSpace() bytes can be written to it
+*/
+char* PacketFramer::writePtr()
+{
+	return (char*)ring + (head & (kCapacity - 1));
+}
+
+/** @brief Number of bytes that can be written contiguously at writePtr()
+*
+* @return returns the number of free contiguous bytes
+*/
+int PacketFramer::writeSpace()
+{
+	int free_bytes = kCapacity - (int)(head - tail);
+	int to_end = kCapacity - (int)(head & (kCapacity - 1));
+	return free_bytes < to_end ? free_bytes : to_end;
+}
+
+/** @brief Mark len bytes written at writePtr() as received
+*
+* @param[in] len number of bytes written
+*
+* @return returns nothing
+*/
+void PacketFramer::commit(int len)
+{
+	head += len;
+}
+
+/** @brief Extract the next complete and valid packet
+*
+* checksum1 = (packet size ^ pID ^ cmd ^ data[0] ^ ... ^ data[n]) & 0xFE \n
+* checksum2 = (~checksum1) & 0xFE
+*
+* @param[out] packet view of the packet. valid until the next commit()
+*
+* @return returns true if a packet was extracted, false if more bytes are needed
+*/
+bool PacketFramer::next(HerkulexPacket& packet)
+{
+	while (available() >= kMinPacketSize)
+	{
+		// sync on the 0xFF 0xFF header
+		if (at(0) != 0xFF || at(1) != 0xFF)
+		{
+			drop(1);
+			resync_count++;
+			continue;
+		}
+
+		int size = at(2);
+		if (size < kMinPacketSize || size > kMaxPacketSize)
+		{
+			drop(1);
+			resync_count++;
+			continue;
+		}
+
+		if (available() < size)
+			return false; // wait for the rest of the packet
+
+		unsigned char checksum1 = (unsigned char)size ^ at(3) ^ at(4);
+		for (int i = kMinPacketSize; i < size; i++)
+			checksum1 ^= at(i);
+		checksum1 &= 0xFE;
+		unsigned char checksum2 = (~checksum1) & 0xFE;
+
+		if (at(5) != checksum1 || at(6) != checksum2)
+		{
+			drop(1);
+			checksum_error_count++;
+			continue;
+		}
+
+		unsigned int start = tail & (kCapacity - 1);
+		if (start + size <= (unsigned int)kCapacity)
+		{
+			packet.raw = ring + start;
+		}
+		else
+		{
+			int first = kCapacity - start;
+			memcpy(scratch, ring + start, first);
+			memcpy(scratch + first, ring, size - first);
+			packet.raw = scratch;
+		}
+		packet.size = size;
+
+		drop(size);
+		packet_count++;
+		return true;
+	}
+	return false;
+}
@@ -0,0 +1,67 @@
+#ifndef PACKET_FRAMER_HPP_
+#define PACKET_FRAMER_HPP_
+
+/** A view of one complete herkulex packet
+*
+* raw points at the first 0xFF of the header. The view stays valid until the next PacketFramer::commit()
+*
+* Packet layout: \n
+* [0xFF][0xFF][packet size][pID][cmd][checksum1][checksum2][data ...]
+*/
+struct HerkulexPacket
+{
+	const unsigned char* raw = nullptr;
+	int size = 0;
+
+	unsigned char pID() const { return raw[3]; }
+	unsigned char cmd() const { return raw[4]; }
+	const unsigned char* data() const { return raw + 7; }
+	int dataLength() const { return size - 7; }
+};
+
+/** Splits the incoming byte stream into herkulex packets
+*
+* Bytes are read from the serial port straight into a fixed ring buffer (writePtr()/writeSpace()/commit()),
+* so several back-to-back replies picked up by one read call are decoded without extra copies or allocations. \n
+* next() syncs on the 0xFF 0xFF header, checks the packet size and both checksums, and drops one byte at a time until it finds a valid packet.
+*
+* Created by:
+* @author Er Jie Kai (EJK)
+ */
+class PacketFramer
+{
+public:
+	static const int kCapacity = 1024;			//size of the ring buffer. must be a power of 2
+	static const int kMinPacketSize = 7;		//header, size, pID, cmd, checksum1, checksum2
+	static const int kMaxPacketSize = 223;		//largest packet accepted by the herkulex servos
+
+	PacketFramer();
+
+	char* writePtr();
+	int writeSpace();
+	void commit(int len);
+
+	bool next(HerkulexPacket& packet);
+	void reset();
+
+	int available() const { return (int)(head - tail); }
+	unsigned int packetCount() const { return packet_count; }
+	unsigned int resyncCount() const { return resync_count; }
+	unsigned int checksumErrorCount() const { return checksum_error_count; }
+
+private:
+	unsigned char ring[kCapacity];
+	unsigned char scratch[kMaxPacketSize]; //used only when a packet wraps around the end of the ring
+
+	unsigned int head; //total number of bytes written into the ring
+	unsigned int tail; //total number of bytes consumed from the ring
+
+	unsigned int packet_count;
+	unsigned int resync_count;
+	unsigned int checksum_error_count;
+
+	unsigned char at(unsigned int offset) const { return ring[(tail + offset) & (kCapacity - 1)]; }
+	void drop(int len) { tail += len; }
+};
+
+#endif /*PACKET_FRAMER_HPP_*/
@@ -0,0 +1,344 @@
+#include "polling_scheduler.hpp"
+#include <chrono>
+#include <cstring>
+
+static long long nowMicros()
+{
+	return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static long long hzToPeriod(double hz)
+{
+	return hz > 0 ? (long long)(1000000.0 / hz) : 0;
+}
+
+/** @brief Create an empty scheduler
+*
+* @param[in] timing baudrate and turnaround of the bus, used to compute the bus time of every read
+*/
+PollingScheduler::PollingScheduler(const BusTiming& timing)
+	: timing(timing)
+{
+}
+
+/** @brief Poll a motor with the default rates (position 50 Hz, 200 Hz while moving. status 50 Hz. voltage/temperature 1 Hz)
+*
+* @param[in] pID id of the motor
+*
+* @return returns false if kMaxServo motors are already polled
+*/
+bool PollingScheduler::addServo(char pID)
+{
+	if (find(pID) != nullptr)
+		return true;
+	if (num_servo >= kMaxServo)
+		return false;
+
+	PolledServo& servo = servos[num_servo++];
+	servo = PolledServo();
+	servo.pID = pID;
+	memset(servo.ram, 0, sizeof(servo.ram));
+	setRate(pID, kPollPosition, 50, 200);
+	setRate(pID, kPollStatus, 50);
+	setRate(pID, kPollHealth, 1);
+	return true;
+}
+
+/** @brief Set the rate of a register group for all the motors added so far
+*
+* @param[in] group the register group
+* @param[in] hz polling rate (0 = do not poll)
+* @param[in] moving_hz polling rate while the motor reports the Moving flag (0 = same as hz)
+*
+* @return returns nothing
+*/
+void PollingScheduler::setRate(PollGroup group, double hz, double moving_hz)
+{
+	for (int i = 0; i < num_servo; i++)
+		setRate(servos[i].pID, group, hz, moving_hz);
+}
+
+/** @brief Set the rate of a register group for one motor
+*
+* @param[in] pID id of the motor
+* @param[in] group the register group
+* @param[in] hz polling rate (0 = do not poll)
+* @param[in] moving_hz polling rate while the motor reports the Moving flag (0 = same as hz)
+*
+* @return returns nothing
+*/
+void PollingScheduler::setRate(char pID, PollGroup group, double hz, double moving_hz)
+{
+	PolledServo* servo = find(pID);
+	if (servo == nullptr)
+		return;
+	PollEntry& entry = servo->groups[group];
+	entry.period_us = hzToPeriod(hz);
+	entry.moving_period_us = hzToPeriod(moving_hz);
+}
+
+/** @brief Bus time of one read of a register group
+*
+* @return returns the time in microseconds
+*/
+long long PollingScheduler::readCost(PollGroup group) const
+{
+	return timing.readTime(groupLength(group));
+}
+
+/** @brief Choose the reads of one tick
+*
+* Reads that are due are taken most overdue first (lateness relative to their period), until budget_us of bus time is used.
+*
+* @param[in] now_us current monotonic time in microseconds
+* @param[in] budget_us bus time available in this tick in microseconds
+* @param[out] items the chosen reads
+* @param[in] max_items size of items
+*
+* @return returns the number of reads chosen
+*/
+int PollingScheduler::plan(long long now_us, long long budget_us, PollItem* items, int max_items)
+{
+	// lateness of every due read, in 1/1000 of its period
+	const int kMaxDue = kMaxServo * kNumPollGroup;
+	PollItem due[kMaxDue];
+	long long lateness[kMaxDue];
+	int num_due = 0;
+
+	for (int i = 0; i < num_servo; i++)
+	{
+		for (int g = 0; g < kNumPollGroup; g++)
+		{
+			long long p = period(servos[i], (PollGroup)g);
+			const PollEntry& entry = servos[i].groups[g];
+			if (p <= 0 || entry.due_us > now_us)
+				continue;
+
+			long long late = (now_us - entry.due_us) * 1000 / p;
+			int k = num_due++;
+			while (k > 0 && lateness[k - 1] < late) // insertion sort, most overdue first
+			{
+				due[k] = due[k - 1];
+				lateness[k] = lateness[k - 1];
+				k--;
+			}
+			due[k].pID = servos[i].pID;
+			due[k].group = (PollGroup)g;
+			due[k].cost_us = readCost((PollGroup)g);
+			lateness[k] = late;
+		}
+	}
+
+	int num_items = 0;
+	long long used_us = 0;
+	for (int i = 0; i < num_due; i++)
+	{
+		if (num_items < max_items && used_us + due[i].cost_us <= budget_us)
+		{
+			items[num_items++] = due[i];
+			used_us += due[i].cost_us;
+		}
+		else
+		{
+			stats.deferred++;
+		}
+	}
+	return num_items;
+}
+
+/** @brief Run one tick: read the register groups that are due, within the bus time budget
+*
+* @param[in] hlx the driver of the bus
+* @param[in] budget_us bus time available in this tick in microseconds
+*
+* @return returns the number of reads sent
+*/
+int PollingScheduler::poll(HerkulexDriver& hlx, long long budget_us)
+{
+	PollItem items[kMaxServo * kNumPollGroup];
+	long long now_us = nowMicros();
+	int num_items = plan(now_us, budget_us, items, kMaxServo * kNumPollGroup);
+
+	stats.ticks++;
+	stats.budget_us += budget_us;
+
+	// one pipelined request per register group
+	for (int g = 0; g < kNumPollGroup; g++)
+	{
+		char pIDs[kMaxServo];
+		int num_ids = 0;
+		for (int i = 0; i < num_items; i++)
+		{
+			if (items[i].group == g)
+			{
+				pIDs[num_ids++] = items[i].pID;
+				stats.planned_us += items[i].cost_us;
+			}
+		}
+		if (num_ids == 0)
+			continue;
+
+		RegisterReply replies[kMaxServo];
+		hlx.readRegisters(pIDs, num_ids, (unsigned char)groupAddress((PollGroup)g), (unsigned char)groupLength((PollGroup)g), replies);
+		long long done_us = nowMicros();
+		for (int i = 0; i < num_ids; i++)
+		{
+			PolledServo* servo = find(pIDs[i]);
+			if (servo != nullptr)
+				applyReply(*servo, (PollGroup)g, replies[i], done_us);
+		}
+		stats.reads += num_ids;
+		stats.group_reads[g] += num_ids;
+	}
+	return num_items;
+}
+
+void PollingScheduler::applyReply(PolledServo& servo, PollGroup group, const RegisterReply& reply, long long now_us)
+{
+	PollEntry& entry = servo.groups[group];
+	long long p = period(servo, group);
+
+	// next poll one period after the previous due time, or one period from now if the poll was more than one period late
+	entry.due_us += p;
+	if (entry.due_us <= now_us)
+		entry.due_us = now_us + p;
+
+	if (reply.status != kReplyOK)
+	{
+		stats.failed_reads++;
+		return;
+	}
+
+	entry.last_read_us = now_us;
+	servo.valid = true;
+	memcpy(servo.ram + (groupAddress(group) - ServoTelemetry::Range::kAddress), reply.data, groupLength(group));
+
+	// every reply carries the status, so the status does not need its own poll for one more period
+	servo.ram[RegStatusError::kAddress - ServoTelemetry::Range::kAddress] = reply.status_error;
+	servo.ram[RegStatusDetail::kAddress - ServoTelemetry::Range::kAddress] = reply.status_detail;
+	PollEntry& status = servo.groups[kPollStatus];
+	status.last_read_us = now_us;
+	if (group != kPollStatus && status.period_us > 0)
+		status.due_us = now_us + status.period_us;
+
+	bool moving = (reply.status_detail & kDetailMoving) != 0;
+	if (moving != servo.moving)
+	{
+		servo.moving = moving;
+		// move the next position poll to the new rate right away
+		PollEntry& position = servo.groups[kPollPosition];
+		long long position_period = period(servo, kPollPosition);
+		if (position_period > 0 && position.last_read_us >= 0)
+			position.due_us = position.last_read_us + position_period;
+	}
+}
+
+/** @brief Get the latest values read for a motor
+*
+* Only the fields of the groups that were polled are up to date. See getLastRead()
+*
+* @param[in] pID id of the motor
+* @param[out] telemetry the values
+*
+* @return returns false if the motor never replied
+*/
+bool PollingScheduler::getTelemetry(char pID, ServoTelemetry& telemetry) const
+{
+	telemetry = ServoTelemetry();
+	telemetry.pID = pID;
+	const PolledServo* servo = find(pID);
+	if (servo == nullptr || !servo->valid)
+		return false;
+
+	typedef ServoTelemetry::Range Range;
+	const unsigned char* data = servo->ram;
+	telemetry.status_error = Range::get<RegStatusError>(data);
+	telemetry.status_detail = Range::get<RegStatusDetail>(data);
+	telemetry.torque_control = Range::get<RegTorqueControl>(data);
+	telemetry.led = Range::get<RegLED>(data);
+	telemetry.voltage = Range::get<RegVoltage>(data);
+	telemetry.temperature = Range::get<RegTemperature>(data);
+	telemetry.control_mode = Range::get<RegControlMode>(data);
+	telemetry.tick = Range::get<RegTick>(data);
+	telemetry.calibrated_position = Range::get<RegCalibratedPosition>(data);
+	telemetry.absolute_position = Range::get<RegAbsolutePosition>(data);
+	telemetry.differential_position = Range::get<RegDifferentialPosition>(data);
+	telemetry.pwm = Range::get<RegPWM>(data);
+	telemetry.valid = true;
+	return true;
+}
+
+/** @brief Get the time a register group of a motor was last read
+*
+* @return returns the monotonic time in microseconds, or -1 if never read
+*/
+long long PollingScheduler::getLastRead(char pID, PollGroup group) const
+{
+	const PolledServo* servo = find(pID);
+	return servo != nullptr ? servo->groups[group].last_read_us : -1;
+}
+
+/** @brief true if the last reply of the motor had the Moving flag set */
+bool PollingScheduler::isMoving(char pID) const
+{
+	const PolledServo* servo = find(pID);
+	return servo != nullptr && servo->moving;
+}
+
+/** @brief Print the counters
+*
+* @return returns nothing
+*/
+void PollingScheduler::printStats() const
+{
+	printf("PollingScheduler: %lld ticks, %lld reads (%lld failed), %lld deferred, bus budget used %.1f%%\n", stats.ticks, stats.reads, stats.failed_reads, stats.deferred,
+		stats.budget_us > 0 ? 100.0 * stats.planned_us / stats.budget_us : 0.0);
+	printf("  reads per group: position %lld, status %lld, health %lld\n", stats.group_reads[kPollPosition], stats.group_reads[kPollStatus], stats.group_reads[kPollHealth]);
+}
+
+PollingScheduler::PolledServo* PollingScheduler::find(char pID)
+{
+	for (int i = 0; i < num_servo; i++)
+	{
+		if (servos[i].pID == pID)
+			return &servos[i];
+	}
+	return nullptr;
+}
+
+const PollingScheduler::PolledServo* PollingScheduler::find(char pID) const
+{
+	return const_cast<PollingScheduler*>(this)->find(pID);
+}
+
+long long PollingScheduler::period(const PolledServo& servo, PollGroup group) const
+{
+	const PollEntry& entry = servo.groups[group];
+	return (servo.moving && entry.moving_period_us > 0) ? entry.moving_period_us : entry.period_us;
+}
+
+int PollingScheduler::groupAddress(PollGroup group)
+{
+	switch (group)
+	{
+	case kPollStatus:
+		return StatusRange::kAddress;
+	case kPollHealth:
+		return HealthRange::kAddress;
+	default:
+		return PositionRange::kAddress;
+	}
+}
+
+int PollingScheduler::groupLength(PollGroup group)
+{
+	switch (group)
+	{
+	case kPollStatus:
+		return StatusRange::kLength;
+	case kPollHealth:
+		return HealthRange::kLength;
+	default:
+		return PositionRange::kLength;
+	}
+}
@@ -0,0 +1,123 @@
+#ifndef POLLING_SCHEDULER_HPP_
+#define POLLING_SCHEDULER_HPP_
+
+#include "herkulex_driver.hpp"
+#include "bus_timing.hpp"
+
+/** Register groups polled by PollingScheduler */
+enum PollGroup
+{
+	kPollPosition,		//absolute position and differential position (60 to 63)
+	kPollStatus,		//status error and status detail (48 to 49)
+	kPollHealth,		//voltage and temperature (54 to 55)
+	kNumPollGroup
+};
+
+/** One read chosen by PollingScheduler::plan()
+* @param[out] pID id of the motor
+* @param[out] group the registers to read
+* @param[out] cost_us bus time of the read in microseconds
+*/
+struct PollItem
+{
+	char pID = 0;
+	PollGroup group = kPollPosition;
+	long long cost_us = 0;
+};
+
+/** Polls every (motor, register group) at its own rate, within a bus time budget per tick
+*
+* Each group has a target rate per motor (by default: position 50 Hz, status 50 Hz, voltage/temperature 1 Hz),
+* and the position rate is raised (by default to 200 Hz) while the motor reports the Moving flag. \n
+* Every tick, poll() picks the reads that are due, most overdue first, until the bus time of the tick (computed with BusTiming from the baudrate and packet sizes) is used up.
+* Reads that do not fit are deferred to the next tick. The reads of one group are pipelined (HerkulexDriver::readRegisters). \n
+* Every reply carries the status of the motor, so any read also counts as a status poll.
+*
+* Usage: \n
+* PollingScheduler poller(BusTiming(115200, 100)); \n
+* poller.addServo(1); \n
+* poller.setRate(kPollPosition, 100, 200); \n
+* poller.poll(hlx, 5000); // every tick, use at most 5ms of bus time \n
+* poller.getTelemetry(1, telemetry);
+*
+* Created by:
+* @author Er Jie Kai (EJK)
+ */
+class PollingScheduler
+{
+public:
+	static const int kMaxServo = 32;
+
+	typedef HerkulexRegisterRange<RegAbsolutePosition, RegDifferentialPosition> PositionRange;
+	typedef HerkulexRegisterRange<RegStatusError, RegStatusDetail> StatusRange;
+	typedef HerkulexRegisterRange<RegVoltage, RegTemperature> HealthRange;
+
+	/** Counters since the scheduler was created
+	* @param[out] ticks number of poll() calls
+	* @param[out] reads number of reads sent
+	* @param[out] group_reads number of reads sent per register group
+	* @param[out] failed_reads number of reads without a valid reply
+	* @param[out] deferred number of due reads that did not fit in the budget of their tick
+	* @param[out] planned_us total estimated bus time of the reads sent
+	* @param[out] budget_us total budget given to poll()
+	*/
+	struct Stats
+	{
+		long long ticks = 0;
+		long long reads = 0;
+		long long group_reads[kNumPollGroup] = { 0 };
+		long long failed_reads = 0;
+		long long deferred = 0;
+		long long planned_us = 0;
+		long long budget_us = 0;
+	};
+
+	PollingScheduler(const BusTiming& timing);
+
+	bool addServo(char pID);
+	void setRate(PollGroup group, double hz, double moving_hz = 0);
+	void setRate(char pID, PollGroup group, double hz, double moving_hz = 0);
+
+	int plan(long long now_us, long long budget_us, PollItem* items, int max_items);
+	int poll(HerkulexDriver& hlx, long long budget_us);
+
+	bool getTelemetry(char pID, ServoTelemetry& telemetry) const;
+	long long getLastRead(char pID, PollGroup group) const;
+	bool isMoving(char pID) const;
+
+	long long readCost(PollGroup group) const;
+	const Stats& getStats() const { return stats; }
+	void printStats() const;
+
+private:
+	struct PollEntry
+	{
+		long long period_us = 0;		//0 = not polled
+		long long moving_period_us = 0;	//period while moving (0 = same as period_us)
+		long long due_us = 0;
+		long long last_read_us = -1;
+	};
+
+	struct PolledServo
+	{
+		char pID = 0;
+		bool moving = false;
+		bool valid = false;
+		unsigned char ram[ServoTelemetry::Range::kLength];	//image of RAM registers 48 to 65
+		PollEntry groups[kNumPollGroup];
+	};
+
+	BusTiming timing;
+	PolledServo servos[kMaxServo];
+	int num_servo = 0;
+	Stats stats;
+
+	PolledServo* find(char pID);
+	const PolledServo* find(char pID) const;
+	long long period(const PolledServo& servo, PollGroup group) const;
+	void applyReply(PolledServo& servo, PollGroup group, const RegisterReply& reply, long long now_us);
+	static int groupAddress(PollGroup group);
+	static int groupLength(PollGroup group);
+};
+
+#endif /*POLLING_SCHEDULER_HPP_*/
@@ -0,0 +1,176 @@
+#include "register_shadow.hpp"
+#include <cstring> //for memset
+
+RegisterShadow::RegisterShadow()
+	: servos(kNumServo)
+{
+	invalidateAll();
+}
+
+bool RegisterShadow::validRange(unsigned char pID, bool eep, int address, int len) const
+{
+	int size = eep ? kEepSize : kRamSize;
+	return pID < kNumServo && address >= 0 && len > 0 && address + len <= size;
+}
+
+/** @brief Write new register values into the shadow
+*
+* Bytes that are already known to have the same value are left untouched. The others are marked dirty.
+*
+* @param[in] pID id of the motor
+* @param[in] eep EEP registers if true, else RAM registers
+* @param[in] address first register address
+* @param[in] values the new register values
+* @param[in] len number of bytes
+*
+* @return returns true if at least one byte became dirty (the write has to be sent), false if the write is redundant
+*/
+bool RegisterShadow::update(unsigned char pID, bool eep, int address, const char* values, int len)
+{
+	if (!validRange(pID, eep, address, len))
+		return true; // not tracked. always send
+
+	ServoShadow& servo = servos[pID];
+	unsigned char* value = eep ? servo.eep : servo.ram;
+	unsigned char* state = eep ? servo.eep_state : servo.ram_state;
+
+	bool changed = false;
+	for (int i = address; i < address + len; i++)
+	{
+		unsigned char v = (unsigned char)values[i - address];
+		if (state[i] == kKnown && value[i] == v)
+			continue;
+		if (state[i] != kDirty)
+		{
+			if (servo.num_dirty == 0)
+				num_dirty_servo++;
+			servo.num_dirty++;
+		}
+		value[i] = v;
+		state[i] = kDirty;
+		changed = true;
+	}
+
+	if (!changed)
+		suppressed_count++;
+	return changed;
+}
+
+/** @brief Record register values known to be on the motor (eg: after a read or a sent write)
+*
+* @param[in] pID id of the motor
+* @param[in] eep EEP registers if true, else RAM registers
+* @param[in] address first register address
+* @param[in] values the register values
+* @param[in] len number of bytes
+*
+* @return returns nothing
+*/
+void RegisterShadow::store(unsigned char pID, bool eep, int address, const unsigned char* values, int len)
+{
+	if (!validRange(pID, eep, address, len))
+		return;
+
+	ServoShadow& servo = servos[pID];
+	unsigned char* value = eep ? servo.eep : servo.ram;
+	unsigned char* state = eep ? servo.eep_state : servo.ram_state;
+	for (int i = address; i < address + len; i++)
+	{
+		if (state[i] == kDirty)
+			continue; // a newer value is waiting to be sent
+		value[i] = values[i - address];
+		state[i] = kKnown;
+	}
+}
+
+/** @brief Record register values written to every motor with the broadcast id
+*
+* @return returns nothing
+*/
+void RegisterShadow::storeAll(bool eep, int address, const unsigned char* values, int len)
+{
+	for (int pID = 0; pID < kNumServo; pID++)
+		store((unsigned char)pID, eep, address, values, len);
+}
+
+/** @brief Take the first block of adjacent dirty bytes of a motor, and mark it as known
+*
+* @param[in] pID id of the motor
+* @param[in] eep EEP registers if true, else RAM registers
+* @param[out] address first register address of the block
+* @param[out] len number of bytes in the block
+* @param[out] values the register values of the block. valid until the next update()
+*
+* @return returns false if there is no dirty byte left
+*/
+bool RegisterShadow::takeDirtyRun(unsigned char pID, bool eep, int& address, int& len, const unsigned char*& values)
+{
+	if (pID >= kNumServo || servos[pID].num_dirty == 0)
+		return false;
+
+	ServoShadow& servo = servos[pID];
+	unsigned char* value = eep ? servo.eep : servo.ram;
+	unsigned char* state = eep ? servo.eep_state : servo.ram_state;
+	int size = eep ? kEepSize : kRamSize;
+
+	int start = 0;
+	while (start < size && state[start] != kDirty)
+		start++;
+	if (start == size)
+		return false;
+
+	int end = start;
+	while (end < size && state[end] == kDirty)
+	{
+		state[end] = kKnown;
+		end++;
+	}
+
+	servo.num_dirty -= end - start;
+	if (servo.num_dirty == 0)
+		num_dirty_servo--;
+
+	address = start;
+	len = end - start;
+	values = value + start;
+	return true;
+}
+
+bool RegisterShadow::isDirty(unsigned char pID) const
+{
+	return pID < kNumServo && servos[pID].num_dirty > 0;
+}
+
+/** @brief Forget everything known about a motor (eg: after reboot, rollback or error clear)
+*
+* Dirty bytes are kept, so writes that were not sent yet are not lost.
+*
+* @param[in] pID id of the motor
+*
+* @return returns nothing
+*/
+void RegisterShadow::invalidate(unsigned char pID)
+{
+	if (pID >= kNumServo)
+		return;
+
+	ServoShadow& servo = servos[pID];
+	for (int i = 0; i < kRamSize; i++)
+		if (servo.ram_state[i] == kKnown)
+			servo.ram_state[i] = kUnknown;
+	for (int i = 0; i < kEepSize; i++)
+		if (servo.eep_state[i] == kKnown)
+			servo.eep_state[i] = kUnknown;
+}
+
+/** @brief Forget everything, including the writes that were not sent yet
+*
+* @return returns nothing
+*/
+void RegisterShadow::invalidateAll()
+{
+	for (int pID = 0; pID < kNumServo; pID++)
+		memset(&servos[pID], 0, sizeof(ServoShadow));
+	num_dirty_servo = 0;
+	suppressed_count = 0;
+}
@@ -0,0 +1,62 @@
+#ifndef REGISTER_SHADOW_HPP_
+#define REGISTER_SHADOW_HPP_
+
+#include <vector>
+
+/** A copy of the RAM and EEP register values that the driver knows every motor has
+*
+* Every register byte is either unknown, known (same value as the motor) or dirty (written by the user but not sent yet). \n
+* update() only marks a byte dirty when the new value differs from the known value, so repeated writes of the same value are suppressed. \n
+* takeDirtyRun() returns adjacent dirty bytes as one block, so they can be sent with a single RAM_WRITE/EEP_WRITE.
+*
+* @note the motor can change some registers by itself (eg: torque is turned off when an error is detected). Call invalidate() whenever that might have happened
+*
+* Created by:
+* @author Er Jie Kai (EJK)
+ */
+class RegisterShadow
+{
+public:
+	static const int kNumServo = 254;	//valid ids are 0 to 253
+	static const int kRamSize = 80;
+	static const int kEepSize = 64;
+
+	RegisterShadow();
+
+	bool update(unsigned char pID, bool eep, int address, const char* values, int len);
+	void store(unsigned char pID, bool eep, int address, const unsigned char* values, int len);
+	void storeAll(bool eep, int address, const unsigned char* values, int len);
+	bool takeDirtyRun(unsigned char pID, bool eep, int& address, int& len, const unsigned char*& values);
+
+	bool isDirty(unsigned char pID) const;
+	bool anyDirty() const { return num_dirty_servo > 0; }
+	void invalidate(unsigned char pID);
+	void invalidateAll();
+
+	unsigned int suppressedCount() const { return suppressed_count; }
+
+private:
+	enum ByteState
+	{
+		kUnknown = 0,
+		kKnown = 1,
+		kDirty = 2
+	};
+
+	struct ServoShadow
+	{
+		unsigned char ram[kRamSize];
+		unsigned char ram_state[kRamSize];
+		unsigned char eep[kEepSize];
+		unsigned char eep_state[kEepSize];
+		int num_dirty; //number of dirty bytes (ram and eep)
+	};
+
+	std::vector<ServoShadow> servos;
+	int num_dirty_servo;
+	unsigned int suppressed_count;
+
+	bool validRange(unsigned char pID, bool eep, int address, int len) const;
+};
+
+#endif /*REGISTER_SHADOW_HPP_*/
@@ -0,0 +1,60 @@
+#ifndef RTT_ESTIMATOR_HPP_
+#define RTT_ESTIMATOR_HPP_
+
+/** Round trip time of one motor, and the reply timeout derived from it
+*
+* Same estimator as the retransmission timer of TCP (RFC 6298): \n
+* srtt = 7/8 srtt + 1/8 rtt, rttvar = 3/4 rttvar + 1/4 |srtt - rtt|, timeout = srtt + max(kGranularity, 4 rttvar). \n
+* Every timeout doubles the timeout (exponential backoff) until the next sample. Samples of retransmitted requests are not used,
+* because the reply might belong to the first request (Karn's algorithm).
+*
+* Created by:
+* @author Er Jie Kai (EJK)
+ */
+struct RttEstimator
+{
+	static const long long kGranularity = 250;	//minimum margin above srtt in microseconds
+
+	long long srtt_us = -1;			//smoothed round trip time. -1 = no sample yet
+	long long rttvar_us = 0;		//round trip time variation
+	long long rto_us = -1;			//current timeout. -1 = no sample yet
+	unsigned int samples = 0;		//number of round trip times measured
+	unsigned int timeouts = 0;		//number of requests without a reply before the timeout
+	unsigned int retries = 0;		//number of requests sent again after a timeout
+
+	/** @brief add a measured round trip time and compute the new timeout */
+	void sample(long long rtt_us)
+	{
+		if (srtt_us < 0)
+		{
+			srtt_us = rtt_us;
+			rttvar_us = rtt_us / 2;
+		}
+		else
+		{
+			long long err = srtt_us > rtt_us ? srtt_us - rtt_us : rtt_us - srtt_us;
+			rttvar_us = (3 * rttvar_us + err) / 4;
+			srtt_us = (7 * srtt_us + rtt_us) / 8;
+		}
+		rto_us = srtt_us + (4 * rttvar_us > kGranularity ? 4 * rttvar_us : kGranularity);
+		samples++;
+	}
+
+	/** @brief a request timed out: double the timeout, up to max_us */
+	void backoff(long long max_us)
+	{
+		timeouts++;
+		if (rto_us >= 0)
+			rto_us = 2 * rto_us < max_us ? 2 * rto_us : max_us;
+	}
+
+	/** @brief timeout of the next request, between min_us and max_us (max_us until the first sample) */
+	long long timeout(long long min_us, long long max_us) const
+	{
+		if (rto_us < 0 || rto_us > max_us)
+			return max_us;
+		return rto_us < min_us ? min_us : rto_us;
+	}
+};
+
+#endif /*RTT_ESTIMATOR_HPP_*/
@@ -0,0 +1,288 @@
+#include "serial_port_finder.hpp"
+
+#ifdef __unix__
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <dirent.h>
+#include <limits.h>
+#include <sys/stat.h>
+
+/** @brief Create a finder
+*
+* @param[in] sysfs_root mount point of sysfs
+* @param[in] dev_root directory of the device files
+*/
+SerialPortFinder::SerialPortFinder(const std::string& sysfs_root, const std::string& dev_root)
+	: sysfs_root(sysfs_root), dev_root(dev_root)
+{
+	const char* cache_home = getenv("XDG_CACHE_HOME");
+	const char* home = getenv("HOME");
+	if (cache_home != nullptr && cache_home[0] != '\0')
+		cache_file = std::string(cache_home) + "/herkulex_serial_ports";
+	else if (home != nullptr && home[0] != '\0')
+		cache_file = std::string(home) + "/.cache/herkulex_serial_ports";
+	else
+		cache_file = "/tmp/herkulex_serial_ports";
+}
+
+// first line of a sysfs attribute file, without the trailing newline. empty if the file does not exist
+std::string SerialPortFinder::readAttribute(const std::string& dir, const char* attribute)
+{
+	std::ifstream file(dir + "/" + attribute);
+	std::string value;
+	if (!file || !std::getline(file, value))
+		return "";
+	while (!value.empty() && (value.back() == '\n' || value.back() == '\r' || value.back() == ' '))
+		value.pop_back();
+	return value;
+}
+
+/** @brief Read the USB attributes of one tty
+*
+* Follows /sys/class/tty/<name>/device up to the USB device (the first parent with an idVendor attribute).
+*
+* @param[in] name name of the tty (eg: ttyUSB0)
+* @param[out] port the attributes. by_id is not filled
+*
+* @return returns false if the tty does not exist or is not a USB device
+*/
+bool SerialPortFinder::describe(const std::string& name, SerialPortInfo& port) const
+{
+	char resolved[PATH_MAX];
+	std::string link = sysfs_root + "/class/tty/" + name + "/device";
+	if (realpath(link.c_str(), resolved) == nullptr)
+		return false;
+
+	char root[PATH_MAX];
+	if (realpath(sysfs_root.c_str(), root) == nullptr)
+		return false;
+
+	std::string dir = resolved;
+	while (dir.size() > strlen(root))
+	{
+		std::string vid = readAttribute(dir, "idVendor");
+		if (!vid.empty())
+		{
+			port = SerialPortInfo();
+			port.name = name;
+			port.device = dev_root + "/" + name;
+			port.vid = (unsigned short)strtoul(vid.c_str(), nullptr, 16);
+			port.pid = (unsigned short)strtoul(readAttribute(dir, "idProduct").c_str(), nullptr, 16);
+			port.serial = readAttribute(dir, "serial");
+			port.manufacturer = readAttribute(dir, "manufacturer");
+			port.product = readAttribute(dir, "product");
+			return true;
+		}
+		size_t slash = dir.find_last_of('/');
+		if (slash == std::string::npos || slash == 0)
+			break;
+		dir.erase(slash);
+	}
+	return false;
+}
+
+/** @brief List every USB serial adapter
+*
+* @param[out] ports the adapters sorted by tty name, with their /dev/serial/by-id link when there is one
+*
+* @return returns the number of adapters found
+*/
+int SerialPortFinder::enumerate(std::vector<SerialPortInfo>& ports) const
+{
+	ports.clear();
+	DIR* dir = opendir((sysfs_root + "/class/tty").c_str());
+	if (dir == nullptr)
+		return 0;
+	struct dirent* entry;
+	while ((entry = readdir(dir)) != nullptr)
+	{
+		if (entry->d_name[0] == '.')
+			continue;
+		SerialPortInfo port;
+		if (describe(entry->d_name, port))
+			ports.push_back(port);
+	}
+	closedir(dir);
+	std::sort(ports.begin(), ports.end(), [](const SerialPortInfo& a, const SerialPortInfo& b) { return a.name < b.name; });
+
+	std::string by_id_dir = dev_root + "/serial/by-id";
+	dir = opendir(by_id_dir.c_str());
+	if (dir != nullptr)
+	{
+		while ((entry = readdir(dir)) != nullptr)
+		{
+			if (entry->d_name[0] == '.')
+				continue;
+			std::string link = by_id_dir + "/" + entry->d_name;
+			char resolved[PATH_MAX];
+			if (realpath(link.c_str(), resolved) == nullptr)
+				continue;
+			const char* name = strrchr(resolved, '/');
+			name = name != nullptr ? name + 1 : resolved;
+			for (size_t i = 0; i < ports.size(); i++)
+			{
+				if (ports[i].name == name)
+					ports[i].by_id = link;
+			}
+		}
+		closedir(dir);
+	}
+	return (int)ports.size();
+}
+
+/** @brief Parse a match string. See SerialPortMatch
+*
+* @param[in] spec eg: "vid=0403,pid=6001,serial=A50285BI", "0403:6001" or "FT232R USB UART"
+*
+* @return returns the match
+*/
+SerialPortMatch SerialPortFinder::parse(const std::string& spec)
+{
+	SerialPortMatch match;
+	if (spec.find('=') == std::string::npos && spec.find(':') == std::string::npos)
+	{
+		match.product = spec;
+		return match;
+	}
+
+	size_t start = 0;
+	while (start <= spec.size())
+	{
+		size_t end = spec.find(',', start);
+		if (end == std::string::npos)
+			end = spec.size();
+		std::string token = spec.substr(start, end - start);
+		size_t eq = token.find('=');
+		size_t colon = token.find(':');
+		if (eq != std::string::npos)
+		{
+			std::string key = token.substr(0, eq);
+			std::string value = token.substr(eq + 1);
+			if (key == "vid")
+				match.vid = (int)strtol(value.c_str(), nullptr, 16);
+			else if (key == "pid")
+				match.pid = (int)strtol(value.c_str(), nullptr, 16);
+			else if (key == "serial")
+				match.serial = value;
+			else if (key == "product")
+				match.product = value;
+		}
+		else if (colon != std::string::npos)
+		{
+			match.vid = (int)strtol(token.substr(0, colon).c_str(), nullptr, 16);
+			match.pid = (int)strtol(token.substr(colon + 1).c_str(), nullptr, 16);
+		}
+		start = end + 1;
+	}
+	return match;
+}
+
+/** @brief true if the adapter has every attribute of the match */
+bool SerialPortFinder::matches(const SerialPortInfo& port, const SerialPortMatch& match)
+{
+	return (match.vid < 0 || match.vid == port.vid) && (match.pid < 0 || match.pid == port.pid) && (match.serial.empty() || match.serial == port.serial)
+		&& (match.product.empty() || match.product == port.product);
+}
+
+// tty name cached for key, empty if none
+std::string SerialPortFinder::readCache(const std::string& key) const
+{
+	std::ifstream file(cache_file);
+	std::string line;
+	while (std::getline(file, line))
+	{
+		size_t tab = line.find('\t');
+		if (tab != std::string::npos && line.compare(0, tab, key) == 0 && tab == key.size())
+			return line.substr(tab + 1);
+	}
+	return "";
+}
+
+void SerialPortFinder::writeCache(const std::string& key, const std::string& name) const
+{
+	std::vector<std::string> lines;
+	{
+		std::ifstream file(cache_file);
+		std::string line;
+		while (std::getline(file, line))
+		{
+			if (line.compare(0, key.size() + 1, key + "\t") != 0)
+				lines.push_back(line);
+		}
+	}
+	lines.push_back(key + "\t" + name);
+
+	size_t slash = cache_file.find_last_of('/');
+	if (slash != std::string::npos && slash > 0)
+		mkdir(cache_file.substr(0, slash).c_str(), 0755); // eg: ~/.cache on a fresh account
+	std::ofstream file(cache_file, std::ios::trunc);
+	for (size_t i = 0; i < lines.size(); i++)
+		file << lines[i] << "\n";
+}
+
+/** @brief Find the device path of the one adapter that matches
+*
+* The cached tty of key is checked first. The adapters are only enumerated if it is gone or does not match anymore.
+*
+* @param[in] match the attributes to match
+* @param[in] key name of the match in the cache (eg: the string it was parsed from)
+*
+* @return returns the device path, or an empty string if no adapter or more than one adapter matches
+*/
+std::string SerialPortFinder::find(const SerialPortMatch& match, const std::string& key) const
+{
+	SerialPortInfo port;
+	std::string cached = readCache(key);
+	if (!cached.empty() && describe(cached, port) && matches(port, match))
+		return port.device;
+
+	std::vector<SerialPortInfo> ports;
+	enumerate(ports);
+	std::vector<SerialPortInfo> found;
+	for (size_t i = 0; i < ports.size(); i++)
+	{
+		if (matches(ports[i], match))
+			found.push_back(ports[i]);
+	}
+
+	if (found.size() == 1)
+	{
+		writeCache(key, found[0].name);
+		return found[0].device;
+	}
+
+	if (found.empty())
+		printf("No USB serial adapter matches \"%s\" (%d adapters found)\n", key.c_str(), (int)ports.size());
+	else
+		printf("%d USB serial adapters match \"%s\", add the serial number to the match:\n", (int)found.size(), key.c_str());
+	for (size_t i = 0; i < found.size(); i++)
+		printf("  %s %04x:%04x serial=%s product=%s\n", found[i].device.c_str(), found[i].vid, found[i].pid, found[i].serial.c_str(), found[i].product.c_str());
+	return "";
+}
+
+/** @brief Turn the port name given to HerkulexDriver into a device path
+*
+* A match string is looked up with find(), which writes the tty it found into the cache file (see setCacheFile()).
+* Device paths and device names never touch the cache.
+*
+* @param[in] valid_com_name a device path (starts with '/', returned as it is), a device name in dev_root (eg: ttyUSB0), or a match string (see SerialPortMatch)
+*
+* @return returns the device path, or an empty string if no single adapter matches
+*/
+std::string SerialPortFinder::resolve(const std::string& valid_com_name) const
+{
+	if (!valid_com_name.empty() && valid_com_name[0] == '/')
+		return valid_com_name;
+
+	struct stat info;
+	std::string device = dev_root + "/" + valid_com_name;
+	if (!valid_com_name.empty() && valid_com_name.find('/') == std::string::npos && stat(device.c_str(), &info) == 0)
+		return device;
+	return find(parse(valid_com_name), valid_com_name);
+}
+
+#endif
@@ -0,0 +1,83 @@
+#ifndef SERIAL_PORT_FINDER_HPP_
+#define SERIAL_PORT_FINDER_HPP_
+
+#include <string>
+#include <vector>
+
+#ifdef __unix__
+
+/** One USB serial adapter found in sysfs
+* @param[out] name name of the tty (eg: ttyUSB0)
+* @param[out] device device path (eg: /dev/ttyUSB0)
+* @param[out] by_id stable path in /dev/serial/by-id, empty if udev did not create one
+* @param[out] vid, pid USB vendor and product id
+* @param[out] serial, manufacturer, product USB string descriptors (empty if the adapter has none)
+*/
+struct SerialPortInfo
+{
+	std::string name;
+	std::string device;
+	std::string by_id;
+	unsigned short vid = 0;
+	unsigned short pid = 0;
+	std::string serial;
+	std::string manufacturer;
+	std::string product;
+};
+
+/** What a serial adapter must have to be chosen. Empty fields and -1 match anything
+*
+* Parsed from a string by SerialPortFinder::parse(): "vid=0403,pid=6001,serial=A50285BI", "0403:6001", "serial=A50285BI" or "product=FT232R USB UART".
+* A string without '=' or ':' is a product string, like the friendly name used on windows.
+*/
+struct SerialPortMatch
+{
+	int vid = -1;
+	int pid = -1;
+	std::string serial;
+	std::string product;
+};
+
+/** Finds the device path of a USB serial adapter on linux, by USB attributes instead of by device name
+*
+* Enumerates /sys/class/tty (USB vendor/product id, serial number and product string of every tty backed by a USB device)
+* and /dev/serial/by-id (the stable udev links). \n
+* find() keeps the result in a cache file ($XDG_CACHE_HOME/herkulex_serial_ports, else ~/.cache/herkulex_serial_ports). On the next start, only the cached tty is checked (one sysfs lookup instead of a full enumeration),
+* and the adapters are only enumerated again if it is gone or does not match anymore. \n
+* When several adapters match (eg: two adapters with the same product string), find() fails and lists them: add the serial number to the match.
+*
+* Usage: \n
+* std::string device = SerialPortFinder().resolve("serial=A50285BI"); // "/dev/ttyUSB1"
+*
+* Created by:
+* @author Er Jie Kai (EJK)
+ */
+class SerialPortFinder
+{
+public:
+	SerialPortFinder(const std::string& sysfs_root = "/sys", const std::string& dev_root = "/dev");
+
+	int enumerate(std::vector<SerialPortInfo>& ports) const;
+	bool describe(const std::string& name, SerialPortInfo& port) const;
+	std::string find(const SerialPortMatch& match, const std::string& key) const;
+	std::string resolve(const std::string& valid_com_name) const;
+
+	void setCacheFile(const std::string& path) { cache_file = path; }
+	const std::string& getCacheFile() const { return cache_file; }
+
+	static SerialPortMatch parse(const std::string& spec);
+	static bool matches(const SerialPortInfo& port, const SerialPortMatch& match);
+
+private:
+	std::string sysfs_root;
+	std::string dev_root;
+	std::string cache_file;
+
+	std::string readCache(const std::string& key) const;
+	void writeCache(const std::string& key, const std::string& name) const;
+	static std::string readAttribute(const std::string& dir, const char* attribute);
+};
+
+#endif
+
+#endif /*SERIAL_PORT_FINDER_HPP_*/
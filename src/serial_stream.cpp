@@ -1,5 +1,634 @@
 #include "serial_stream.hpp"
 
+#ifdef __unix__
+
+#include "custom_baudrate.hpp"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <poll.h>
+#include <errno.h>
+#include <sys/ioctl.h>
+#include <time.h>
+#include <stdlib.h>
+#include <limits.h>
+#include <linux/serial.h>
+
+/** @brief Convert a numeric baudrate into the termios speed constant
+*
+* @param[in] baudrate the baudrate in bits per second (eg: 115200)
+*
+* @return returns the termios speed_t, or B0 if the baudrate is not supported
+*/
+static speed_t baudToSpeed(int baudrate)
+{
+	switch (baudrate)
+	{
+	case 9600: return B9600;
+	case 19200: return B19200;
+	case 38400: return B38400;
+	case 57600: return B57600;
+	case 115200: return B115200;
+	case 230400: return B230400;
+	case 460800: return B460800;
+	case 500000: return B500000;
+	case 576000: return B576000;
+	case 921600: return B921600;
+	case 1000000: return B1000000;
+	default: return B0;
+	}
+}
+
+/** @brief Get a monotonic timestamp in microseconds
+*
+* @return returns the current monotonic time in microseconds
+*/
+static long long monotonicMicros()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+SerialStream::SerialStream(bool use_overlapped)
+{
+	(void)use_overlapped; // overlapped I/O is windows only. the linux fd is always non-blocking
+	fd = -1;
+	device_name[0] = '\0';
+
+	if (pipe(wake_pipe) == 0)
+	{
+		fcntl(wake_pipe[0], F_SETFL, O_NONBLOCK);
+		fcntl(wake_pipe[1], F_SETFL, O_NONBLOCK);
+	}
+	else
+	{
+		wake_pipe[0] = -1;
+		wake_pipe[1] = -1;
+	}
+
+	memset(&tio, 0, sizeof(tio));
+	cfmakeraw(&tio);
+	tio.c_cflag |= (CLOCAL | CREAD); // ignore modem control lines, enable receiver
+	tio.c_cflag &= ~CSTOPB; // 1 stop bit
+	tio.c_cflag &= ~CRTSCTS; // no hardware flow control
+	tio.c_cc[VMIN] = 0; // reads never block inside the driver. timing is done with poll()
+	tio.c_cc[VTIME] = 0;
+	cfsetispeed(&tio, B115200);
+	cfsetospeed(&tio, B115200);
+}
+
+SerialStream::~SerialStream()
+{
+	Close();
+
+	for (int i = 0; i < 2; i++)
+	{
+		if (wake_pipe[i] >= 0)
+			::close(wake_pipe[i]);
+	}
+}
+
+/** @brief Configure the port settings
+*
+* If the port is already opened, the settings are applied immediately. Else they are applied when Open() is called
+*
+* Baudrates without a termios constant (eg: BAUD_666666) are set with termios2, if the adapter can generate them. \n
+* When the port is opened, the bytes still waiting to be sent go out at the old settings first.
+*
+* @param[in] baudrate the baudrate in bits per second (eg: BAUD_115200)
+* @param[in] charsize number of data bits (5 to 8)
+* @param[in] parity PARITY_NONE, PARITY_ODD or PARITY_EVEN
+* @param[in] stopbit number of stop bits (1 or 2)
+* @param[in] flowcontrol 0 = none, 1 = hardware (RTS/CTS)
+*
+* @return returns nothing
+*/
+void SerialStream::configurePort(int baudrate, int charsize, int parity, int stopbit, int flowcontrol)
+{
+	if (baudrate <= 0)
+	{
+		printf("SerialStream: unsupported baudrate %d, using 115200\n", baudrate);
+		baudrate = BAUD_115200;
+	}
+	this->baudrate = baudrate;
+
+	speed_t speed = baudToSpeed(baudrate);
+	custom_baudrate = speed == B0;
+	if (custom_baudrate)
+		speed = B38400; // placeholder. applySettings() sets the real baudrate with termios2
+	cfsetispeed(&tio, speed);
+	cfsetospeed(&tio, speed);
+
+	tio.c_cflag &= ~CSIZE;
+	if (charsize == 5)
+		tio.c_cflag |= CS5;
+	else if (charsize == 6)
+		tio.c_cflag |= CS6;
+	else if (charsize == 7)
+		tio.c_cflag |= CS7;
+	else
+		tio.c_cflag |= CS8;
+
+	tio.c_cflag &= ~(PARENB | PARODD);
+	if (parity == PARITY_ODD)
+		tio.c_cflag |= (PARENB | PARODD);
+	else if (parity == PARITY_EVEN)
+		tio.c_cflag |= PARENB;
+
+	if (stopbit == 2)
+		tio.c_cflag |= CSTOPB;
+	else
+		tio.c_cflag &= ~CSTOPB;
+
+	if (flowcontrol == 1)
+		tio.c_cflag |= CRTSCTS;
+	else
+		tio.c_cflag &= ~CRTSCTS;
+
+	if (fd >= 0)
+	{
+		tcdrain(fd); // a request still in the output buffer must not be garbled by the new baudrate
+		applySettings();
+	}
+}
+
+/** @brief Writes the termios settings to the opened port
+*
+* @return returns 0 if successful, else -1
+*/
+int SerialStream::applySettings()
+{
+	if (custom_baudrate)
+	{
+		if (setCustomBaudrate(fd, tio.c_iflag, tio.c_oflag, tio.c_cflag, tio.c_lflag, tio.c_cc, NCCS, baudrate) != 0)
+		{
+			printf("SerialStream: %s does not support %d baud (errno %d)\n", device_name, baudrate, errno);
+			return -1;
+		}
+		return 0;
+	}
+
+	if (tcsetattr(fd, TCSANOW, &tio) != 0)
+	{
+		printf("SerialStream: tcsetattr failed on %s (errno %d)\n", device_name, errno);
+		return -1;
+	}
+	return 0;
+}
+
+/** @brief Opens a serial port in linux
+*
+* A port that is already open is closed first, and its latency settings are restored (see Close())
+*
+* @param[in] device the path of the port (eg: /dev/ttyUSB0)
+*
+* @return returns flag code [0 = everything successful, 1 = open failed, 2 = tcsetattr failed ]
+*/
+int SerialStream::Open(const char* device)
+{
+	int flag = 0;
+
+	if (fd >= 0)
+		Close(); // before device_name changes: it locates the latency timer to restore
+
+	strncpy(device_name, device, sizeof(device_name) - 1);
+	device_name[sizeof(device_name) - 1] = '\0';
+
+	// O_NOCTTY: the port must not become the controlling terminal. O_NONBLOCK: reads/writes return immediately, poll() does the waiting
+	fd = ::open(device_name, O_RDWR | O_NOCTTY | O_NONBLOCK);
+	if (fd >= 0)
+	{
+		if (applySettings() != 0)
+			flag = 2;
+		else if (low_latency)
+			applyLowLatency();
+	}
+	else
+	{
+		flag = 1;
+	}
+
+	if (flag != 0)
+	{
+		Close();
+	}
+	else
+	{
+		clear();
+	}
+
+	return flag;
+}
+
+void SerialStream::Close(void)
+{
+	if (fd >= 0)
+	{
+		restoreLowLatency();
+		::close(fd);
+	}
+	fd = -1;
+}
+
+bool SerialStream::good()
+{
+	return fd >= 0;
+}
+
+/** @brief Wait until there is data to be read
+*
+* @param[in] wait_us maximum time to wait in microseconds (-1 = wait forever)
+*
+* @return returns 1 if data is available, 0 on timeout or interrupt(), -1 on error
+*/
+int SerialStream::waitReadable(long wait_us)
+{
+	struct pollfd pfds[2];
+	struct pollfd& pfd = pfds[0];
+	pfd.fd = fd;
+	pfd.events = POLLIN;
+	pfd.revents = 0;
+	pfds[1].fd = wake_pipe[0];
+	pfds[1].events = POLLIN;
+	pfds[1].revents = 0;
+	nfds_t nfds = wake_pipe[0] >= 0 ? 2 : 1;
+
+	struct timespec ts;
+	struct timespec* tsp = NULL;
+	if (wait_us >= 0)
+	{
+		ts.tv_sec = wait_us / 1000000;
+		ts.tv_nsec = (wait_us % 1000000) * 1000;
+		tsp = &ts;
+	}
+
+	int ret;
+	do
+	{
+		ret = ppoll(pfds, nfds, tsp, NULL);
+	} while (ret < 0 && errno == EINTR);
+
+	if (ret > 0 && nfds == 2 && (pfds[1].revents & POLLIN))
+		return 0; // interrupted. the wake pipe stays readable until clearInterrupt()
+
+	if (ret > 0 && (pfd.revents & (POLLERR | POLLHUP | POLLNVAL)) && !(pfd.revents & POLLIN))
+		return -1;
+
+	if (ret == 0 && read_minimum > 1)
+	{
+		// poll() only reports VMIN bytes (see setReadMinimum()). at the timeout, a shorter reply must still be read
+		int available = 0;
+		if (ioctl(fd, FIONREAD, &available) == 0 && available > 0)
+			return 1;
+	}
+	return ret;
+}
+
+void SerialStream::write(char* buffer, int len)
+{
+	if (fd < 0)
+		return;
+
+	int written = 0;
+	while (written < len)
+	{
+		ssize_t n = ::write(fd, buffer + written, len - written);
+		if (n > 0)
+		{
+			written += (int)n;
+		}
+		else if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+		{
+			// kernel tx buffer is full. wait until it drains
+			struct pollfd pfd;
+			pfd.fd = fd;
+			pfd.events = POLLOUT;
+			pfd.revents = 0;
+			poll(&pfd, 1, -1);
+		}
+		else if (n < 0 && errno == EINTR)
+		{
+			continue;
+		}
+		else
+		{
+			printf("Cannot write to %s (errno %d)\n", device_name, errno);
+			return;
+		}
+	}
+}
+
+/** @brief Discard the bytes waiting to be sent, then send buffer and wait until it has left the port
+*
+* Only uses tcflush(), write(), poll() and tcdrain(), which are async-signal-safe, so it can be called from a signal handler.
+* Bytes of a write() in progress in another thread may still go out before buffer.
+*
+* @param[in] buffer the bytes to send
+* @param[in] len number of bytes
+*
+* @return returns the number of bytes written
+*/
+int SerialStream::writeUrgent(const char* buffer, int len)
+{
+	if (fd < 0)
+		return 0;
+
+	tcflush(fd, TCOFLUSH);
+	int written = 0;
+	while (written < len)
+	{
+		ssize_t n = ::write(fd, buffer + written, len - written);
+		if (n > 0)
+		{
+			written += (int)n;
+		}
+		else if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+		{
+			struct pollfd pfd;
+			pfd.fd = fd;
+			pfd.events = POLLOUT;
+			pfd.revents = 0;
+			poll(&pfd, 1, 1);
+		}
+		else
+		{
+			break;
+		}
+	}
+	tcdrain(fd);
+	return written;
+}
+
+/** @brief Wake up a read waiting in another thread. The read returns as if it had timed out
+*
+* Async-signal-safe. Every read returns immediately until clearInterrupt() is called
+*
+* @return returns nothing
+*/
+void SerialStream::interrupt()
+{
+	if (wake_pipe[1] < 0)
+		return;
+	char wake = 1;
+	ssize_t n = ::write(wake_pipe[1], &wake, 1);
+	(void)n; // the pipe is already readable if it is full
+}
+
+/** @brief Let reads wait again after interrupt()
+*
+* @return returns nothing
+*/
+void SerialStream::clearInterrupt()
+{
+	if (wake_pipe[0] < 0)
+		return;
+	char drain[64];
+	while (::read(wake_pipe[0], drain, sizeof(drain)) > 0)
+	{
+	}
+}
+
+/** @brief Reads one byte
+*
+* Waits up to the read timeout for it. The size of buffer is unknown, so only one byte is read: use read(buffer, len) or readsome() for more
+*
+* @param[out] buffer where the read byte is stored
+*
+* @return returns the number of bytes read (0 or 1)
+*/
+int SerialStream::read(char* buffer)
+{
+	if (fd < 0 || waitReadable(timeout_us) <= 0)
+		return 0;
+
+	ssize_t n = ::read(fd, buffer, 1);
+	return n > 0 ? (int)n : 0;
+}
+
+/** @brief Reads len bytes from the port
+*
+* Returns early if the read timeout expires before len bytes have arrived
+*
+* @param[out] buffer where the read bytes are stored
+* @param[in] len the number of bytes to read
+*
+* @return returns the number of bytes read
+*/
+int SerialStream::read(char* buffer, int len)
+{
+	if (fd < 0)
+		return 0;
+
+	long long deadline = monotonicMicros() + timeout_us;
+	int nbr = 0;
+	while (nbr < len)
+	{
+		long wait_us = -1;
+		if (timeout_us >= 0)
+		{
+			long long remaining = deadline - monotonicMicros();
+			if (remaining <= 0)
+				break;
+			wait_us = (long)remaining;
+		}
+		if (waitReadable(wait_us) <= 0)
+			break;
+
+		ssize_t n = ::read(fd, buffer + nbr, len - nbr);
+		if (n > 0)
+			nbr += (int)n;
+		else if (n < 0 && errno != EAGAIN && errno != EINTR)
+			break;
+	}
+	return nbr;
+}
+
+/** @brief Reads the bytes waiting in the input buffer, up to maxlen
+*
+* Waits up to the read timeout for the first byte, then returns whatever has arrived without waiting further.
+*
+* @param[out] buffer where the read bytes are stored
+* @param[in] maxlen the size of buffer
+*
+* @return returns the number of bytes read
+*/
+int SerialStream::readsome(char* buffer, int maxlen)
+{
+	if (fd < 0 || maxlen <= 0 || waitReadable(timeout_us) <= 0)
+		return 0;
+
+	ssize_t n = ::read(fd, buffer, maxlen);
+	return n > 0 ? (int)n : 0;
+}
+
+int SerialStream::get(char& buffer)
+{
+	return read(&buffer, 1);
+}
+
+/** @brief Sets the read timeout
+*
+* @param[in] timeout_us maximum time to wait for a byte in microseconds (-1 = wait forever)
+*
+* @return returns nothing
+*/
+void SerialStream::setTimeout(long timeout_us)
+{
+	this->timeout_us = timeout_us;
+}
+
+void SerialStream::clear()
+{
+	if (fd >= 0)
+		tcflush(fd, TCIOFLUSH);
+}
+
+/** @brief Set the low latency profile of a USB serial adapter
+*
+* USB adapters (FTDI, CP210x...) hold the received bytes until their latency timer expires (16 ms by default on FTDI),
+* so a 13 byte reply that takes 1.1 ms on the wire at 115200 baud arrives up to 16 ms late. When enabled: \n
+* - the ASYNC_LOW_LATENCY flag is set with TIOCSSERIAL (ftdi_sio then sets its latency timer to 1 ms) \n
+* - /sys/class/tty/<tty>/device/latency_timer is set to latency_timer_ms if it exists and is writable (needs root or a udev rule) \n
+* When disabled, the flag and the latency timer are set back to their value before setLowLatency(true). Close() and the destructor
+* also set them back, because they belong to the adapter and would outlive the process. \n
+* If the port is not opened yet, the profile is applied by Open().
+*
+* @param[in] enabled true to set the low latency profile, false to restore the default
+* @param[in] latency_timer_ms latency timer in milliseconds (1 to 255)
+*
+* @return returns the settings that are in effect (kAsyncLowLatency | kLatencyTimerSet). 0 if the port is not opened or disabled
+*/
+int SerialStream::setLowLatency(bool enabled, int latency_timer_ms)
+{
+	low_latency = enabled;
+	this->latency_timer_ms = latency_timer_ms < 1 ? 1 : (latency_timer_ms > 255 ? 255 : latency_timer_ms);
+	if (fd < 0)
+		return 0;
+	return applyLowLatency();
+}
+
+int SerialStream::applyLowLatency()
+{
+	int applied = 0;
+	char path[PATH_MAX];
+	bool has_timer = latencyTimerPath(path, sizeof(path));
+	if (has_timer && low_latency && saved_latency_timer < 0)
+		saved_latency_timer = getLatencyTimer(); // before ASYNC_LOW_LATENCY, which sets the timer of ftdi_sio to 1 ms
+
+	struct serial_struct serial;
+	if (ioctl(fd, TIOCGSERIAL, &serial) == 0) // fails on ttys without a serial driver (eg: pseudo terminals)
+	{
+		bool change = true;
+		if (low_latency)
+		{
+			if (saved_async_low_latency < 0)
+				saved_async_low_latency = (serial.flags & ASYNC_LOW_LATENCY) ? 1 : 0;
+			serial.flags |= ASYNC_LOW_LATENCY;
+		}
+		else if (saved_async_low_latency >= 0)
+		{
+			if (saved_async_low_latency == 1)
+				serial.flags |= ASYNC_LOW_LATENCY;
+			else
+				serial.flags &= ~ASYNC_LOW_LATENCY;
+			saved_async_low_latency = -1;
+		}
+		else
+		{
+			change = false; // never changed by setLowLatency()
+		}
+		if (change && ioctl(fd, TIOCSSERIAL, &serial) == 0 && low_latency)
+			applied |= kAsyncLowLatency;
+	}
+
+	if (!has_timer)
+		return applied;
+
+	int value = low_latency ? latency_timer_ms : saved_latency_timer;
+	if (!low_latency)
+		saved_latency_timer = -1;
+	if (value < 1)
+		return applied;
+
+	FILE* file = fopen(path, "w");
+	if (file == NULL)
+		return applied; // only root may write it unless a udev rule allows it
+	bool written = fprintf(file, "%d", value) > 0;
+	written = fclose(file) == 0 && written;
+	if (written && low_latency)
+		applied |= kLatencyTimerSet;
+	return applied;
+}
+
+// ASYNC_LOW_LATENCY and the latency timer belong to the adapter and outlive the process: put them back before the port is closed.
+// low_latency is kept, so the next Open() applies the profile again
+void SerialStream::restoreLowLatency()
+{
+	if (saved_async_low_latency < 0 && saved_latency_timer < 0)
+		return;
+	bool enabled = low_latency;
+	low_latency = false;
+	applyLowLatency();
+	low_latency = enabled;
+}
+
+// sysfs latency_timer attribute of the opened tty. false if the adapter has none (not a usb-serial adapter with a latency timer)
+bool SerialStream::latencyTimerPath(char* path, int len)
+{
+	char resolved[PATH_MAX];
+	if (realpath(device_name, resolved) == NULL) // follows /dev/serial/by-id links
+		return false;
+	const char* name = strrchr(resolved, '/');
+	name = name != NULL ? name + 1 : resolved;
+	snprintf(path, len, "/sys/class/tty/%s/device/latency_timer", name);
+	return access(path, F_OK) == 0;
+}
+
+/** @brief Get the USB latency timer of the opened adapter
+*
+* @return returns the latency timer in milliseconds, or -1 if the adapter has none
+*/
+int SerialStream::getLatencyTimer()
+{
+	char path[PATH_MAX];
+	if (fd < 0 || !latencyTimerPath(path, sizeof(path)))
+		return -1;
+	FILE* file = fopen(path, "r");
+	if (file == NULL)
+		return -1;
+	int value = -1;
+	if (fscanf(file, "%d", &value) != 1)
+		value = -1;
+	fclose(file);
+	return value;
+}
+
+/** @brief Set the number of bytes that must have arrived before a waiting read wakes up
+*
+* Sets VMIN (with VTIME = 0). Because the fd is non-blocking, VMIN does not make reads block: it only makes poll() wait
+* until that many bytes are in the input buffer. Set to the size of the expected reply, a read wakes up once per reply
+* instead of once per USB transfer. Fewer bytes are still returned when the read timeout expires. \n
+* Only calls tcsetattr() when the value changes.
+*
+* @param[in] bytes number of bytes (1 to 255. 1 = wake up on the first byte)
+*
+* @return returns nothing
+*/
+void SerialStream::setReadMinimum(int bytes)
+{
+	bytes = bytes < 1 ? 1 : (bytes > 255 ? 255 : bytes);
+	if (bytes == read_minimum)
+		return;
+	read_minimum = bytes;
+	tio.c_cc[VMIN] = bytes > 1 ? (cc_t)bytes : 0;
+	tio.c_cc[VTIME] = 0;
+	if (fd >= 0)
+		applySettings();
+}
+
+#elif defined(_WIN32) || defined(WIN32)
+
 SerialStream::SerialStream(bool use_overlapped)
 {
 	SerialStreamHandle = INVALID_HANDLE_VALUE;
@@ -79,6 +708,7 @@ int SerialStream::Open(const char* device)
 			flag = 2; // set flag to 2 if SetCommState returns a false (0)
 
 		SetCommMask(SerialStreamHandle, EV_DSR); // create event handle. EV_RXCHAR
+		setTimeout(timeout_us); // apply the read timeout (COMMTIMEOUTS) to the new handle
 		if (use_overlapped == true)
 		{
 			memset(&ov, 0, sizeof(ov));
@@ -257,10 +887,43 @@ int SerialStream::read(char* buffer)
 	}
 }
 
-void SerialStream::read(char* buffer, int len)
+int SerialStream::read(char* buffer, int len)
 {
 	unsigned long nbr = 0; //number of bytes that is read out
 	ReadFile(SerialStreamHandle, buffer, len, &nbr, NULL);
+	return ((int)nbr);
+}
+
+/** @brief Reads the bytes waiting in the input buffer, up to maxlen
+*
+* Waits up to the read timeout for the first byte, then returns whatever has arrived without waiting further.
+*
+* @param[out] buffer where the read bytes are stored
+* @param[in] maxlen the size of buffer
+*
+* @return returns the number of bytes read
+*/
+int SerialStream::readsome(char* buffer, int maxlen)
+{
+	unsigned long nbr = 0; //number of bytes that is read out
+	if (SerialStreamHandle == INVALID_HANDLE_VALUE || maxlen <= 0)
+		return 0;
+
+	ReadFile(SerialStreamHandle, buffer, 1, &nbr, NULL);
+	if (nbr == 0)
+		return 0;
+
+	DWORD errorcode = 0;
+	COMSTAT mycomstat;
+	ClearCommError(SerialStreamHandle, &errorcode, &mycomstat); //use to obtain the number of bytes left over in the buffer
+	unsigned long to_read = mycomstat.cbInQue;
+	if (to_read > (unsigned long)(maxlen - 1))
+		to_read = maxlen - 1;
+
+	unsigned long nbr_rest = 0;
+	if (to_read > 0)
+		ReadFile(SerialStreamHandle, buffer + 1, to_read, &nbr_rest, NULL);
+	return (int)(nbr + nbr_rest);
 }
 
 int SerialStream::get(char& buffer)
@@ -270,11 +933,108 @@ int SerialStream::get(char& buffer)
 	return nbr;
 }
 
+/** @brief Sets the read timeout
+*
+* @param[in] timeout_us maximum time to wait for a byte in microseconds (-1 = wait forever)
+*
+* @return returns nothing
+*/
+void SerialStream::setTimeout(long timeout_us)
+{
+	this->timeout_us = timeout_us;
+
+	COMMTIMEOUTS timeouts;
+	memset(&timeouts, 0, sizeof(timeouts));
+	if (timeout_us >= 0)
+	{
+		DWORD timeout_ms = (DWORD)((timeout_us + 999) / 1000);
+		timeouts.ReadIntervalTimeout = timeout_ms;
+		timeouts.ReadTotalTimeoutConstant = timeout_ms;
+	}
+	if (SerialStreamHandle != INVALID_HANDLE_VALUE)
+		SetCommTimeouts(SerialStreamHandle, &timeouts);
+}
+
 void SerialStream::clear()
 {
 	PurgeComm(SerialStreamHandle, PURGE_RXCLEAR | PURGE_TXCLEAR);
 }
 
+/** @brief Discard the bytes waiting to be sent, then send buffer and wait until it has left the port
+*
+* @param[in] buffer the bytes to send
+* @param[in] len number of bytes
+*
+* @return returns the number of bytes written
+*/
+int SerialStream::writeUrgent(const char* buffer, int len)
+{
+	if (SerialStreamHandle == INVALID_HANDLE_VALUE)
+		return 0;
+
+	PurgeComm(SerialStreamHandle, PURGE_TXABORT | PURGE_TXCLEAR);
+	unsigned long written = 0;
+	if (use_overlapped == true)
+	{
+		OVERLAPPED urgent;
+		memset(&urgent, 0, sizeof(urgent));
+		urgent.hEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+		if (!WriteFile(SerialStreamHandle, buffer, len, &written, &urgent) && GetLastError() == ERROR_IO_PENDING)
+			GetOverlappedResult(SerialStreamHandle, &urgent, &written, TRUE);
+		CloseHandle(urgent.hEvent);
+	}
+	else
+	{
+		WriteFile(SerialStreamHandle, buffer, len, &written, NULL);
+	}
+	FlushFileBuffers(SerialStreamHandle);
+	return (int)written;
+}
+
+/** @brief Wake up a read waiting in another thread. The read returns as if it had timed out
+*
+* @return returns nothing
+*/
+void SerialStream::interrupt()
+{
+	CancelIoEx(SerialStreamHandle, NULL);
+}
+
+/** @brief Let reads wait again after interrupt(). Nothing to do on windows
+*
+* @return returns nothing
+*/
+void SerialStream::clearInterrupt()
+{
+}
+
+/** @brief The latency timer of FTDI adapters is set in the driver properties on windows (Port Settings > Advanced). Nothing is changed
+*
+* @return returns 0
+*/
+int SerialStream::setLowLatency(bool enabled, int latency_timer_ms)
+{
+	(void)enabled;
+	(void)latency_timer_ms;
+	return 0;
+}
+
+int SerialStream::getLatencyTimer()
+{
+	return -1;
+}
+
+/** @brief Windows has no VMIN. Nothing to do
+*
+* @return returns nothing
+*/
+void SerialStream::setReadMinimum(int bytes)
+{
+	(void)bytes;
+}
+
+
+#endif
 
 /*
 // main used for testing
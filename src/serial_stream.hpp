@@ -3,13 +3,36 @@
 
 #include <stdio.h>
 #include <iostream>
-#include <windows.h>
 #include <string>
 #include <ctime> // for timer
 
-/** Reads data from a USB port for WINDOWS
+#ifdef __unix__
+
+#include <termios.h>
+#include <cstring>
+
+// baudrate and parity names follow LibSerial/winbase so that the driver code stays the same on both platforms
+#define BAUD_9600 9600
+#define BAUD_19200 19200
+#define BAUD_57600 57600
+#define BAUD_115200 115200
+#define BAUD_230400 230400
+#define BAUD_460800 460800
+#define BAUD_500000 500000
+#define BAUD_666666 666666
+#define BAUD_1000000 1000000
+
+#define PARITY_NONE 0
+#define PARITY_ODD 1
+#define PARITY_EVEN 2
+
+#elif defined(_WIN32) || defined(WIN32)     /* _Win32 is usually defined by compilers targeting 32 or   64 bit Windows systems */
+#include <windows.h>
+#endif
+
+/** Reads data from a USB port for WINDOWS and LINUX
 *
-* @note for linux, use LibSerial
+* @note the linux implementation uses termios in raw mode with a non-blocking file descriptor. Timed reads are done with poll()
 * @see http://libserial.sourceforge.net/
 *
 * This class is written to mimic the SerialStream.h member functions. Hence, the member functions name are all the same, and not following google style guide
@@ -19,33 +42,74 @@
 * For using Overlapped (Multithread). i.e. non blocking read/write
 * https://www.dreamincode.net/forums/topic/165693-microsoft-working-with-overlapped-io/
 *
+* basics on termios
+* https://www.cmrr.umn.edu/~strupp/serial.html
+*
 * Created by:
 * @author Er Jie Kai (EJK)
  */
 class SerialStream
 {
 private:
+#ifdef __unix__
+	struct termios tio;
+	char device_name[64];
+	int baudrate = BAUD_115200;
+	bool custom_baudrate = false; //the baudrate has no Bxxx constant: it is set with termios2 (see custom_baudrate.hpp)
+	long timeout_us = 100000; //read timeout in microseconds. (-1 = wait forever)
+	int wake_pipe[2]; //interrupt() writes into wake_pipe[1] to wake up a waiting read
+	bool low_latency = false; //see setLowLatency()
+	int latency_timer_ms = 1;
+	int saved_latency_timer = -1; //latency timer of the adapter before setLowLatency(true). -1 = not changed
+	int saved_async_low_latency = -1; //ASYNC_LOW_LATENCY flag of the adapter before setLowLatency(true) (0 or 1). -1 = not changed
+	int read_minimum = 1; //see setReadMinimum()
+
+	int waitReadable(long wait_us);
+	int applySettings();
+	int applyLowLatency();
+	void restoreLowLatency();
+	bool latencyTimerPath(char* path, int len);
+#else
 	DCB dcb;
 	char comport[15];
 	OVERLAPPED ov;
 	bool use_overlapped = false;
+	long timeout_us = -1; //read timeout in microseconds. (-1 = wait forever)
+#endif
 
 public:
+	static const int kAsyncLowLatency = 1;	//setLowLatency(): the ASYNC_LOW_LATENCY flag of the driver is set
+	static const int kLatencyTimerSet = 2;	//setLowLatency(): the USB latency timer of the adapter was written
+
+#ifdef __unix__
+	int fd;
+#else
 	HANDLE SerialStreamHandle;
+#endif
 
 	SerialStream(bool use_overlapped = false);
 	~SerialStream();
+	SerialStream(const SerialStream&) = delete; //owns the port and the wake pipe: a copy would close them twice
+	SerialStream& operator=(const SerialStream&) = delete;
 
 	int Open(const char* device);
 	void Close(void);
 
-	void write(char* buffer, int len); //uses overlapped 
+	void write(char* buffer, int len); //uses overlapped
 	int read(char* buffer); //uses overlapped
-	void read(char* buffer, int len);
+	int read(char* buffer, int len);
+	int readsome(char* buffer, int maxlen);
 	int get(char& buffer); //uses overlapped
 	void configurePort(int baudrate, int charsize, int parity, int stopbit, int flowcontrol);
+	void setTimeout(long timeout_us);
+	int setLowLatency(bool enabled, int latency_timer_ms = 1);
+	int getLatencyTimer();
+	void setReadMinimum(int bytes);
+	int writeUrgent(const char* buffer, int len);
+	void interrupt();
+	void clearInterrupt();
 	bool good();
 	void clear();
 };
 
-#endif /*SERIAL_STREAM_HPP_*/
\ No newline at end of file
+#endif /*SERIAL_STREAM_HPP_*/
@@ -0,0 +1,539 @@
+#include "servo_bus_simulator.hpp"
+
+#ifdef __unix__
+
+#include "herkulex_registers.hpp"
+#include "custom_baudrate.hpp"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <poll.h>
+#include <errno.h>
+#include <termios.h>
+#include <time.h>
+
+/** @brief Get a monotonic timestamp in microseconds
+*
+* @return returns the current monotonic time in microseconds
+*/
+static long long monotonicMicros()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+/** @brief Sleep until an absolute monotonic time
+*
+* @param[in] when_us the time to wake up in microseconds
+*
+* @return returns nothing
+*/
+static void sleepUntil(long long when_us)
+{
+	struct timespec ts;
+	ts.tv_sec = when_us / 1000000LL;
+	ts.tv_nsec = (when_us % 1000000LL) * 1000;
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+	{
+	}
+}
+
+/** @brief Convert a termios speed into bits per second
+*
+* @param[in] speed the termios speed constant
+*
+* @return returns the baudrate, or 0 if unknown (eg: BOTHER, see portBaudrate())
+*/
+static int baudFromSpeed(speed_t speed)
+{
+	switch (speed)
+	{
+	case B9600: return 9600;
+	case B19200: return 19200;
+	case B38400: return 38400;
+	case B57600: return 57600;
+	case B115200: return 115200;
+	case B230400: return 230400;
+	case B460800: return 460800;
+	case B500000: return 500000;
+	case B576000: return 576000;
+	case B921600: return 921600;
+	case B1000000: return 1000000;
+	default: return 0;
+	}
+}
+
+ServoBusSimulator::ServoBusSimulator()
+	: servos(256), running(false), master_fd(-1), baudrate(BusTiming().baudrate), turnaround_us(BusTiming().turnaround_us), drop_one_in(0), bus_free_us(0), wire_baudrate(0), latency_timer_us(0),
+	packet_count(0), reply_count(0), checksum_error_count(0), id_collision_count(0)
+{
+	for (size_t i = 0; i < servos.size(); i++)
+	{
+		memset(&servos[i], 0, sizeof(SimServo));
+	}
+	for (int i = 0; i < kNumCommand; i++)
+		command_count[i] = 0;
+	for (int i = 0; i < kRamSize; i++)
+		last_ram_write[i] = -1;
+}
+
+ServoBusSimulator::~ServoBusSimulator()
+{
+	stop();
+}
+
+/** @brief Add a motor to the bus, with factory default registers and the given id
+*
+* Must be called before start()
+*
+* @param[in] pID id of the motor (0 to 253)
+*
+* @return returns nothing
+*/
+void ServoBusSimulator::addServo(unsigned char pID)
+{
+	if (pID > 253)
+		return;
+	factoryDefaults(servos[pID], pID);
+	bootServo(servos[pID], true);
+}
+
+/** @brief Factory default EEP registers
+*
+* @return returns nothing
+*/
+void ServoBusSimulator::factoryDefaults(SimServo& servo, unsigned char pID)
+{
+	memset(servo.eep, 0, kEepSize);
+	servo.eep[0] = 0x01;	//model number 1 (DRS-0101)
+	servo.eep[1] = 0x01;	//model number 2
+	servo.eep[2] = 0x00;	//version 1
+	servo.eep[3] = 0x01;	//version 2
+	servo.eep[4] = 0x10;	//baudrate 115200
+	servo.eep[6] = pID;		//id
+	servo.eep[7] = 0x01;	//ACK policy: reply to read only
+	servo.eep[8] = 0x7F;	//alarm LED policy
+	servo.eep[9] = 0x35;	//torque policy
+	servo.eep[11] = 0xDF;	//max temperature
+	servo.eep[12] = 0x5B;	//min voltage
+	servo.eep[13] = 0x89;	//max voltage
+	servo.eep[26] = 0x15;	//min position (21)
+	servo.eep[28] = 0xEA;	//max position (1002)
+	servo.eep[29] = 0x03;
+}
+
+/** @brief Power on / REBOOT: RAM registers 0 to 47 are loaded from EEP registers 6 to 53
+*
+* @param[in] reload_eep copy the EEP registers into the RAM registers
+*
+* @return returns nothing
+*/
+void ServoBusSimulator::bootServo(SimServo& servo, bool reload_eep)
+{
+	memset(servo.ram, 0, kRamSize);
+	if (reload_eep)
+		memcpy(servo.ram, servo.eep + 6, 48);
+	servo.baudrate = HerkulexBaudrate::fromCode(servo.eep[4]);
+	servo.ram[54] = 100;	//voltage (7.4V)
+	servo.ram[55] = 40;		//temperature
+	servo.ram[60] = 0x00;	//absolute position 512
+	servo.ram[61] = 0x02;
+	servo.ram[58] = servo.ram[60];
+	servo.ram[59] = servo.ram[61];
+	servo.start_position = 512;
+	servo.goal_position = 512;
+	servo.move_start_us = 0;
+	servo.move_duration_us = 0;
+	servo.ram[0x31] |= 0x02; //in position
+}
+
+/** @brief Open the pseudo-terminal and start answering on it
+*
+* @return returns false if the pty could not be created
+*/
+bool ServoBusSimulator::start()
+{
+	if (running)
+		return true;
+
+	master_fd = posix_openpt(O_RDWR | O_NOCTTY);
+	if (master_fd < 0 || grantpt(master_fd) != 0 || unlockpt(master_fd) != 0)
+	{
+		printf("ServoBusSimulator: could not create pty (errno %d)\n", errno);
+		if (master_fd >= 0)
+			close(master_fd);
+		master_fd = -1;
+		return false;
+	}
+	slave_path = ptsname(master_fd);
+
+	struct termios tio;
+	tcgetattr(master_fd, &tio);
+	cfmakeraw(&tio);
+	tcsetattr(master_fd, TCSANOW, &tio);
+	fcntl(master_fd, F_SETFL, fcntl(master_fd, F_GETFL) | O_NONBLOCK);
+
+	running = true;
+	worker = std::thread(&ServoBusSimulator::run, this);
+	return true;
+}
+
+/** @brief Stop the simulator thread and close the pty
+*
+* @return returns nothing
+*/
+void ServoBusSimulator::stop()
+{
+	if (!running)
+		return;
+
+	running = false;
+	if (worker.joinable())
+		worker.join();
+	close(master_fd);
+	master_fd = -1;
+}
+
+/** @brief A motor only understands the traffic if the port runs at its baudrate. UARTs tolerate a few % of error (eg: 115200 for 2000000 / 17 = 117647)
+*
+* @return returns true if the baudrate of the port matches the motor
+*/
+bool ServoBusSimulator::baudMatches(const SimServo& servo) const
+{
+	if (wire_baudrate == 0 || servo.baudrate == 0)
+		return true; // cannot tell
+	int difference = wire_baudrate > servo.baudrate ? wire_baudrate - servo.baudrate : servo.baudrate - wire_baudrate;
+	return difference * 100LL <= servo.baudrate * 3LL;
+}
+
+/** @brief Get the baudrate the driver set on the port, including the ones set with termios2 (eg: 666666)
+*
+* @return returns the baudrate, or 0 if it cannot be read
+*/
+int ServoBusSimulator::portBaudrate() const
+{
+	struct termios tio;
+	if (tcgetattr(master_fd, &tio) != 0)
+		return 0;
+	int baudrate = baudFromSpeed(cfgetospeed(&tio));
+	return baudrate != 0 ? baudrate : getCustomBaudrate(master_fd);
+}
+
+void ServoBusSimulator::run()
+{
+	unsigned char buffer[1024];
+	int length = 0;
+
+	while (running)
+	{
+		struct pollfd pfd;
+		pfd.fd = master_fd;
+		pfd.events = POLLIN;
+		pfd.revents = 0;
+		if (poll(&pfd, 1, 20) <= 0)
+			continue;
+
+		ssize_t n = read(master_fd, buffer + length, sizeof(buffer) - length);
+		if (n <= 0)
+		{
+			if (pfd.revents & POLLHUP)
+				usleep(1000); // slave not opened yet
+			continue;
+		}
+		length += (int)n;
+		long long arrival_us = monotonicMicros();
+
+		// split the bytes into packets: [0xFF][0xFF][size][pID][cmd][checksum1][checksum2][data ...]
+		int pos = 0;
+		while (length - pos >= 7)
+		{
+			if (buffer[pos] != 0xFF || buffer[pos + 1] != 0xFF || buffer[pos + 2] < 7 || buffer[pos + 2] > 223)
+			{
+				pos++;
+				continue;
+			}
+			int size = buffer[pos + 2];
+			if (length - pos < size)
+				break;
+			handlePacket(buffer + pos, size, arrival_us);
+			pos += size;
+		}
+		memmove(buffer, buffer + pos, length - pos);
+		length -= pos;
+		if (length == (int)sizeof(buffer))
+			length = 0; // garbage
+	}
+}
+
+/** @brief Move the absolute position along the current S_JOG/I_JOG motion
+*
+* @return returns nothing
+*/
+void ServoBusSimulator::updateMotion(SimServo& servo, long long now_us)
+{
+	int position = servo.goal_position;
+	long long elapsed = now_us - servo.move_start_us;
+	bool moving = servo.move_duration_us > 0 && elapsed < servo.move_duration_us;
+	if (moving)
+		position = servo.start_position + (int)((servo.goal_position - servo.start_position) * elapsed / servo.move_duration_us);
+
+	int previous = servo.ram[60] | (servo.ram[61] << 8);
+	short velocity = (short)(position - previous);
+	servo.ram[60] = position & 0xFF;
+	servo.ram[61] = (position >> 8) & 0xFF;
+	servo.ram[58] = servo.ram[60];
+	servo.ram[59] = servo.ram[61];
+	servo.ram[62] = velocity & 0xFF;
+	servo.ram[63] = (velocity >> 8) & 0xFF;
+
+	unsigned char& detail = servo.ram[49];
+	detail &= ~0x03;
+	detail |= moving ? 0x01 : 0x02;
+	if (servo.ram[52] == 0x60)
+		detail |= 0x40;
+	else
+		detail &= ~0x40;
+}
+
+/** @brief Start a S_JOG/I_JOG motion
+*
+* SET byte: bit 0 = stop, bit 1 = mode, bit 2 to 4 = LED, bit 5 = jog invalid
+*
+* @return returns nothing
+*/
+void ServoBusSimulator::startMove(SimServo& servo, int goal, int playtime_ticks, unsigned char set, long long now_us)
+{
+	servo.ram[53] = (set >> 2) & 0x07;
+	if (set & 0x20) //jog invalid
+		return;
+	if (servo.ram[52] != 0x60) //torque must be on
+		return;
+
+	updateMotion(servo, now_us);
+	servo.ram[56] = (set >> 1) & 0x01;
+	servo.start_position = servo.ram[60] | (servo.ram[61] << 8);
+	servo.goal_position = goal & 0x7FFF;
+	servo.move_start_us = now_us;
+	servo.move_duration_us = (long long)playtime_ticks * 11200; //every tick = 11.2ms
+	servo.ram[68] = goal & 0xFF;
+	servo.ram[69] = (goal >> 8) & 0xFF;
+}
+
+void ServoBusSimulator::handlePacket(const unsigned char* packet, int size, long long arrival_us)
+{
+	packet_count++;
+	wire_baudrate = portBaudrate();
+
+	unsigned char pID = packet[3];
+	unsigned char cmd = packet[4];
+	const unsigned char* data = packet + 7;
+	int datalen = size - 7;
+
+	unsigned char checksum1 = (unsigned char)size ^ pID ^ cmd;
+	for (int i = 0; i < datalen; i++)
+		checksum1 ^= data[i];
+	checksum1 &= 0xFE;
+	bool checksum_ok = packet[5] == checksum1 && packet[6] == ((~checksum1) & 0xFE);
+	if (!checksum_ok)
+	{
+		checksum_error_count++;
+		if (pID < 254 && servos[pID].eep[0] != 0)
+		{
+			servos[pID].ram[48] |= 0x08; //invalid packet
+			servos[pID].ram[49] |= 0x04; //checksum error
+		}
+		return;
+	}
+	if (cmd < kNumCommand)
+		command_count[cmd]++;
+	if (cmd == 0x03 && datalen >= 2 && data[0] + data[1] <= kRamSize && datalen == 2 + data[1])
+	{
+		for (int i = 0; i < data[1]; i++)
+			last_ram_write[data[0] + i] = data[2 + i];
+	}
+
+	// S_JOG and I_JOG carry their own ids for every entry
+	if (cmd == 0x06 || cmd == 0x05)
+	{
+		int entry_size = (cmd == 0x06) ? 4 : 5;
+		int offset = (cmd == 0x06) ? 1 : 0;
+		for (int i = offset; i + entry_size <= datalen; i += entry_size)
+		{
+			unsigned char id = data[i + 3];
+			if (id > 253 || servos[id].eep[0] == 0 || !baudMatches(servos[id]))
+				continue;
+			int playtime = (cmd == 0x06) ? data[0] : data[i + 4];
+			startMove(servos[id], data[i] | (data[i + 1] << 8), playtime, data[i + 2], arrival_us);
+		}
+		return;
+	}
+
+	for (int id = 0; id < 254; id++)
+	{
+		if (servos[id].eep[0] == 0 || (pID != id && pID != 0xFE))
+			continue;
+
+		SimServo& servo = servos[id];
+		if (!baudMatches(servo))
+			continue;
+		updateMotion(servo, arrival_us);
+
+		unsigned char reply_data[2 + kRamSize + 2];
+		int reply_len = 0;
+		bool is_read = false;
+
+		switch (cmd)
+		{
+		case 0x01: //EEP_WRITE
+		case 0x03: //RAM_WRITE
+		{
+			unsigned char* regs = (cmd == 0x01) ? servo.eep : servo.ram;
+			int regs_size = (cmd == 0x01) ? kEepSize : kRamSize;
+			if (datalen < 2 || data[0] + data[1] > regs_size || datalen != 2 + data[1])
+			{
+				servo.ram[48] |= 0x08;
+				servo.ram[49] |= 0x10; //exceed register range
+				break;
+			}
+			memcpy(regs + data[0], data + 2, data[1]);
+			if (cmd == 0x03 && data[0] == 0 && servo.ram[0] != id && servo.ram[0] < 254 && moveServo(id, servo.ram[0]))
+				continue; // RAM id changed: the motor now answers to the new id
+			break;
+		}
+		case 0x02: //EEP_READ
+		case 0x04: //RAM_READ
+		{
+			is_read = true;
+			const unsigned char* regs = (cmd == 0x02) ? servo.eep : servo.ram;
+			int regs_size = (cmd == 0x02) ? kEepSize : kRamSize;
+			if (datalen != 2 || data[0] + data[1] > regs_size)
+			{
+				servo.ram[48] |= 0x08;
+				servo.ram[49] |= 0x10; //exceed register range
+				reply_data[0] = datalen > 0 ? data[0] : 0;
+				reply_data[1] = 0;
+				reply_len = 2;
+				break;
+			}
+			reply_data[0] = data[0];
+			reply_data[1] = data[1];
+			memcpy(reply_data + 2, regs + data[0], data[1]);
+			reply_len = 2 + data[1];
+			break;
+		}
+		case 0x07: //STAT
+			is_read = true;
+			break;
+		case 0x08: //ROLLBACK
+		{
+			unsigned char keep_id = servo.eep[6];
+			unsigned char keep_baud = servo.eep[4];
+			factoryDefaults(servo, id);
+			servo.eep[6] = (datalen >= 1 && data[0]) ? keep_id : 0xDB; //factory id is 219
+			servo.eep[4] = (datalen >= 2 && data[1]) ? keep_baud : 0x10;
+			break;
+		}
+		case 0x09: //REBOOT
+			bootServo(servo, true);
+			if (servo.ram[0] != id && servo.ram[0] < 254 && moveServo(id, servo.ram[0]))
+				continue; // booted with the id from EEP
+			break;
+		default:
+			servo.ram[48] |= 0x08;
+			servo.ram[49] |= 0x08; //unknown command
+			break;
+		}
+
+		// ACK policy (RAM 1): 0 = never reply, 1 = reply to read and STAT, 2 = reply to all. no reply to the broadcast id
+		unsigned char policy = servo.ram[1];
+		if (pID == 0xFE || policy == 0 || (policy == 1 && !is_read))
+			continue;
+
+		reply_data[reply_len++] = servo.ram[48];
+		reply_data[reply_len++] = servo.ram[49];
+		reply(servo, cmd | 0x40, reply_data, reply_len, size, arrival_us);
+	}
+}
+
+/** @brief Give a motor a new id
+*
+* Two motors with the same id would both answer and garble each other on a real bus. The simulator cannot hold two motors at one id,
+* so the motor keeps its old id and the collision is counted (see idCollisionCount()). eg: a broadcast RAM id write moves one motor only
+*
+* @param[in] id current id of the motor
+* @param[in] new_id the id it was given
+*
+* @return returns false if new_id is already used by another motor
+*/
+bool ServoBusSimulator::moveServo(int id, int new_id)
+{
+	if (servos[new_id].eep[0] != 0)
+	{
+		id_collision_count++;
+		printf("ServoBusSimulator: id %d is already used, motor %d keeps its id\n", new_id, id);
+		servos[id].ram[0] = (unsigned char)id;
+		return false;
+	}
+	servos[new_id] = servos[id];
+	memset(&servos[id], 0, sizeof(SimServo));
+	return true;
+}
+
+/** @brief Send an ACK packet after the modeled bus delay
+*
+* @return returns nothing
+*/
+void ServoBusSimulator::reply(SimServo& servo, unsigned char cmd, const unsigned char* data, int datalen, int request_size, long long arrival_us)
+{
+	int one_in = drop_one_in;
+	if (one_in > 0 && (rand() % one_in) == 0)
+		return;
+
+	unsigned char packet[256];
+	int size = 7 + datalen;
+	packet[0] = 0xFF;
+	packet[1] = 0xFF;
+	packet[2] = (unsigned char)size;
+	packet[3] = servo.ram[0];
+	packet[4] = cmd;
+	unsigned char checksum1 = (unsigned char)size ^ packet[3] ^ cmd;
+	for (int i = 0; i < datalen; i++)
+	{
+		packet[7 + i] = data[i];
+		checksum1 ^= data[i];
+	}
+	checksum1 &= 0xFE;
+	packet[5] = checksum1;
+	packet[6] = (~checksum1) & 0xFE;
+
+	// the request ends on the wire after its own transfer time, the reply starts after the turnaround and arrives after its transfer time
+	BusTiming timing(wire_baudrate != 0 ? wire_baudrate : baudrate.load(), turnaround_us);
+	long long request_end = (arrival_us > bus_free_us ? arrival_us : bus_free_us) + timing.wireTime(request_size);
+	long long reply_end = request_end + timing.turnaround_us + timing.wireTime(size);
+	bus_free_us = reply_end;
+
+	// the adapter only passes the bytes to the host when its latency timer expires, unless the reply is longer than the timer
+	long long delivery = reply_end;
+	long long latency_us = latency_timer_us;
+	long long latency_end = request_end + timing.turnaround_us + timing.wireTime(1) + latency_us;
+	if (latency_us > 0 && latency_end > delivery)
+		delivery = latency_end;
+	sleepUntil(delivery);
+
+	reply_count++; // before the write: the driver can handle the reply before the write returns
+	int written = 0;
+	while (written < size && running)
+	{
+		ssize_t n = write(master_fd, packet + written, size - written);
+		if (n > 0)
+			written += (int)n;
+		else
+			usleep(100);
+	}
+}
+
+#endif
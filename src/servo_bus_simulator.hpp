@@ -0,0 +1,107 @@
+#ifndef SERVO_BUS_SIMULATOR_HPP_
+#define SERVO_BUS_SIMULATOR_HPP_
+
+#ifdef __unix__
+
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <string>
+#include "bus_timing.hpp"
+
+/** Emulates a bus of herkulex motors behind a pseudo-terminal
+*
+* The simulator opens a pty pair and answers on the master side. HerkulexDriver opens slavePath() exactly like a real usb serial adapter,
+* so the driver can be tested and benchmarked without any motor.
+*
+* Every simulated motor has full RAM and EEP register files and answers EEP_WRITE, EEP_READ, RAM_WRITE, RAM_READ, I_JOG, S_JOG, STAT, ROLLBACK and REBOOT
+* with valid checksums, following its ACK policy (RAM register 1). S_JOG/I_JOG move the absolute position linearly to the goal over the playtime.
+*
+* Bus timing is modeled with BusTiming: every request and reply takes (bytes X 10 bits / baudrate) on the wire, and every reply starts turnaround_us after the end of its request.
+* The baudrate is the one the driver sets on the port (setBaudrate() is only used if it cannot be read). \n
+The USB adapter can be modeled too: with setLatencyTimer(), a reply is held until the latency timer expires after its first byte, like an FTDI adapter. \n
+* Traffic is ignored while the baudrate of the port does not match (within 3%) the baudrate the motor loaded from EEP register 4 at its last boot.
+*
+* @note linux only (uses posix_openpt)
+*
+* Created by:
+* @author Er Jie Kai (EJK)
+ */
+class ServoBusSimulator
+{
+public:
+	static const int kRamSize = 80;
+	static const int kEepSize = 64;
+	static const int kNumCommand = 16; //commands are 0x01 to 0x09
+
+	ServoBusSimulator();
+	~ServoBusSimulator();
+
+	void addServo(unsigned char pID);
+	bool start();
+	void stop();
+
+	const char* slavePath() const { return slave_path.c_str(); }
+	void setBaudrate(int baudrate) { this->baudrate = baudrate; }
+	void setTurnaround(long turnaround_us) { this->turnaround_us = turnaround_us; }
+	BusTiming getTiming() const { return BusTiming(baudrate, turnaround_us); }
+	void setDropRate(int one_in_n) { drop_one_in = one_in_n; }
+	void setLatencyTimer(int latency_timer_ms) { latency_timer_us = latency_timer_ms * 1000LL; }
+
+	unsigned int packetCount() const { return packet_count; }
+	unsigned int replyCount() const { return reply_count; }
+	unsigned int checksumErrorCount() const { return checksum_error_count; }
+	unsigned int idCollisionCount() const { return id_collision_count; }
+	unsigned int commandCount(unsigned char cmd) const { return cmd < kNumCommand ? command_count[cmd].load() : 0; } //valid packets received with this command
+	int lastRamWrite(int address) const { return address >= 0 && address < kRamSize ? last_ram_write[address].load() : -1; } //value of the last RAM_WRITE of a register, to any id (-1 = never written)
+
+private:
+	struct SimServo
+	{
+		unsigned char ram[kRamSize];
+		unsigned char eep[kEepSize];
+		int baudrate; //baudrate loaded from EEP register 4 at boot
+
+		// motion toward the goal position
+		int start_position;
+		int goal_position;
+		long long move_start_us;
+		long long move_duration_us;
+	};
+
+	std::vector<SimServo> servos;
+	std::thread worker;
+	std::atomic<bool> running;
+	int master_fd;
+	std::string slave_path;
+
+	// settings, read by the worker thread while it runs
+	std::atomic<int> baudrate; //baudrate of the bus when the one of the port cannot be read
+	std::atomic<long> turnaround_us; //delay from the end of a request to the start of its reply
+	std::atomic<int> drop_one_in; //drop one reply every n replies (0 = never)
+	long long bus_free_us; //time the simulated bus is free again
+	int wire_baudrate; //baudrate of the port when the packet being handled arrived (0 = unknown)
+	std::atomic<long long> latency_timer_us; //USB latency timer of the simulated adapter (0 = replies are delivered as soon as they are on the wire)
+
+	std::atomic<unsigned int> packet_count;
+	std::atomic<unsigned int> reply_count;
+	std::atomic<unsigned int> checksum_error_count;
+	std::atomic<unsigned int> id_collision_count; //id changes rejected because the new id was already used
+	std::atomic<unsigned int> command_count[kNumCommand];
+	std::atomic<int> last_ram_write[kRamSize];
+
+	void run();
+	void handlePacket(const unsigned char* packet, int size, long long arrival_us);
+	void reply(SimServo& servo, unsigned char cmd, const unsigned char* data, int datalen, int request_size, long long arrival_us);
+	void bootServo(SimServo& servo, bool reload_eep);
+	bool moveServo(int id, int new_id);
+	void factoryDefaults(SimServo& servo, unsigned char pID);
+	void updateMotion(SimServo& servo, long long now_us);
+	void startMove(SimServo& servo, int goal, int playtime_ticks, unsigned char set, long long now_us);
+	bool baudMatches(const SimServo& servo) const;
+	int portBaudrate() const;
+};
+
+#endif
+
+#endif /*SERVO_BUS_SIMULATOR_HPP_*/
@@ -0,0 +1,288 @@
+#include "servo_network.hpp"
+#include <iostream>
+#include <new>
+#include <thread>
+
+/** @brief Create a network without any bus */
+ServoNetwork::ServoNetwork()
+{
+	for (int i = 0; i < HerkulexDriver::kNumServo; i++)
+	{
+		route[i] = kNoBus;
+		bus_position[i] = 0;
+	}
+	for (int b = 0; b < kMaxBus; b++)
+	{
+		bus_size[b] = 0;
+		gathered.bus_cycle[b] = -1;
+	}
+}
+
+ServoNetwork::~ServoNetwork()
+{
+	stop(); // the buses are destroyed after, with the members
+}
+
+/** @brief Open one more bus. Must be called before start()
+*
+* @param[in] valid_com_name the serial port of the bus, as for HerkulexDriver
+*
+* @return returns the index of the bus, or -1 if kMaxBus buses are already open
+*/
+int ServoNetwork::addBus(std::string valid_com_name)
+{
+	if (num_bus >= kMaxBus)
+		return -1;
+	buses[num_bus].reset(new (bus_storage[num_bus]) BusIoThread(valid_com_name));
+	return num_bus++;
+}
+
+/** @brief Route a motor to a bus. Its telemetry is read every cycle of that bus. Must be called before start()
+*
+* @param[in] pID id of the motor (unique across the buses)
+* @param[in] bus index of the bus, as returned by addBus()
+*
+* @return returns false if the id is already on another bus, or the bus already has BusSnapshot::kMaxServo motors
+*/
+bool ServoNetwork::addServo(char pID, int bus)
+{
+	unsigned char id = (unsigned char)pID;
+	if (id >= HerkulexDriver::kNumServo || bus < 0 || bus >= num_bus)
+		return false;
+	if (route[id] == bus)
+		return true;
+	if (route[id] != kNoBus)
+	{
+		std::cerr << "[" << __FILE__ << ":" << __LINE__ << "] "
+			<< "Error: motor " << (int)id << " is on bus " << (int)route[id] << " and on bus " << bus
+			<< std::endl;
+		return false;
+	}
+	if (bus_size[bus] >= BusSnapshot::kMaxServo || num_servo >= NetworkSnapshot::kMaxServo)
+		return false;
+
+	route[id] = (signed char)bus;
+	bus_position[id] = (unsigned char)bus_size[bus]++;
+	servos[num_servo++] = pID;
+	return true;
+}
+
+/** @brief Scan all the buses at the same time (see HerkulexDriver::scanBus) and route every motor found. Must be called before start()
+*
+* @param[in] timing baudrate and turnaround of the buses
+*
+* @return returns the number of motors routed
+*/
+int ServoNetwork::discover(const BusTiming& timing)
+{
+	ScanResult found[kMaxBus][HerkulexDriver::kNumServo];
+	int num_found[kMaxBus] = { 0 };
+	std::thread scans[kMaxBus];
+	for (int b = 0; b < num_bus; b++)
+		scans[b] = std::thread([&, b]() { num_found[b] = buses[b]->driver().scanBus(found[b], HerkulexDriver::kNumServo, timing); });
+	for (int b = 0; b < num_bus; b++)
+		scans[b].join();
+
+	int num_routed = 0;
+	for (int b = 0; b < num_bus; b++)
+	{
+		for (int i = 0; i < num_found[b]; i++)
+		{
+			if (addServo(found[b][i].pID, b))
+				num_routed++;
+		}
+	}
+	return num_routed;
+}
+
+/** @brief Get the bus of a motor
+*
+* @return returns the index of the bus, or kNoBus if the motor was not routed
+*/
+int ServoNetwork::busOf(char pID) const
+{
+	unsigned char id = (unsigned char)pID;
+	return id < HerkulexDriver::kNumServo ? route[id] : kNoBus;
+}
+
+/** @brief Start the I/O thread of every bus
+*
+* @param[in] period_ns period of the I/O cycles in nanoseconds. Should be longer than the time to read the telemetry of the busiest bus
+*
+* @return returns nothing
+*/
+void ServoNetwork::start(long long period_ns)
+{
+	for (int b = 0; b < num_bus; b++)
+	{
+		char pIDs[BusSnapshot::kMaxServo];
+		for (int i = 0; i < num_servo; i++)
+		{
+			unsigned char id = (unsigned char)servos[i];
+			if (route[id] == b)
+				pIDs[bus_position[id]] = servos[i];
+		}
+		buses[b]->setPolledServos(pIDs, bus_size[b]);
+		buses[b]->start(period_ns);
+	}
+}
+
+/** @brief Stop the I/O thread of every bus
+*
+* @return returns nothing
+*/
+void ServoNetwork::stop()
+{
+	for (int b = 0; b < num_bus; b++)
+		buses[b]->stop();
+}
+
+// splits the entries per bus, and queues one S_JOG/I_JOG per bus
+bool ServoNetwork::pushJog(bool individual, const S_JOG_TAG* entries, char num_entries)
+{
+	S_JOG_TAG per_bus[kMaxBus][BusCommand::kMaxJog];
+	char count[kMaxBus] = { 0 };
+	bool ok = true;
+	for (int i = 0; i < num_entries; i++)
+	{
+		int b = busOf(entries[i].pID);
+		if (b == kNoBus || count[b] >= BusCommand::kMaxJog)
+		{
+			ok = false;
+			continue;
+		}
+		per_bus[b][(int)count[b]++] = entries[i];
+	}
+
+	for (int b = 0; b < num_bus; b++)
+	{
+		if (count[b] == 0)
+			continue;
+		if (!(individual ? buses[b]->runMotorIndividual(per_bus[b], count[b]) : buses[b]->runMotor(per_bus[b], count[b])))
+			ok = false;
+	}
+	return ok;
+}
+
+/** @brief Queue a S_JOG on every bus that has some of the motors. See HerkulexDriver::runMotor
+*
+* @return returns false if a motor is not routed, or a command could not be queued
+*/
+bool ServoNetwork::runMotor(const S_JOG_TAG* sjog, char num_sjog)
+{
+	return pushJog(false, sjog, num_sjog);
+}
+
+/** @brief Queue a I_JOG on every bus that has some of the motors. See HerkulexDriver::runMotorIndividual
+*
+* @return returns false if a motor is not routed, or a command could not be queued
+*/
+bool ServoNetwork::runMotorIndividual(const S_JOG_TAG* ijog, char num_ijog)
+{
+	return pushJog(true, ijog, num_ijog);
+}
+
+/** @brief Queue a torque control write on the bus of the motor. See HerkulexDriver::setTorqueControl
+*
+* @return returns false if the motor is not routed, or the command could not be queued
+*/
+bool ServoNetwork::setTorqueControl(char pID, int mode)
+{
+	int b = busOf(pID);
+	return b != kNoBus && buses[b]->setTorqueControl(pID, mode);
+}
+
+/** @brief Queue a LED write on the bus of the motor. See HerkulexDriver::setLEDColour
+*
+* @return returns false if the motor is not routed, or the command could not be queued
+*/
+bool ServoNetwork::setLEDColour(char pID, LEDColour colour)
+{
+	int b = busOf(pID);
+	return b != kNoBus && buses[b]->setLEDColour(pID, colour);
+}
+
+/** @brief Queue a control mode write on the bus of the motor. See HerkulexDriver::setControlMode
+*
+* @return returns false if the motor is not routed, or the command could not be queued
+*/
+bool ServoNetwork::setControlMode(char pID, int controlmode)
+{
+	int b = busOf(pID);
+	return b != kNoBus && buses[b]->setControlMode(pID, controlmode);
+}
+
+/** @brief Queue a status error clear on the bus of the motor. See HerkulexDriver::clearError
+*
+* @return returns false if the motor is not routed, or the command could not be queued
+*/
+bool ServoNetwork::clearError(char pID)
+{
+	int b = busOf(pID);
+	return b != kNoBus && buses[b]->clearError(pID);
+}
+
+/** @brief Gather the latest snapshot of every bus. Wait-free
+*
+* The buses run their cycles independently, so the entries of different buses can come from slightly different times (see bus_cycle and timestamp_us).
+*
+* @return returns the gathered telemetry. It stays valid until the next call
+*/
+const NetworkSnapshot& ServoNetwork::snapshot()
+{
+	const BusSnapshot* latest[kMaxBus];
+	gathered.timestamp_us = 0;
+	for (int b = 0; b < num_bus; b++)
+	{
+		latest[b] = &buses[b]->snapshot();
+		gathered.bus_cycle[b] = latest[b]->cycle;
+		if (b == 0 || latest[b]->timestamp_us < gathered.timestamp_us)
+			gathered.timestamp_us = latest[b]->timestamp_us;
+	}
+
+	for (int i = 0; i < num_servo; i++)
+	{
+		unsigned char id = (unsigned char)servos[i];
+		const BusSnapshot& s = *latest[route[id]];
+		gathered.bus[i] = route[id];
+		if (bus_position[id] < s.num_servo)
+			gathered.telemetry[i] = s.telemetry[bus_position[id]];
+		else
+			gathered.telemetry[i] = ServoTelemetry(); // no cycle done yet
+	}
+	gathered.num_servo = num_servo;
+	return gathered;
+}
+
+/** @brief Read the latest state of one motor from the state table of its bus. Lock-free, from any thread
+*
+* @param[in] pID id of the motor
+* @param[out] telemetry the state of the motor
+* @param[out] timestamp_us monotonic time of the read in microseconds (optional)
+*
+* @return returns false if the motor is not routed or was never read
+*/
+bool ServoNetwork::read(char pID, ServoTelemetry& telemetry, long long* timestamp_us) const
+{
+	int b = busOf(pID);
+	return b != kNoBus && buses[b]->stateTable().read(pID, telemetry, timestamp_us);
+}
+
+/** @brief Stop every motor of every bus. From any thread or signal handler. See HerkulexDriver::emergencyStop
+*
+* @return returns nothing
+*/
+void ServoNetwork::emergencyStop(bool brake)
+{
+	for (int b = 0; b < num_bus; b++)
+		buses[b]->emergencyStop(brake);
+}
+
+/** @brief number of commands dropped because the queue of their bus was full */
+unsigned int ServoNetwork::droppedCommandCount() const
+{
+	unsigned int dropped = 0;
+	for (int b = 0; b < num_bus; b++)
+		dropped += buses[b]->droppedCommandCount();
+	return dropped;
+}
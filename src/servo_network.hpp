@@ -0,0 +1,103 @@
+#ifndef SERVO_NETWORK_HPP_
+#define SERVO_NETWORK_HPP_
+
+#include <memory>
+#include <string>
+#include "bus_io_thread.hpp"
+
+/** Telemetry of all the motors of a ServoNetwork, gathered from the latest snapshot of every bus
+* @param[out] bus_cycle the I/O cycle of the snapshot of every bus (-1 = no cycle done yet)
+* @param[out] timestamp_us monotonic time of the oldest bus snapshot in microseconds
+* @param[out] num_servo number of entries in telemetry
+* @param[out] telemetry one entry per motor, in the order given to ServoNetwork::addServo
+* @param[out] bus the bus of every entry
+*/
+struct NetworkSnapshot
+{
+	static const int kMaxBus = 4;
+	static const int kMaxServo = kMaxBus * BusSnapshot::kMaxServo;
+
+	long long bus_cycle[kMaxBus];
+	long long timestamp_us = 0;
+	int num_servo = 0;
+	ServoTelemetry telemetry[kMaxServo];
+	int bus[kMaxServo];
+};
+
+/** Several herkulex buses (one serial adapter each) behind one interface
+*
+* Every bus has its own BusIoThread, so the buses transfer in parallel and the telemetry rate grows with the number of adapters. \n
+* A routing table maps every motor id to its bus. Commands are split per bus and queued to the I/O thread of every bus concerned (eg: one S_JOG
+* for 12 motors on 2 buses becomes one S_JOG per bus, sent in the same cycle), and snapshot() gathers the latest telemetry of all the buses. \n
+* The routing table is filled by addServo(), or by discover() which scans all the buses at the same time.
+*
+* @note motor ids must be unique across the buses. The thread and usage rules of BusIoThread apply: one thread sends commands, one thread calls snapshot()
+*
+* Usage: \n
+* ServoNetwork network; \n
+* network.addBus("/dev/ttyUSB0"); \n
+* network.addBus("/dev/ttyUSB1"); \n
+* network.discover(BusTiming(115200, 100)); \n
+* network.start(5000000); // 200 Hz \n
+* network.runMotor(sjog, 12); \n
+* const NetworkSnapshot& s = network.snapshot();
+*
+* Created by:
+* @author Er Jie Kai (EJK)
+ */
+class ServoNetwork
+{
+public:
+	static const int kMaxBus = NetworkSnapshot::kMaxBus;
+	static const int kNoBus = -1;
+
+	ServoNetwork();
+	~ServoNetwork();
+	ServoNetwork(const ServoNetwork&) = delete; //owns the I/O threads and serial ports of the buses
+	ServoNetwork& operator=(const ServoNetwork&) = delete;
+
+	int addBus(std::string valid_com_name);
+	bool addServo(char pID, int bus);
+	int discover(const BusTiming& timing);
+
+	int numBus() const { return num_bus; }
+	int busOf(char pID) const;
+	BusIoThread& bus(int index) { return *buses[index]; }
+
+	void start(long long period_ns);
+	void stop();
+
+	bool runMotor(const S_JOG_TAG* sjog, char num_sjog);
+	bool runMotorIndividual(const S_JOG_TAG* ijog, char num_ijog);
+	bool setTorqueControl(char pID, int mode);
+	bool setLEDColour(char pID, LEDColour colour);
+	bool setControlMode(char pID, int controlmode);
+	bool clearError(char pID);
+
+	const NetworkSnapshot& snapshot();
+	bool read(char pID, ServoTelemetry& telemetry, long long* timestamp_us = nullptr) const;
+	void emergencyStop(bool brake = false);
+	unsigned int droppedCommandCount() const;
+
+private:
+	// destroys a BusIoThread built in bus_storage, without freeing the storage
+	struct DestroyInPlace
+	{
+		void operator()(BusIoThread* bus) const { bus->~BusIoThread(); }
+	};
+	alignas(BusIoThread) unsigned char bus_storage[kMaxBus][sizeof(BusIoThread)]; //the BusIoThread objects, built in place by addBus() (new does not guarantee their 64 byte alignment in C++11)
+	std::unique_ptr<BusIoThread, DestroyInPlace> buses[kMaxBus];
+	int num_bus = 0;
+
+	signed char route[HerkulexDriver::kNumServo]; //bus of every id (kNoBus = unknown)
+	unsigned char bus_position[HerkulexDriver::kNumServo]; //index of every id in the snapshot of its bus
+	int bus_size[kMaxBus]; //number of motors on every bus
+	char servos[NetworkSnapshot::kMaxServo]; //all the routed ids, in the order they were added
+	int num_servo = 0;
+
+	NetworkSnapshot gathered;
+
+	bool pushJog(bool individual, const S_JOG_TAG* entries, char num_entries);
+};
+
+#endif /*SERVO_NETWORK_HPP_*/
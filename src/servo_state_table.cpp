@@ -0,0 +1,177 @@
+#include "servo_state_table.hpp"
+#include <cmath>
+#include <cstring>
+#include <thread>
+
+ServoStateTable::ServoStateTable()
+	: sequence(0)
+{
+	memset(&fields, 0, sizeof(fields));
+	for (int i = 0; i < kNumServo; i++)
+		fields.timestamp_us[i] = -1;
+}
+
+/** @brief Start writing a cycle. Readers that overlap with the write will retry
+*
+* @return returns nothing
+*/
+void ServoStateTable::beginWrite()
+{
+	sequence.store(sequence.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release); // the odd sequence is visible before any value changes
+}
+
+/** @brief Store the telemetry of one motor. Only between beginWrite() and endWrite()
+*
+* @param[in] telemetry the telemetry. Ignored if not valid
+* @param[in] timestamp_us monotonic time of the read in microseconds
+*
+* @return returns nothing
+*/
+void ServoStateTable::set(const ServoTelemetry& telemetry, long long timestamp_us)
+{
+	unsigned char i = (unsigned char)telemetry.pID;
+	if (!telemetry.valid || i >= kNumServo)
+		return;
+	fields.timestamp_us[i] = timestamp_us;
+	fields.status_error[i] = telemetry.status_error;
+	fields.status_detail[i] = telemetry.status_detail;
+	fields.torque_control[i] = telemetry.torque_control;
+	fields.led[i] = telemetry.led;
+	fields.voltage[i] = telemetry.voltage;
+	fields.temperature[i] = telemetry.temperature;
+	fields.control_mode[i] = telemetry.control_mode;
+	fields.tick[i] = telemetry.tick;
+	fields.calibrated_position[i] = telemetry.calibrated_position;
+	fields.absolute_position[i] = telemetry.absolute_position;
+	fields.differential_position[i] = telemetry.differential_position;
+	fields.pwm[i] = telemetry.pwm;
+	fields.rtt_us[i] = telemetry.rtt_us;
+}
+
+/** @brief Finish writing a cycle and make it visible to the readers
+*
+* @return returns nothing
+*/
+void ServoStateTable::endWrite()
+{
+	sequence.fetch_add(1, std::memory_order_release);
+}
+
+/** @brief Write the telemetry of one cycle
+*
+* @param[in] telemetry the telemetry of the motors
+* @param[in] num_servo number of entries in telemetry
+* @param[in] timestamp_us monotonic time of the reads in microseconds
+*
+* @return returns nothing
+*/
+void ServoStateTable::publish(const ServoTelemetry* telemetry, int num_servo, long long timestamp_us)
+{
+	beginWrite();
+	for (int i = 0; i < num_servo; i++)
+		set(telemetry[i], timestamp_us);
+	endWrite();
+}
+
+unsigned int ServoStateTable::readBegin() const
+{
+	unsigned int start = sequence.load(std::memory_order_acquire);
+	while (start & 1)
+	{
+		std::this_thread::yield(); // the writer is in the middle of a cycle
+		start = sequence.load(std::memory_order_acquire);
+	}
+	return start;
+}
+
+bool ServoStateTable::readRetry(unsigned int start) const
+{
+	std::atomic_thread_fence(std::memory_order_acquire); // the values are read before the sequence is checked again
+	return sequence.load(std::memory_order_relaxed) != start;
+}
+
+/** @brief Get the latest state of one motor. Lock-free, no bus traffic
+*
+* @param[in] pID id of the motor
+* @param[out] telemetry the state of the motor. telemetry.valid is false if the motor was never read
+* @param[out] timestamp_us monotonic time of the read in microseconds (optional)
+*
+* @return returns true if the motor was read at least once
+*/
+bool ServoStateTable::read(char pID, ServoTelemetry& telemetry, long long* timestamp_us) const
+{
+	unsigned char i = (unsigned char)pID;
+	telemetry = ServoTelemetry();
+	telemetry.pID = pID;
+	if (i >= kNumServo)
+		return false;
+
+	long long timestamp;
+	unsigned int start;
+	do
+	{
+		start = readBegin();
+		timestamp = fields.timestamp_us[i];
+		telemetry.status_error = fields.status_error[i];
+		telemetry.status_detail = fields.status_detail[i];
+		telemetry.torque_control = fields.torque_control[i];
+		telemetry.led = fields.led[i];
+		telemetry.voltage = fields.voltage[i];
+		telemetry.temperature = fields.temperature[i];
+		telemetry.control_mode = fields.control_mode[i];
+		telemetry.tick = fields.tick[i];
+		telemetry.calibrated_position = fields.calibrated_position[i];
+		telemetry.absolute_position = fields.absolute_position[i];
+		telemetry.differential_position = fields.differential_position[i];
+		telemetry.pwm = fields.pwm[i];
+		telemetry.rtt_us = fields.rtt_us[i];
+	} while (readRetry(start));
+
+	telemetry.valid = timestamp >= 0;
+	if (timestamp_us != nullptr)
+		*timestamp_us = timestamp;
+	return telemetry.valid;
+}
+
+/** @brief Get the latest absolute angle of one motor. Lock-free, no bus traffic
+*
+* @param[in] pID id of the motor
+*
+* @return returns the angle in degrees, or NAN if the motor was never read
+*/
+float ServoStateTable::getAbsoluteAngle(char pID) const
+{
+	unsigned char i = (unsigned char)pID;
+	if (i >= kNumServo)
+		return NAN;
+
+	long long timestamp;
+	unsigned short position;
+	unsigned int start;
+	do
+	{
+		start = readBegin();
+		timestamp = fields.timestamp_us[i];
+		position = fields.absolute_position[i];
+	} while (readRetry(start));
+
+	return timestamp >= 0 ? RegAbsolutePosition::toUnits(position) : NAN;
+}
+
+/** @brief Copy the state of all the motors, all from the same cycle
+*
+* @param[out] output the copy
+*
+* @return returns the version() of the copy
+*/
+unsigned int ServoStateTable::snapshot(Fields& output) const
+{
+	unsigned int start;
+	do
+	{
+		start = readBegin();
+		memcpy(&output, &fields, sizeof(fields));
+	} while (readRetry(start));
+	return start / 2;
+}
@@ -0,0 +1,66 @@
+#ifndef SERVO_STATE_TABLE_HPP_
+#define SERVO_STATE_TABLE_HPP_
+
+#include <atomic>
+#include "herkulex_driver.hpp"
+
+/** Latest state of every motor, shared between one writer and any number of reader threads
+*
+* The bus owner (eg: BusIoThread) writes the telemetry it read once per cycle, between beginWrite() and endWrite(). \n
+* Readers never lock and never touch the bus: read() and snapshot() copy the values and retry if the writer was in the middle of a cycle (seqlock).
+* A reader always gets the values of one whole cycle, never a mix of two cycles. \n
+* The values are stored as one array per field (struct of arrays), each array on its own cache lines,
+* so a reader scanning one field (eg: all the positions) only touches the cache lines of that field.
+*
+* @note only one thread may write
+*
+* Created by:
+* @author Er Jie Kai (EJK)
+ */
+class ServoStateTable
+{
+public:
+	static const int kNumServo = 254;
+
+	/** The stored state, indexed by pID */
+	struct Fields
+	{
+		alignas(64) long long timestamp_us[kNumServo];		//monotonic time of the read (-1 = never read)
+		alignas(64) unsigned char status_error[kNumServo];
+		alignas(64) unsigned char status_detail[kNumServo];
+		alignas(64) unsigned char torque_control[kNumServo];
+		alignas(64) unsigned char led[kNumServo];
+		alignas(64) unsigned char voltage[kNumServo];
+		alignas(64) unsigned char temperature[kNumServo];
+		alignas(64) unsigned char control_mode[kNumServo];
+		alignas(64) unsigned char tick[kNumServo];
+		alignas(64) unsigned short calibrated_position[kNumServo];
+		alignas(64) unsigned short absolute_position[kNumServo];
+		alignas(64) short differential_position[kNumServo];
+		alignas(64) short pwm[kNumServo];
+		alignas(64) long long rtt_us[kNumServo];
+	};
+
+	ServoStateTable();
+
+	void beginWrite();
+	void set(const ServoTelemetry& telemetry, long long timestamp_us);
+	void endWrite();
+	void publish(const ServoTelemetry* telemetry, int num_servo, long long timestamp_us);
+
+	bool read(char pID, ServoTelemetry& telemetry, long long* timestamp_us = nullptr) const;
+	float getAbsoluteAngle(char pID) const;
+	unsigned int snapshot(Fields& output) const;
+
+	/** @brief number of completed writes. Changes every cycle, so readers can tell if anything is new */
+	unsigned int version() const { return sequence.load(std::memory_order_acquire) / 2; }
+
+private:
+	alignas(64) std::atomic<unsigned int> sequence;	//odd while the writer is writing
+	Fields fields;
+
+	unsigned int readBegin() const;
+	bool readRetry(unsigned int start) const;
+};
+
+#endif /*SERVO_STATE_TABLE_HPP_*/
@@ -0,0 +1,109 @@
+#ifndef SERVO_STATUS_HPP_
+#define SERVO_STATUS_HPP_
+
+#include <stdio.h>
+
+/** Status Error bits (RAM register 48) */
+enum StatusErrorFlag
+{
+	kErrorInputVoltage = 0x01,		//Exceed Input Voltage limit
+	kErrorPotLimit = 0x02,			//Exceed allowed POT limit
+	kErrorTemperature = 0x04,		//Exceed Temperature limit
+	kErrorInvalidPacket = 0x08,		//Invalid Packet
+	kErrorOverload = 0x10,			//Overload detected
+	kErrorDriverFault = 0x20,		//Driver fault detected
+	kErrorEEPDistorted = 0x40		//EEP REG distorted
+};
+
+/** Status Detail bits (RAM register 49) */
+enum StatusDetailFlag
+{
+	kDetailMoving = 0x01,			//Moving flag
+	kDetailInposition = 0x02,		//Inposition flag
+	kDetailChecksumError = 0x04,	//Checksum Error
+	kDetailUnknownCommand = 0x08,	//Unknown Command
+	kDetailExceedRegRange = 0x10,	//Exceed REG range
+	kDetailGarbage = 0x20,			//Garbage detected
+	kDetailMotorOn = 0x40			//MOTOR_ON flag
+};
+
+/** Status error and status detail of one motor, as sent in every ACK packet
+*
+* The flags are tested with bitmasks, so checking a status costs no I/O. \n
+* describe() formats the flags into a buffer, for logging outside of the control loop.
+*
+* Created by:
+* @author Er Jie Kai (EJK)
+ */
+struct ServoStatus
+{
+	unsigned char error = 0;
+	unsigned char detail = 0;
+
+	ServoStatus() {}
+	ServoStatus(unsigned char error, unsigned char detail) : error(error), detail(detail) {}
+
+	/** @brief true if any status error bit is set (bit 7 is reserved and ignored) */
+	bool hasError() const { return (error & 0x7F) != 0; }
+	bool has(StatusErrorFlag flag) const { return (error & flag) != 0; }
+	bool has(StatusDetailFlag flag) const { return (detail & flag) != 0; }
+	bool isMoving() const { return has(kDetailMoving); }
+	bool isInPosition() const { return has(kDetailInposition); }
+	bool isMotorOn() const { return has(kDetailMotorOn); }
+
+	/** @brief combined code: status_error << 8 | status_detail */
+	int code() const { return (error << 8) | detail; }
+
+	bool operator==(const ServoStatus& other) const { return error == other.error && detail == other.detail; }
+	bool operator!=(const ServoStatus& other) const { return !(*this == other); }
+
+	/** @brief Write the names of all set flags into output
+	*
+	* @param[out] output the text buffer
+	* @param[in] len size of output
+	*
+	* @return returns the number of characters written (excluding the terminating 0)
+	*/
+	int describe(char* output, int len) const
+	{
+		static const char* error_names[] = { "Exceed input voltage limit", "Exceed allowed potentiometer limit", "Exceed temperature limit",
+			"Invalid packet", "Overload detected", "Driver fault detected", "EEP register distorted" };
+		static const char* detail_names[] = { "Moving", "Inposition", "Checksum error", "Unknown command",
+			"Exceed register range", "Garbage detected", "MOTOR_ON" };
+
+		if (len <= 0)
+			return 0;
+		output[0] = '\0';
+		int written = snprintf(output, len, "Error[0x%02x] Detail[0x%02x]", error, detail);
+		for (int bit = 0; bit < 7 && written < len; bit++)
+		{
+			if (error & (1 << bit))
+				written += snprintf(output + written, len - written, " %s,", error_names[bit]);
+		}
+		for (int bit = 0; bit < 7 && written < len; bit++)
+		{
+			if (detail & (1 << bit))
+				written += snprintf(output + written, len - written, " %s,", detail_names[bit]);
+		}
+		if (written >= len)
+			written = len - 1;
+		return written;
+	}
+};
+
+/** What the driver does by itself when a motor reports a status error. The flags can be combined */
+enum RecoveryPolicy
+{
+	kRecoverNone = 0x00,		//only report the status
+	kRecoverAutoClear = 0x01,	//clear the status error
+	kRecoverTorqueOff = 0x02,	//make the motor torque free
+	kRecoverEscalate = 0x04		//call the recovery callback
+};
+
+/** Called with (context, pID, status) when a motor reports an error and kRecoverEscalate is set */
+typedef void (*RecoveryCallback)(void* context, char pID, const ServoStatus& status);
+
+/** Called with (context, pID, previous status, new status) when the status reported by a motor changes */
+typedef void (*StatusChangeCallback)(void* context, char pID, const ServoStatus& previous, const ServoStatus& current);
+
+#endif /*SERVO_STATUS_HPP_*/
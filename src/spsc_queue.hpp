@@ -0,0 +1,63 @@
+#ifndef SPSC_QUEUE_HPP_
+#define SPSC_QUEUE_HPP_
+
+#include <atomic>
+
+/** Lock-free single-producer / single-consumer ring
+*
+* One thread calls push(), one other thread calls pop(). Neither call blocks, allocates or makes a syscall. \n
+* The indices only ever increase and wrap around naturally, so the ring holds exactly Capacity items. \n
+* The producer and consumer indices are on separate cache lines, so the two threads do not invalidate each other on every call.
+*
+* @note Capacity must be a power of 2
+*
+* Created by:
+* @author Er Jie Kai (EJK)
+ */
+template <typename T, unsigned int Capacity>
+class SpscQueue
+{
+	static_assert(Capacity > 0 && (Capacity & (Capacity - 1)) == 0, "SpscQueue capacity must be a power of 2");
+
+public:
+	SpscQueue() : head(0), tail(0) {}
+
+	/** @brief Add an item. Producer thread only
+	*
+	* @return returns false if the queue is full (the item is not added)
+	*/
+	bool push(const T& item)
+	{
+		unsigned int t = tail.load(std::memory_order_relaxed);
+		if (t - head.load(std::memory_order_acquire) == Capacity)
+			return false;
+		items[t & (Capacity - 1)] = item;
+		tail.store(t + 1, std::memory_order_release);
+		return true;
+	}
+
+	/** @brief Remove the oldest item. Consumer thread only
+	*
+	* @return returns false if the queue is empty
+	*/
+	bool pop(T& item)
+	{
+		unsigned int h = head.load(std::memory_order_relaxed);
+		if (h == tail.load(std::memory_order_acquire))
+			return false;
+		item = items[h & (Capacity - 1)];
+		head.store(h + 1, std::memory_order_release);
+		return true;
+	}
+
+	bool empty() const { return head.load(std::memory_order_acquire) == tail.load(std::memory_order_acquire); }
+	unsigned int size() const { return tail.load(std::memory_order_acquire) - head.load(std::memory_order_acquire); }
+	unsigned int capacity() const { return Capacity; }
+
+private:
+	alignas(64) std::atomic<unsigned int> head;	//next item to pop, written by the consumer
+	alignas(64) std::atomic<unsigned int> tail;	//next free slot, written by the producer
+	alignas(64) T items[Capacity];
+};
+
+#endif /*SPSC_QUEUE_HPP_*/
@@ -0,0 +1,324 @@
+#include "transaction_scheduler.hpp"
+#include <chrono>
+#include <cstring>
+
+/** @brief Create an empty scheduler
+*
+* @param[in] hlx the driver of the bus
+* @param[in] timing baudrate and turnaround of the bus, used to compute the bus time of every transaction
+*/
+TransactionScheduler::TransactionScheduler(HerkulexDriver& hlx, const BusTiming& timing)
+	: hlx(hlx), timing(timing)
+{
+}
+
+/** @brief Monotonic time in microseconds, the clock of all deadlines */
+long long TransactionScheduler::nowMicros()
+{
+	return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/** @brief Bus time of a transaction
+*
+* @param[in] transaction the transaction
+*
+* @return returns the time in microseconds (request, and turnaround and reply when the motor replies)
+*/
+long long TransactionScheduler::cost(const BusTransaction& transaction) const
+{
+	switch (transaction.kind)
+	{
+	case BusTransaction::kRead:
+		return timing.readTime(transaction.length);
+	case BusTransaction::kJog:
+	{
+		// jogs are sent to the broadcast id, so there is no reply
+		int datalen = transaction.individual ? 5 * transaction.num_jog : 1 + 4 * transaction.num_jog;
+		return timing.wireTime(BusTiming::kHeaderSize + datalen);
+	}
+	default:
+		return timing.writeTime(transaction.length, ack_policy >= 2 && (unsigned char)transaction.pID != HerkulexDriver::kBroadcastID);
+	}
+}
+
+/** @brief Queue a transaction
+*
+* @param[in] transaction the transaction. cost_us is computed here
+*
+* @return returns false if kMaxTransaction transactions are already queued
+*/
+bool TransactionScheduler::submit(const BusTransaction& transaction)
+{
+	if (num_queued >= kMaxTransaction)
+		return false;
+	queue[num_queued] = transaction;
+	queue[num_queued].cost_us = cost(transaction);
+	sequence[num_queued] = next_sequence++;
+	num_queued++;
+	return true;
+}
+
+/** @brief Queue a register write
+*
+* @param[in] pID id of the motor
+* @param[in] address first register address
+* @param[in] values the bytes to write
+* @param[in] len number of bytes (max RegisterReply::kMaxLength)
+* @param[in] deadline_us monotonic time by which the write should be sent
+* @param[in] priority importance of the write
+* @param[in] eep write the EEP registers instead of the RAM registers
+*
+* @return returns false if the queue is full
+*/
+bool TransactionScheduler::submitWrite(char pID, unsigned char address, const unsigned char* values, unsigned char len, long long deadline_us,
+	TransactionPriority priority, bool eep)
+{
+	if (len > RegisterReply::kMaxLength)
+		return false;
+	BusTransaction t;
+	t.kind = BusTransaction::kWrite;
+	t.priority = priority;
+	t.deadline_us = deadline_us;
+	t.pID = pID;
+	t.address = address;
+	t.length = len;
+	t.eep = eep;
+	memcpy(t.data, values, len);
+	return submit(t);
+}
+
+/** @brief Queue a register read
+*
+* @param[in] pID id of the motor
+* @param[in] address first register address
+* @param[in] len number of bytes (max RegisterReply::kMaxLength)
+* @param[in] deadline_us monotonic time by which the read should be sent
+* @param[in] callback called with the reply, or with status kReplyTimeout if the read is dropped. It may submit new transactions
+* @param[in] context passed to callback
+* @param[in] priority importance of the read
+* @param[in] drop_when_late drop the read if it could not be sent before its deadline
+*
+* @return returns false if the queue is full
+*/
+bool TransactionScheduler::submitRead(char pID, unsigned char address, unsigned char len, long long deadline_us, TransactionCallback callback, void* context,
+	TransactionPriority priority, bool drop_when_late)
+{
+	if (len > RegisterReply::kMaxLength)
+		return false;
+	BusTransaction t;
+	t.kind = BusTransaction::kRead;
+	t.priority = priority;
+	t.deadline_us = deadline_us;
+	t.drop_when_late = drop_when_late;
+	t.pID = pID;
+	t.address = address;
+	t.length = len;
+	t.callback = callback;
+	t.context = context;
+	return submit(t);
+}
+
+/** @brief Queue a setpoint (S_JOG or I_JOG)
+*
+* @param[in] entries the motors to move. See HerkulexDriver::runMotor
+* @param[in] num_entries number of entries (max BusTransaction::kMaxJog)
+* @param[in] deadline_us monotonic time by which the setpoint should be sent
+* @param[in] individual use I_JOG (per motor time) instead of S_JOG
+*
+* @return returns false if the queue is full
+*/
+bool TransactionScheduler::submitJog(const S_JOG_TAG* entries, char num_entries, long long deadline_us, bool individual)
+{
+	if (num_entries > BusTransaction::kMaxJog)
+		return false;
+	BusTransaction t;
+	t.kind = BusTransaction::kJog;
+	t.priority = kPrioritySetpoint;
+	t.deadline_us = deadline_us;
+	for (int i = 0; i < num_entries; i++)
+		t.jog[i] = entries[i];
+	t.num_jog = num_entries;
+	t.individual = individual;
+	return submit(t);
+}
+
+/** @brief Queue a torque off (RAM register 52 = 0x00) at safety priority. It is sent in the next cycle, before anything else
+*
+* @param[in] pID id of the motor (kBroadcastID for all the motors)
+*
+* @return returns false if the queue is full
+*/
+bool TransactionScheduler::submitTorqueOff(char pID)
+{
+	const unsigned char torque_free = 0x00;
+	return submitWrite(pID, RegTorqueControl::kAddress, &torque_free, RegTorqueControl::kWidth, nowMicros(), kPrioritySafety);
+}
+
+// true if queue[a] must be considered before queue[b]
+bool TransactionScheduler::before(int a, int b) const
+{
+	const BusTransaction& ta = queue[a];
+	const BusTransaction& tb = queue[b];
+	bool safety_a = ta.priority == kPrioritySafety;
+	bool safety_b = tb.priority == kPrioritySafety;
+	if (safety_a != safety_b)
+		return safety_a;
+	if (ta.deadline_us != tb.deadline_us)
+		return ta.deadline_us < tb.deadline_us;
+	if (ta.priority != tb.priority)
+		return ta.priority < tb.priority;
+	return sequence[a] < sequence[b];
+}
+
+/** @brief Send the transactions of one cycle
+*
+* @param[in] budget_us bus time available in this cycle in microseconds (eg: 80% of the control period)
+*
+* @return returns the report of the cycle
+*/
+BusCycleReport TransactionScheduler::runCycle(long long budget_us)
+{
+	long long start_us = nowMicros();
+	BusCycleReport report;
+	report.budget_us = budget_us;
+	const int num_cycle = num_queued; // the callbacks may submit more: those wait for the next cycle
+
+	// earliest deadline first, safety before everything
+	int order[kMaxTransaction];
+	for (int i = 0; i < num_cycle; i++)
+	{
+		int k = i;
+		while (k > 0 && before(i, order[k - 1]))
+		{
+			order[k] = order[k - 1];
+			k--;
+		}
+		order[k] = i;
+	}
+
+	int chosen[kMaxTransaction];
+	int num_chosen = 0;
+	bool keep[kMaxTransaction] = { false };
+	for (int i = 0; i < num_cycle; i++)
+	{
+		const BusTransaction& t = queue[order[i]];
+		if (t.priority == kPrioritySafety)
+		{
+			chosen[num_chosen++] = order[i];
+			report.planned_us += t.cost_us;
+		}
+		else if (t.drop_when_late && t.deadline_us < start_us)
+		{
+			dropRead(t);
+			report.dropped++;
+		}
+		else if (report.planned_us + t.cost_us <= budget_us)
+		{
+			chosen[num_chosen++] = order[i];
+			report.planned_us += t.cost_us;
+		}
+		else
+		{
+			keep[order[i]] = true;
+			report.deferred++;
+		}
+	}
+	report.sent = num_chosen;
+
+	// writes and setpoints in one burst, in the chosen order
+	hlx.beginBatch();
+	for (int i = 0; i < num_chosen; i++)
+	{
+		BusTransaction& t = queue[chosen[i]];
+		if (t.kind == BusTransaction::kWrite)
+			hlx.writeRegisters(t.pID, t.address, t.data, t.length, t.eep, t.priority == kPrioritySafety); // safety writes are never suppressed by the shadow
+		else if (t.kind == BusTransaction::kJog && t.individual)
+			hlx.runMotorIndividual(t.jog, t.num_jog);
+		else if (t.kind == BusTransaction::kJog)
+			hlx.runMotor(t.jog, t.num_jog);
+	}
+	hlx.endBatch();
+	sendReads(chosen, num_chosen);
+
+	// keep the deferred transactions, then the ones submitted during the cycle, in submission order
+	int kept = 0;
+	for (int i = 0; i < num_queued; i++)
+	{
+		if (i < num_cycle && !keep[i])
+			continue;
+		if (kept != i)
+		{
+			queue[kept] = queue[i];
+			sequence[kept] = sequence[i];
+		}
+		kept++;
+	}
+	num_queued = kept;
+
+	report.elapsed_us = nowMicros() - start_us;
+	last_report = report;
+	totals.sent += report.sent;
+	totals.deferred += report.deferred;
+	totals.dropped += report.dropped;
+	totals.planned_us += report.planned_us;
+	totals.budget_us += report.budget_us;
+	totals.elapsed_us += report.elapsed_us;
+	return report;
+}
+
+// sends the chosen reads, pipelined per register block, in the chosen order of the first read of every block
+void TransactionScheduler::sendReads(const int* chosen, int num_chosen)
+{
+	bool done[kMaxTransaction] = { false };
+	for (int i = 0; i < num_chosen; i++)
+	{
+		const BusTransaction& first = queue[chosen[i]];
+		if (first.kind != BusTransaction::kRead || done[i])
+			continue;
+
+		char pIDs[kMaxTransaction];
+		int members[kMaxTransaction];
+		int num_ids = 0;
+		for (int j = i; j < num_chosen; j++)
+		{
+			const BusTransaction& t = queue[chosen[j]];
+			if (!done[j] && t.kind == BusTransaction::kRead && t.address == first.address && t.length == first.length && t.eep == first.eep)
+			{
+				done[j] = true;
+				members[num_ids] = chosen[j];
+				pIDs[num_ids++] = t.pID;
+			}
+		}
+
+		RegisterReply replies[kMaxTransaction];
+		hlx.readRegisters(pIDs, num_ids, first.address, first.length, replies, first.eep);
+		for (int k = 0; k < num_ids; k++)
+		{
+			const BusTransaction& t = queue[members[k]];
+			if (t.callback != nullptr)
+				t.callback(t.context, replies[k]);
+		}
+	}
+}
+
+void TransactionScheduler::dropRead(const BusTransaction& transaction)
+{
+	if (transaction.kind != BusTransaction::kRead || transaction.callback == nullptr)
+		return;
+	RegisterReply reply;
+	reply.pID = transaction.pID;
+	reply.status = kReplyTimeout;
+	transaction.callback(transaction.context, reply);
+}
+
+/** @brief Print the totals of all cycles
+*
+* @return returns nothing
+*/
+void TransactionScheduler::printStats() const
+{
+	printf("TransactionScheduler: %d sent, %d deferred, %d dropped, bus utilization %.1f%% of the budget\n", totals.sent, totals.deferred, totals.dropped,
+		100.0 * totals.utilization());
+	printf("  last cycle: %d sent, %d deferred, %d dropped, planned %lld us, elapsed %lld us, budget %lld us\n", last_report.sent, last_report.deferred,
+		last_report.dropped, last_report.planned_us, last_report.elapsed_us, last_report.budget_us);
+}
@@ -0,0 +1,146 @@
+#ifndef TRANSACTION_SCHEDULER_HPP_
+#define TRANSACTION_SCHEDULER_HPP_
+
+#include "herkulex_driver.hpp"
+#include "bus_timing.hpp"
+
+/** Importance of a transaction. Lower values are more important */
+enum TransactionPriority
+{
+	kPrioritySafety = 0,	//always sent first, never dropped (eg: torque off)
+	kPrioritySetpoint = 1,	//motion commands, never dropped
+	kPriorityNormal = 2,	//configuration writes
+	kPriorityPoll = 3		//telemetry reads, dropped when stale
+};
+
+/** Called with (context, reply) when a read transaction completes, times out or is dropped (reply.status = kReplyTimeout) */
+typedef void (*TransactionCallback)(void* context, const RegisterReply& reply);
+
+/** One queued bus transaction
+* @param[in] kind write, read or jog
+* @param[in] priority see TransactionPriority
+* @param[in] deadline_us monotonic time in microseconds by which the transaction should be on the bus
+* @param[in] drop_when_late drop the transaction instead of sending it after its deadline
+* @param[in] pID, address, length, eep, data the registers (kWrite, kRead)
+* @param[in] jog, num_jog, individual the motors to move, with S_JOG or I_JOG (kJog)
+* @param[in] callback, context called with the reply (kRead)
+* @param[out] cost_us bus time of the transaction in microseconds
+*/
+struct BusTransaction
+{
+	static const int kMaxJog = 16;
+
+	enum Kind
+	{
+		kWrite,
+		kRead,
+		kJog
+	};
+
+	Kind kind = kWrite;
+	TransactionPriority priority = kPriorityNormal;
+	long long deadline_us = 0;
+	bool drop_when_late = false;
+
+	char pID = 0;
+	unsigned char address = 0;
+	unsigned char length = 0;
+	bool eep = false;
+	unsigned char data[RegisterReply::kMaxLength];
+
+	S_JOG_TAG jog[kMaxJog];
+	char num_jog = 0;
+	bool individual = false;
+
+	TransactionCallback callback = nullptr;
+	void* context = nullptr;
+
+	long long cost_us = 0;
+};
+
+/** Bus traffic of one cycle of TransactionScheduler::runCycle()
+* @param[out] sent number of transactions sent
+* @param[out] deferred number of transactions kept for the next cycle because the budget was used up
+* @param[out] dropped number of stale transactions dropped
+* @param[out] planned_us bus time of the sent transactions, computed with BusTiming
+* @param[out] budget_us bus time available in the cycle
+* @param[out] elapsed_us measured time of the cycle
+*/
+struct BusCycleReport
+{
+	int sent = 0;
+	int deferred = 0;
+	int dropped = 0;
+	long long planned_us = 0;
+	long long budget_us = 0;
+	long long elapsed_us = 0;
+
+	/** @brief fraction of the budget used by the sent transactions */
+	double utilization() const { return budget_us > 0 ? (double)planned_us / budget_us : 0.0; }
+};
+
+/** Orders bus transactions by deadline and fits every cycle into its bus time budget
+*
+* Every queued transaction knows its bus time (request + turnaround + expected reply, from BusTiming). runCycle() then sends:
+* 1. all safety transactions, even beyond the budget. Safety writes bypass the register shadow of the driver, so a torque off is always sent \n
+* 2. the other transactions earliest deadline first (ties: most important first), while they fit in the budget \n
+* Transactions that do not fit are deferred to the next cycle, except stale ones marked drop_when_late (telemetry polls), which are dropped.
+* So setpoints are delivered even when telemetry demand spikes: the polls are the ones deferred or dropped. \n
+* The chosen writes and jogs go out first in one TX burst, then the chosen reads, pipelined per register block. \n
+* A callback may submit new transactions: they are planned in the next cycle.
+*
+* Usage: \n
+* TransactionScheduler scheduler(hlx, BusTiming(115200, 100)); \n
+* scheduler.submitJog(sjog, 3, now + 10000); \n
+* scheduler.submitRead(1, RegAbsolutePosition::kAddress, 2, now + 20000, onPosition, &state); \n
+* BusCycleReport report = scheduler.runCycle(8000); // 8ms of bus time
+*
+* Created by:
+* @author Er Jie Kai (EJK)
+ */
+class TransactionScheduler
+{
+public:
+	static const int kMaxTransaction = 64;
+
+	TransactionScheduler(HerkulexDriver& hlx, const BusTiming& timing);
+
+	void setAckPolicy(int policy) { ack_policy = policy; }
+
+	bool submit(const BusTransaction& transaction);
+	bool submitWrite(char pID, unsigned char address, const unsigned char* values, unsigned char len, long long deadline_us,
+		TransactionPriority priority = kPriorityNormal, bool eep = false);
+	bool submitRead(char pID, unsigned char address, unsigned char len, long long deadline_us, TransactionCallback callback, void* context,
+		TransactionPriority priority = kPriorityPoll, bool drop_when_late = true);
+	bool submitJog(const S_JOG_TAG* entries, char num_entries, long long deadline_us, bool individual = false);
+	bool submitTorqueOff(char pID);
+
+	BusCycleReport runCycle(long long budget_us);
+
+	long long cost(const BusTransaction& transaction) const;
+	int pending() const { return num_queued; }
+	const BusCycleReport& getLastReport() const { return last_report; }
+	const BusCycleReport& getTotals() const { return totals; }
+	void printStats() const;
+
+	static long long nowMicros();
+
+private:
+	HerkulexDriver& hlx;
+	BusTiming timing;
+	int ack_policy = 1;		//ACK policy of the motors (RAM register 1). writes are only replied to with policy 2
+
+	BusTransaction queue[kMaxTransaction];
+	int num_queued = 0;
+	long long next_sequence = 0;	//keeps submission order among equal deadlines
+	long long sequence[kMaxTransaction];
+
+	BusCycleReport last_report;
+	BusCycleReport totals;
+
+	bool before(int a, int b) const;
+	void sendReads(const int* chosen, int num_chosen);
+	static void dropRead(const BusTransaction& transaction);
+};
+
+#endif /*TRANSACTION_SCHEDULER_HPP_*/
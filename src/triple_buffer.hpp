@@ -0,0 +1,61 @@
+#ifndef TRIPLE_BUFFER_HPP_
+#define TRIPLE_BUFFER_HPP_
+
+#include <atomic>
+
+/** Wait-free latest-value exchange between one writer thread and one reader thread
+*
+* The writer fills writeBuffer() and calls publish(). The reader calls update() and then reads readBuffer(). \n
+* Three copies of T rotate through the writer, the reader and a middle slot that is swapped with one atomic exchange,
+* so neither side ever waits for the other and the reader always sees a complete value. Values published between two update() calls are skipped.
+*
+* Created by:
+* @author Er Jie Kai (EJK)
+ */
+template <typename T>
+class TripleBuffer
+{
+public:
+	TripleBuffer() : middle(1), back(0), front(2) {}
+
+	/** @brief The buffer being filled by the writer */
+	T& writeBuffer() { return buffers[back]; }
+
+	/** @brief Make the write buffer the latest value. Writer thread only
+	*
+	* @return returns nothing
+	*/
+	void publish()
+	{
+		back = middle.exchange(back | kNewBit, std::memory_order_acq_rel) & kIndexMask;
+	}
+
+	/** @brief Take the latest published value, if any. Reader thread only
+	*
+	* @return returns true if readBuffer() now holds a newer value
+	*/
+	bool update()
+	{
+		if (!(middle.load(std::memory_order_acquire) & kNewBit))
+			return false;
+		front = middle.exchange(front, std::memory_order_acq_rel) & kIndexMask;
+		return true;
+	}
+
+	/** @brief The latest value taken by update() */
+	const T& readBuffer() const { return buffers[front]; }
+
+private:
+	enum
+	{
+		kIndexMask = 0x03,
+		kNewBit = 0x04		//set when the middle slot holds a value the reader has not taken yet
+	};
+
+	T buffers[3];
+	alignas(64) std::atomic<int> middle;
+	alignas(64) int back;	//owned by the writer
+	alignas(64) int front;	//owned by the reader
+};
+
+#endif /*TRIPLE_BUFFER_HPP_*/